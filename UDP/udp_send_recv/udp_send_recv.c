@@ -23,6 +23,9 @@
 // DHCP
 #include "dhcpserver/dhcpserver.h"
 
+// Load test
+#include "traffic.h"
+
 /*
  *  DEBUGGING
  */
@@ -65,14 +68,30 @@ static struct udp_pcb* udp_send_pcb;
 char send_data[UDP_MSG_LEN_MAX];
 struct pt_sem new_udp_send_s;
 
-// UDP ack
-char return_addr_str[20] = "255.255.255.255";
+// UDP ack. A burst of data (e.g. "tg rate=max") can arrive before the ack
+// thread runs, so acks are queued instead of overwriting a single slot.
+typedef struct pending_ack {
+    char addr[20]; // Return address
+    int ack_number;
+    char timestamp[50];
+    bool is_traffic; // Was the data being acked a load test packet?
+} pending_ack_t;
+
+#define ACK_QUEUE_LEN 4
+pending_ack_t ack_queue[ACK_QUEUE_LEN];
+unsigned int ack_head = 0; // Acks ever queued
+unsigned int ack_tail = 0; // Acks ever sent by the ack thread
 static ip_addr_t return_addr;
-int return_ack_number;
-char return_timestamp[50];
 static struct udp_pcb* udp_ack_pcb;
 struct pt_sem new_udp_ack_s;
 
+// Load test started with the "tg" command (see traffic.h)
+traffic_gen_t traffic_gen;
+traffic_sink_t traffic_sink;
+
+// Set while send_data waits for the send thread
+bool send_pending = false;
+
 // Bruce Land's TCP server structure. Stores metadata for an access point hosted
 // by a Pico-W. This includes the IPv4 address.
 typedef struct TCP_SERVER_T_ {
@@ -274,13 +293,16 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
         memcpy(req, buffer, udp_send_length);
 
 #ifdef PRINT_ON_SEND
-        // Print formatted packet contents
-        printf("| Outgoing...\n");
-        printf("|\tpayload: { %s }\n", buffer);
-        printf("|\tdest:    %s\n", dest_addr_str);
-        printf("|\tnum:     %d\n", packet_counter);
-        printf("|\tmsg:     %s\n", send_data);
-        printf("\n");
+        // Print formatted packet contents, load test packets are only
+        // counted
+        if (!traffic_is_payload(send_data)) {
+            printf("| Outgoing...\n");
+            printf("|\tpayload: { %s }\n", buffer);
+            printf("|\tdest:    %s\n", dest_addr_str);
+            printf("|\tnum:     %d\n", packet_counter);
+            printf("|\tmsg:     %s\n", send_data);
+            printf("\n");
+        }
 #endif
 
         // Send packet
@@ -292,11 +314,15 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
             packet_counter++;
         } else {
             printf("Failed to send UDP packet! error=%d\n", er);
+            traffic_send_failed(&traffic_gen, send_data);
         }
 
         // Free the packet buffer
         pbuf_free(p);
 
+        // send_data can be written again
+        send_pending = false;
+
         PT_YIELD(pt);
     }
 
@@ -328,6 +354,9 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
 
     static float rtt_ms;
 
+    // Load test packets and their acks aren't printed
+    static bool quiet;
+
     while (true) {
         // Wait until the buffer is written
         PT_SEM_WAIT(pt, &new_udp_recv_s);
@@ -363,29 +392,49 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
         token = strtok(NULL, ";");
         copy_field(msg, token);
 
+        // Count load test packets and acks
+        quiet = false;
+        if (strcmp(packet_type, "data") == 0 && traffic_is_payload(msg)) {
+            traffic_receive(&traffic_sink, msg, time_us_64());
+            quiet = true;
+        } else if (strcmp(packet_type, "ack") == 0 && traffic_gen.sent > 0) {
+            traffic_ack(&traffic_gen, (uint32_t) (time_us_64() - timestamp),
+                        time_us_64());
+            quiet = traffic_gen.active;
+        }
+
 #ifdef PRINT_ON_RECV
         // Print formatted packet contents
-        printf("| Incoming...\n");
-        printf("|\tPayload: { %s }\n", recv_data);
-        printf("|\ttype:    %s\n", packet_type);
-        printf("|\tfrom:    %s\n", src_addr);
-        printf("|\tack:     %s\n", packet_num);
-        if (strcmp(packet_type, "data") == 0) {
-            printf("|\tmsg:     %s\n", msg);
-        } else if (strcmp(packet_type, "ack") == 0) {
-            printf("|\tRTT:     %.2f ms\n", rtt_ms);
-        } else {
-            printf("|\tmsg:     %s\n", msg);
+        if (!quiet) {
+            printf("| Incoming...\n");
+            printf("|\tPayload: { %s }\n", recv_data);
+            printf("|\ttype:    %s\n", packet_type);
+            printf("|\tfrom:    %s\n", src_addr);
+            printf("|\tack:     %s\n", packet_num);
+            if (strcmp(packet_type, "data") == 0) {
+                printf("|\tmsg:     %s\n", msg);
+            } else if (strcmp(packet_type, "ack") == 0) {
+                printf("|\tRTT:     %.2f ms\n", rtt_ms);
+            } else {
+                printf("|\tmsg:     %s\n", msg);
+            }
+            printf("\n");
         }
-        printf("\n");
 #endif
 
         // If data was received, respond with ACK
-        if (strcmp(packet_type, "data") == 0) {
-            // Assign return address and ACK number
-            strcpy(return_addr_str, src_addr);
-            strcpy(return_timestamp, timestamp_str);
-            return_ack_number = atoi(packet_num);
+        if (strcmp(packet_type, "data") == 0
+            && ack_head - ack_tail == ACK_QUEUE_LEN) {
+            printf("Ack queue full, not acking %s\n", packet_num);
+        } else if (strcmp(packet_type, "data") == 0) {
+            // Queue the return address and ACK number
+            pending_ack_t* ack = &ack_queue[ack_head % ACK_QUEUE_LEN];
+            snprintf(ack->addr, sizeof(ack->addr), "%s", src_addr);
+            snprintf(ack->timestamp, sizeof(ack->timestamp), "%s",
+                     timestamp_str);
+            ack->ack_number = atoi(packet_num);
+            ack->is_traffic = quiet;
+            ack_head++;
 
             // Signal ACK thread
             PT_SEM_SIGNAL(pt, &new_udp_ack_s);
@@ -421,19 +470,24 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
     // Stores the address of the pbuf payload
     static char* req;
 
+    // Oldest queued ack, its slot isn't reused until it has been sent
+    static pending_ack_t* ack;
+
     // Error code
     static err_t er;
 
     while (true) {
-        // Wait until the buffer is written
+        // Wait until an ack is queued
         PT_SEM_WAIT(pt, &new_udp_ack_s);
 
+        ack = &ack_queue[ack_tail % ACK_QUEUE_LEN];
+
         // Assign target pico IP address
-        ipaddr_aton(return_addr_str, &return_addr);
+        ipaddr_aton(ack->addr, &return_addr);
 
         // Append header to the payload
-        sprintf(buffer, "%s;%s;%d;%s", "ack", my_addr, return_ack_number,
-                return_timestamp);
+        sprintf(buffer, "%s;%s;%d;%s", "ack", my_addr, ack->ack_number,
+                ack->timestamp);
 
         // Allocate pbuf
         udp_ack_length = strlen(buffer);
@@ -447,11 +501,13 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
 
 #ifdef PRINT_ON_SEND
         // Print formatted packet contents
-        printf("| Outgoing...\n");
-        printf("|\tPayload: { %s }\n", buffer);
-        printf("|\tdest:    %s\n", return_addr_str);
-        printf("|\tnum:     %d\n", return_ack_number);
-        printf("\n");
+        if (!ack->is_traffic) {
+            printf("| Outgoing...\n");
+            printf("|\tPayload: { %s }\n", buffer);
+            printf("|\tdest:    %s\n", ack->addr);
+            printf("|\tnum:     %d\n", ack->ack_number);
+            printf("\n");
+        }
 #endif
         // Send packet
         // cyw43_arch_lwip_begin();
@@ -465,6 +521,9 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
         // Free the packet buffer
         pbuf_free(p);
 
+        // Release the slot
+        ack_tail++;
+
         PT_YIELD(pt);
     }
 
@@ -489,6 +548,15 @@ static PT_THREAD(protothread_serial(struct pt* pt))
         serial_write;
         serial_read;
 
+        // Load test commands aren't sent
+        if (strncmp(pt_serial_in_buffer, "tg", 2) == 0
+            && (pt_serial_in_buffer[2] == ' '
+                || pt_serial_in_buffer[2] == '\0')) {
+            traffic_command(pt_serial_in_buffer + 2, &traffic_gen,
+                            &traffic_sink, time_us_64());
+            continue;
+        }
+
         // Write message to send buffer
         memset(send_data, 0, UDP_MSG_LEN_MAX);
         sprintf(send_data, "%s", pt_serial_in_buffer);
@@ -500,6 +568,33 @@ static PT_THREAD(protothread_serial(struct pt* pt))
     PT_END(pt);
 }
 
+// =================================================
+// Traffic generator thread
+// =================================================
+static PT_THREAD(protothread_traffic(struct pt* pt))
+{
+    PT_BEGIN(pt);
+
+    while (true) {
+        PT_YIELD_UNTIL(pt, traffic_report_due(&traffic_gen, &traffic_sink,
+                                              time_us_64())
+                               || (!send_pending
+                                   && traffic_due(&traffic_gen, time_us_64())));
+
+        traffic_report(&traffic_gen, &traffic_sink, time_us_64());
+
+        if (!send_pending && traffic_due(&traffic_gen, time_us_64())) {
+            // Same path as a typed message
+            traffic_next(&traffic_gen, send_data, time_us_64());
+            send_pending = true;
+
+            PT_SEM_SIGNAL(pt, &new_udp_send_s);
+        }
+    }
+
+    PT_END(pt);
+}
+
 /*
  *  CORE 1 MAIN
  */
@@ -661,6 +756,7 @@ int main()
     pt_add_thread(protothread_udp_recv);
     pt_add_thread(protothread_udp_ack);
     pt_add_thread(protothread_serial);
+    pt_add_thread(protothread_traffic);
     pt_schedule_start;
 
     // De-initialize the cyw43 architecture.
@@ -24,6 +24,9 @@
 // DHCP
 #include "dhcpserver/dhcpserver.h"
 
+// Load test
+#include "traffic.h"
+
 /*
  *  DEBUGGING
  */
@@ -66,11 +69,17 @@ static struct udp_pcb* udp_send_pcb;
 struct pt_sem new_udp_send_s;
 
 // UDP ack
-char return_addr_str[20] = "255.255.255.255";
 static ip_addr_t return_addr;
 static struct udp_pcb* udp_ack_pcb;
 struct pt_sem new_udp_ack_s;
 
+// Load test started with the "tg" command (see traffic.h)
+traffic_gen_t traffic_gen;
+traffic_sink_t traffic_sink;
+
+// Set while the send queue waits for the send thread (on core 1)
+volatile bool send_pending = false;
+
 // Bruce Land's TCP server structure. Stores metadata for an access point hosted
 // by a Pico-W. This includes the IPv4 address.
 typedef struct TCP_SERVER_T_ {
@@ -90,6 +99,19 @@ typedef struct TCP_SERVER_T_ {
 // SSID of the access point
 char target_ssid[SSID_LEN];
 
+// Scan for one SSID instead of every picow network (optional). Naming the SSID
+// makes the chip send directed probes and report only that network.
+// #define TARGET_SSID "picow_test"
+
+// Listen for beacons instead of sending probes
+#define PASSIVE_SCAN false
+
+// Minimum time (ms) before the driver's "scan active" flag is trusted
+#define SCAN_MIN_TIME_MS 500
+
+// Give up on a scan after this long (ms)
+#define SCAN_TIMEOUT_MS 10000
+
 // If the result of the scan is a network starting with "picow"
 static int scan_callback(void* env, const cyw43_ev_scan_result_t* result)
 {
@@ -121,9 +143,17 @@ static int scan_callback(void* env, const cyw43_ev_scan_result_t* result)
 // Initiate a wifi scan
 int find_target()
 {
-    // Scan options don't matter
     cyw43_wifi_scan_options_t scan_options = {0};
 
+#ifdef TARGET_SSID
+    // Only look for the target network
+    scan_options.ssid_len = strlen(TARGET_SSID);
+    memcpy(scan_options.ssid, TARGET_SSID, scan_options.ssid_len);
+#endif
+
+    // 0 = active, 1 = passive
+    scan_options.scan_type = PASSIVE_SCAN ? 1 : 0;
+
     printf("Starting Wifi scan...");
 
     // This function scans for nearby Wifi networks and runs the
@@ -137,7 +167,17 @@ int find_target()
         return 1;
     }
 
-    sleep_ms(5000);
+    // Wait for the scan to finish instead of a fixed time, a targeted scan is
+    // done well before a full sweep would be
+    absolute_time_t start = get_absolute_time();
+    sleep_ms(SCAN_MIN_TIME_MS);
+    while (cyw43_wifi_scan_active(&cyw43_state)
+           && absolute_time_diff_us(start, get_absolute_time())
+                  < 1000 * SCAN_TIMEOUT_MS) {
+        sleep_ms(10);
+    }
+    printf("Scan took %lld ms\n",
+           absolute_time_diff_us(start, get_absolute_time()) / 1000);
 
     return 0;
 }
@@ -165,8 +205,14 @@ typedef struct outgoing_packet {
 // Mutexes
 struct mutex send_mutex, ack_mutex;
 
-// Packet queues
-packet_t send_queue, ack_queue;
+// Packet queues. A burst of data (e.g. "tg rate=max") can arrive before the
+// ack thread runs, so acks are queued with their return addresses.
+#define ACK_QUEUE_LEN 4
+packet_t send_queue, ack_queue[ACK_QUEUE_LEN];
+char ack_addrs[ACK_QUEUE_LEN][20];
+bool ack_is_traffic[ACK_QUEUE_LEN]; // Acking a load test packet?
+unsigned int ack_head = 0;          // Acks ever queued
+unsigned int ack_tail = 0;          // Acks ever taken by the ack thread
 
 packet_t compose_packet(char* type, char* addr, int ack, uint64_t t, char* m)
 {
@@ -404,6 +450,9 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
         send_buf = send_queue;
         mutex_exit(&send_mutex);
 
+        // The queue can be written again
+        send_pending = false;
+
         // Append header to the payload
         sprintf(buffer, "%s;%s;%d;%llu;%s", send_buf.packet_type,
                 send_buf.ip_addr, send_buf.ack_num, send_buf.timestamp,
@@ -420,13 +469,16 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
         memcpy(req, buffer, udp_send_length);
 
 #ifdef PRINT_ON_SEND
-        // Print formatted packet contents
-        printf("| Outgoing...\n");
-        printf("|\tpayload: { %s }\n", buffer);
-        printf("|\tdest:    %s\n", send_buf.ip_addr);
-        printf("|\tnum:     %d\n", send_buf.ack_num);
-        printf("|\tmsg:     %s\n", send_buf.msg);
-        printf("\n");
+        // Print formatted packet contents, load test packets are only
+        // counted
+        if (!traffic_is_payload(send_buf.msg)) {
+            printf("| Outgoing...\n");
+            printf("|\tpayload: { %s }\n", buffer);
+            printf("|\tdest:    %s\n", send_buf.ip_addr);
+            printf("|\tnum:     %d\n", send_buf.ack_num);
+            printf("|\tmsg:     %s\n", send_buf.msg);
+            printf("\n");
+        }
 #endif
 
         // Send packet
@@ -438,6 +490,7 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
             packet_counter++;
         } else {
             printf("Failed to send UDP packet! error=%d\n", er);
+            traffic_send_failed(&traffic_gen, send_buf.msg);
         }
 
         // Free the packet buffer
@@ -465,6 +518,9 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
     // Incoming packet
     static packet_t recv_buf;
 
+    // Load test packets and their acks aren't printed
+    static bool quiet;
+
     while (true) {
         // Wait until the buffer is written
         PT_SEM_SAFE_WAIT(pt, &new_udp_recv_s);
@@ -472,37 +528,58 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
         // Convert the contents of the received packet to a packet_t
         recv_buf = string_to_packet(recv_data);
 
+        // Count load test packets and acks
+        quiet = false;
+        if (strcmp(recv_buf.packet_type, "data") == 0
+            && traffic_is_payload(recv_buf.msg)) {
+            traffic_receive(&traffic_sink, recv_buf.msg, time_us_64());
+            quiet = true;
+        } else if (strcmp(recv_buf.packet_type, "ack") == 0
+                   && traffic_gen.sent > 0) {
+            traffic_ack(&traffic_gen,
+                        (uint32_t) (time_us_64() - recv_buf.timestamp),
+                        time_us_64());
+            quiet = traffic_gen.active;
+        }
+
 #ifndef PRINT_ON_RECV
-        if (strcmp(recv_buf.packet_type, "ack") == 0) {
+        if (strcmp(recv_buf.packet_type, "ack") == 0 && !quiet) {
             printf("%3d", recv_buf.ack_num);
         }
 #else
         // Print formatted packet contents
-        printf("| Incoming...\n");
-        printf("|\tPayload: { %s }\n", recv_data);
-        printf("|\ttype:    %s\n", recv_buf.packet_type);
-        printf("|\tfrom:    %s\n", recv_buf.ip_addr);
-        printf("|\tack:     %d\n", recv_buf.ack_num);
-        if (strcmp(recv_buf.packet_type, "data") == 0) {
-            printf("|\tmsg:     %s\n", recv_buf.msg);
-        } else if (strcmp(recv_buf.packet_type, "ack") == 0) {
-            rtt_ms = (time_us_64() - recv_buf.timestamp) / 1000.0f;
-            printf("|\tRTT:     %.2f ms\n", rtt_ms);
-        } else {
-            printf("|\tmsg:     %s\n", recv_buf.msg);
+        if (!quiet) {
+            printf("| Incoming...\n");
+            printf("|\tPayload: { %s }\n", recv_data);
+            printf("|\ttype:    %s\n", recv_buf.packet_type);
+            printf("|\tfrom:    %s\n", recv_buf.ip_addr);
+            printf("|\tack:     %d\n", recv_buf.ack_num);
+            if (strcmp(recv_buf.packet_type, "data") == 0) {
+                printf("|\tmsg:     %s\n", recv_buf.msg);
+            } else if (strcmp(recv_buf.packet_type, "ack") == 0) {
+                rtt_ms = (time_us_64() - recv_buf.timestamp) / 1000.0f;
+                printf("|\tRTT:     %.2f ms\n", rtt_ms);
+            } else {
+                printf("|\tmsg:     %s\n", recv_buf.msg);
+            }
+            printf("\n");
         }
-        printf("\n");
 #endif
 
         // If data was received, respond with ACK
-        if (strcmp(recv_buf.packet_type, "data") == 0) {
-            // Assign return address and ACK number
-            strcpy(return_addr_str, recv_buf.ip_addr);
-
+        if (strcmp(recv_buf.packet_type, "data") == 0
+            && ack_head - ack_tail == ACK_QUEUE_LEN) {
+            printf("Ack queue full, not acking %d\n", recv_buf.ack_num);
+        } else if (strcmp(recv_buf.packet_type, "data") == 0) {
             // Write to the ack queue
             mutex_enter_blocking(&ack_mutex);
-            ack_queue = compose_packet("ack", my_addr, recv_buf.ack_num,
-                                       recv_buf.timestamp, "");
+            snprintf(ack_addrs[ack_head % ACK_QUEUE_LEN], 20, "%s",
+                     recv_buf.ip_addr);
+            ack_is_traffic[ack_head % ACK_QUEUE_LEN] = quiet;
+            ack_queue[ack_head % ACK_QUEUE_LEN] =
+                compose_packet("ack", my_addr, recv_buf.ack_num,
+                               recv_buf.timestamp, "");
+            ack_head++;
             mutex_exit(&ack_mutex);
 
             // Signal ACK thread
@@ -531,6 +608,8 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
 
     // Outgoing packet
     static packet_t ack_buf;
+    static char return_addr_str[20];
+    static bool is_traffic;
 
     // Payload
     static char buffer[UDP_MSG_LEN_MAX];
@@ -546,14 +625,18 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
         // Wait until the buffer is written
         PT_SEM_SAFE_WAIT(pt, &new_udp_ack_s);
 
-        // Assign target pico IP address
-        ipaddr_aton(return_addr_str, &return_addr);
-
         // Pop the head of the queue
         mutex_enter_blocking(&ack_mutex);
-        ack_buf = ack_queue;
+        ack_buf = ack_queue[ack_tail % ACK_QUEUE_LEN];
+        snprintf(return_addr_str, 20, "%s",
+                 ack_addrs[ack_tail % ACK_QUEUE_LEN]);
+        is_traffic = ack_is_traffic[ack_tail % ACK_QUEUE_LEN];
+        ack_tail++;
         mutex_exit(&ack_mutex);
 
+        // Assign target pico IP address
+        ipaddr_aton(return_addr_str, &return_addr);
+
         // Append header to the payload
         sprintf(buffer, "%s;%s;%d;%llu", ack_buf.packet_type, ack_buf.ip_addr,
                 ack_buf.ack_num, ack_buf.timestamp);
@@ -570,11 +653,13 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
 
 #ifdef PRINT_ON_SEND
         // Print formatted packet contents
-        printf("| Outgoing...\n");
-        printf("|\tPayload: { %s }\n", buffer);
-        printf("|\tdest:    %s\n", return_addr_str);
-        printf("|\tnum:     %d\n", ack_buf.ack_num);
-        printf("\n");
+        if (!is_traffic) {
+            printf("| Outgoing...\n");
+            printf("|\tPayload: { %s }\n", buffer);
+            printf("|\tdest:    %s\n", return_addr_str);
+            printf("|\tnum:     %d\n", ack_buf.ack_num);
+            printf("\n");
+        }
 #endif
 
         // Send packet
@@ -612,6 +697,15 @@ static PT_THREAD(protothread_serial(struct pt* pt))
         // Spawn thread for non-blocking read
         serial_read;
 
+        // Load test commands aren't sent
+        if (strncmp(pt_serial_in_buffer, "tg", 2) == 0
+            && (pt_serial_in_buffer[2] == ' '
+                || pt_serial_in_buffer[2] == '\0')) {
+            traffic_command(pt_serial_in_buffer + 2, &traffic_gen,
+                            &traffic_sink, time_us_64());
+            continue;
+        }
+
         mutex_enter_blocking(&send_mutex);
         send_queue = compose_packet("data", my_addr, packet_counter,
                                     time_us_64(), pt_serial_in_buffer);
@@ -624,6 +718,41 @@ static PT_THREAD(protothread_serial(struct pt* pt))
     PT_END(pt);
 }
 
+// =================================================
+// Traffic generator thread
+// =================================================
+static PT_THREAD(protothread_traffic(struct pt* pt))
+{
+    PT_BEGIN(pt);
+
+    // Payload of the next packet
+    static char payload[TRAFFIC_MAX_SIZE + 1];
+
+    while (true) {
+        PT_YIELD_UNTIL(pt, traffic_report_due(&traffic_gen, &traffic_sink,
+                                              time_us_64())
+                               || (!send_pending
+                                   && traffic_due(&traffic_gen, time_us_64())));
+
+        traffic_report(&traffic_gen, &traffic_sink, time_us_64());
+
+        if (!send_pending && traffic_due(&traffic_gen, time_us_64())) {
+            traffic_next(&traffic_gen, payload, time_us_64());
+
+            // Same path as a typed message
+            mutex_enter_blocking(&send_mutex);
+            send_queue = compose_packet("data", my_addr, packet_counter,
+                                        time_us_64(), payload);
+            mutex_exit(&send_mutex);
+            send_pending = true;
+
+            PT_SEM_SAFE_SIGNAL(pt, &new_udp_send_s);
+        }
+    }
+
+    PT_END(pt);
+}
+
 /*
  *  CORE 1 MAIN
  */
@@ -787,6 +916,7 @@ int main()
     pt_add_thread(protothread_udp_recv);
     pt_add_thread(protothread_udp_ack);
     pt_add_thread(protothread_serial);
+    pt_add_thread(protothread_traffic);
     pt_schedule_start;
 
     // De-initialize the cyw43 architecture.
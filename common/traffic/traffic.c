@@ -0,0 +1,418 @@
+// C libraries
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Local
+#include "traffic.h"
+
+bool traffic_is_payload(const char* msg)
+{
+    return strncmp(msg, "TG:", 3) == 0;
+}
+
+/************************************************
+ *  GENERATOR
+ ************************************************/
+
+void traffic_start(traffic_gen_t* g, const traffic_cfg_t* cfg, uint64_t now)
+{
+    memset(g, 0, sizeof(*g));
+
+    g->cfg      = *cfg;
+    g->active   = true;
+    g->start_us = now;
+    g->next_us  = now;
+
+    // A new ID per run, so the sink doesn't merge it with the last one even
+    // across a reset of this node
+    g->run = (uint32_t) (now / 1000);
+}
+
+void traffic_stop(traffic_gen_t* g, uint64_t now)
+{
+    if (!g->active) {
+        return;
+    }
+
+    g->active   = false;
+    g->reported = false;
+    g->end_us   = now;
+}
+
+bool traffic_due(traffic_gen_t* g, uint64_t now)
+{
+    if (!g->active) {
+        return false;
+    }
+
+    if ((g->cfg.count != 0 && g->sent >= g->cfg.count)
+        || (g->cfg.duration_ms != 0
+            && now - g->start_us >= 1000ULL * g->cfg.duration_ms)) {
+        traffic_stop(g, now);
+        return false;
+    }
+
+    return g->cfg.rate == 0 || now >= g->next_us;
+}
+
+int traffic_next(traffic_gen_t* g, char* buf, uint64_t now)
+{
+    int len = snprintf(buf, TRAFFIC_MAX_SIZE + 1, "TG:%lu:%lu:",
+                       (unsigned long) g->run, (unsigned long) g->seq);
+
+    // Pad to the configured size
+    while (len < g->cfg.size) {
+        buf[len++] = 'x';
+    }
+    buf[len] = '\0';
+
+    g->seq++;
+    g->sent++;
+    g->bytes += len;
+
+    if (g->cfg.rate != 0) {
+        g->next_us += 1000000ULL / g->cfg.rate;
+
+        // Catch up on short stalls, but don't burst after a reconnection
+        if (now > g->next_us + 1000000ULL) {
+            g->next_us = now;
+        }
+    }
+
+    return len;
+}
+
+void traffic_send_failed(traffic_gen_t* g, const char* msg)
+{
+    unsigned long run;
+
+    if (sscanf(msg, "TG:%lu:", &run) == 1 && run == g->run && g->sent > 0) {
+        g->errors++;
+    }
+}
+
+void traffic_ack(traffic_gen_t* g, uint32_t rtt_us, uint64_t now)
+{
+    if (g->sent == 0 || (!g->active && now - g->end_us > TRAFFIC_DRAIN_US)) {
+        return;
+    }
+
+    g->acked++;
+    g->rtt_us[g->rtt_count % TRAFFIC_RTT_SAMPLES] = rtt_us;
+    g->rtt_count++;
+}
+
+/************************************************
+ *  SINK
+ ************************************************/
+
+// Mark [seq] as seen, returns true if it already was
+static bool window_test_set(traffic_sink_t* s, uint32_t seq)
+{
+    uint32_t i   = seq % TRAFFIC_WINDOW;
+    uint32_t bit = 1u << (i % 32);
+    bool seen    = (s->seen[i / 32] & bit) != 0;
+
+    s->seen[i / 32] |= bit;
+
+    return seen;
+}
+
+static void window_clear(traffic_sink_t* s, uint32_t seq)
+{
+    uint32_t i = seq % TRAFFIC_WINDOW;
+
+    s->seen[i / 32] &= ~(1u << (i % 32));
+}
+
+void traffic_receive(traffic_sink_t* s, const char* msg, uint64_t now)
+{
+    unsigned long run, seq;
+
+    if (sscanf(msg, "TG:%lu:%lu:", &run, &seq) != 2) {
+        return;
+    }
+
+    bool first = !s->receiving || run != s->run;
+
+    // The first packet of a run
+    if (first) {
+        memset(s, 0, sizeof(*s));
+        s->receiving = true;
+        s->run       = run;
+        s->highest   = seq;
+        s->first_us  = now;
+    }
+
+    s->received++;
+    s->last_us  = now;
+    s->reported = false;
+
+    if (!first && seq <= s->highest) {
+        if (s->highest - seq < TRAFFIC_WINDOW && window_test_set(s, seq)) {
+            s->duplicates++;
+            return;
+        }
+
+        // Arrived after a higher sequence number. One older than the window
+        // can't be told apart from a duplicate, and counts as reordered.
+        s->reordered++;
+    } else if (!first) {
+        // Forget the sequence numbers that slide out of the window
+        if (seq - s->highest >= TRAFFIC_WINDOW) {
+            memset(s->seen, 0, sizeof(s->seen));
+        } else {
+            for (uint32_t i = s->highest + 1; i <= seq; i++) {
+                window_clear(s, i);
+            }
+        }
+        s->highest = seq;
+        window_test_set(s, seq);
+    } else {
+        window_test_set(s, seq);
+    }
+
+    s->unique++;
+    s->bytes += strlen(msg);
+}
+
+/************************************************
+ *  REPORTS
+ ************************************************/
+
+static bool gen_report_due(const traffic_gen_t* g, uint64_t now)
+{
+    return !g->active && !g->reported && g->sent > 0
+           && now - g->end_us >= TRAFFIC_DRAIN_US;
+}
+
+static bool sink_report_due(const traffic_sink_t* s, uint64_t now)
+{
+    return s->receiving && !s->reported && now - s->last_us >= TRAFFIC_IDLE_US;
+}
+
+bool traffic_report_due(const traffic_gen_t* g, const traffic_sink_t* s,
+                        uint64_t now)
+{
+    return gen_report_due(g, now) || sink_report_due(s, now);
+}
+
+uint64_t traffic_wake_time(const traffic_gen_t* g, const traffic_sink_t* s,
+                           uint64_t now)
+{
+    uint64_t wake = UINT64_MAX;
+
+    if (g->active) {
+        // Paced packets, a saturating run waits on the send path instead
+        if (g->cfg.rate != 0 && g->next_us > now && g->next_us < wake) {
+            wake = g->next_us;
+        }
+        if (g->cfg.duration_ms != 0) {
+            uint64_t end = g->start_us + 1000ULL * g->cfg.duration_ms;
+            if (end < wake) {
+                wake = end;
+            }
+        }
+    } else if (!g->reported && g->sent > 0) {
+        wake = g->end_us + TRAFFIC_DRAIN_US;
+    }
+
+    if (s->receiving && !s->reported && s->last_us + TRAFFIC_IDLE_US < wake) {
+        wake = s->last_us + TRAFFIC_IDLE_US;
+    }
+
+    return wake;
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+static float percent(uint32_t part, uint32_t whole)
+{
+    return whole == 0 ? 0.0f : 100.0f * part / whole;
+}
+
+// Throughput in kbit/s of [bytes] over [us]
+static float kbps(uint64_t bytes, uint64_t us)
+{
+    return us == 0 ? 0.0f : (float) (8000.0 * bytes / us);
+}
+
+static void print_gen(const traffic_gen_t* g, uint64_t now)
+{
+    // Sorted copy of the samples
+    static uint32_t sorted[TRAFFIC_RTT_SAMPLES];
+
+    uint64_t elapsed = (g->active ? now : g->end_us) - g->start_us;
+
+    printf("TRAFFIC GENERATOR (run %lu%s)\n", (unsigned long) g->run,
+           g->active ? ", running" : "");
+    if (g->cfg.dest >= 0) {
+        printf("\tdest       node %d\n", g->cfg.dest);
+    }
+    printf("\toffered    %d bytes at ", g->cfg.size);
+    if (g->cfg.rate == 0) {
+        printf("max rate\n");
+    } else {
+        printf("%lu pkt/s\n", (unsigned long) g->cfg.rate);
+    }
+    printf("\tsent       %lu packets in %.2f s (%.1f pkt/s, %.1f kbit/s)\n",
+           (unsigned long) g->sent, elapsed / 1e6,
+           elapsed == 0 ? 0.0f : (float) (1e6 * g->sent / elapsed),
+           kbps(g->bytes, elapsed));
+    printf("\terrors     %lu\n", (unsigned long) g->errors);
+    printf("\tacked      %lu (%.1f%%)\n", (unsigned long) g->acked,
+           percent(g->acked, g->sent));
+
+    uint32_t n = g->rtt_count < TRAFFIC_RTT_SAMPLES ? g->rtt_count
+                                                    : TRAFFIC_RTT_SAMPLES;
+    if (n == 0) {
+        return;
+    }
+
+    memcpy(sorted, g->rtt_us, n * sizeof(uint32_t));
+    qsort(sorted, n, sizeof(uint32_t), compare_u32);
+
+    printf("\tRTT (ms)   min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f"
+           "  (last %lu)\n",
+           sorted[0] / 1e3, sorted[(n - 1) * 50 / 100] / 1e3,
+           sorted[(n - 1) * 90 / 100] / 1e3, sorted[(n - 1) * 99 / 100] / 1e3,
+           sorted[n - 1] / 1e3, (unsigned long) n);
+}
+
+static void print_sink(const traffic_sink_t* s)
+{
+    uint64_t elapsed = s->last_us - s->first_us;
+    uint32_t lost    = s->highest + 1 > s->unique ? s->highest + 1 - s->unique
+                                                  : 0;
+
+    printf("TRAFFIC SINK (run %lu)\n", (unsigned long) s->run);
+    printf("\treceived   %lu packets in %.2f s\n", (unsigned long) s->received,
+           elapsed / 1e6);
+    printf("\tgoodput    %.1f kbit/s\n", kbps(s->bytes, elapsed));
+    printf("\tlost       %lu (%.1f%%)\n", (unsigned long) lost,
+           percent(lost, s->highest + 1));
+    printf("\treordered  %lu\n", (unsigned long) s->reordered);
+    printf("\tduplicates %lu\n", (unsigned long) s->duplicates);
+}
+
+void traffic_report(traffic_gen_t* g, traffic_sink_t* s, uint64_t now)
+{
+    if (gen_report_due(g, now)) {
+        print_gen(g, now);
+        g->reported = true;
+    }
+
+    if (sink_report_due(s, now)) {
+        print_sink(s);
+        s->reported = true;
+    }
+}
+
+void print_traffic(const traffic_gen_t* g, const traffic_sink_t* s,
+                   uint64_t now)
+{
+    if (g->sent == 0 && !g->active) {
+        printf("TRAFFIC GENERATOR: no run yet\n");
+    } else {
+        print_gen(g, now);
+    }
+
+    if (!s->receiving) {
+        printf("TRAFFIC SINK: nothing received\n");
+    } else {
+        print_sink(s);
+    }
+}
+
+/************************************************
+ *  CONSOLE
+ ************************************************/
+
+static void print_usage()
+{
+    printf("usage: tg [dest=<ID>] [size=<bytes>] [rate=<pps>|max] [count=<n>] "
+           "[time=<sec>]\n");
+    printf("       tg stop | stats | reset\n");
+}
+
+bool traffic_command(const char* args, traffic_gen_t* g, traffic_sink_t* s,
+                     uint64_t now)
+{
+    char word[24];
+    int n;
+
+    if (sscanf(args, " %23s", word) != 1) {
+        print_usage();
+        return false;
+    }
+
+    if (strcmp(word, "stop") == 0) {
+        traffic_stop(g, now);
+        return false;
+    } else if (strcmp(word, "stats") == 0) {
+        print_traffic(g, s, now);
+        return false;
+    } else if (strcmp(word, "reset") == 0) {
+        if (!g->active) {
+            memset(g, 0, sizeof(*g));
+        }
+        memset(s, 0, sizeof(*s));
+        return false;
+    }
+
+    traffic_cfg_t cfg = {-1, TRAFFIC_DEFAULT_SIZE, TRAFFIC_DEFAULT_RATE, 0,
+                         1000 * TRAFFIC_DEFAULT_TIME};
+
+    // Parse key=value pairs
+    while (sscanf(args, " %23s%n", word, &n) == 1) {
+        args += n;
+
+        char* val = strchr(word, '=');
+        if (val == NULL) {
+            break;
+        }
+        *val++ = '\0';
+
+        if (strcmp(word, "dest") == 0) {
+            cfg.dest = atoi(val);
+        } else if (strcmp(word, "size") == 0) {
+            cfg.size = atoi(val);
+        } else if (strcmp(word, "rate") == 0) {
+            cfg.rate = strcmp(val, "max") == 0 ? 0 : strtoul(val, NULL, 10);
+            if (cfg.rate == 0 && strcmp(val, "max") != 0) {
+                break;
+            }
+        } else if (strcmp(word, "count") == 0) {
+            cfg.count = strtoul(val, NULL, 10);
+        } else if (strcmp(word, "time") == 0) {
+            cfg.duration_ms = 1000 * strtoul(val, NULL, 10);
+        } else {
+            break;
+        }
+
+        word[0] = '\0';
+    }
+
+    if (word[0] != '\0' || cfg.size < TRAFFIC_MIN_SIZE
+        || cfg.size > TRAFFIC_MAX_SIZE) {
+        printf("ERROR: Bad tg command (size is %d to %d bytes)\n",
+               TRAFFIC_MIN_SIZE, TRAFFIC_MAX_SIZE);
+        print_usage();
+        return false;
+    }
+
+    traffic_start(g, &cfg, now);
+
+    printf("Traffic run %lu started\n", (unsigned long) g->run);
+
+    return true;
+}
@@ -0,0 +1,138 @@
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Traffic generator and goodput meter. The generator paces numbered packets
+// into the application's normal send path, and the sink at the destination
+// counts them as they arrive. Nothing here touches the network or the clock,
+// the application passes in time_us_64() and sends the payloads itself.
+//
+// Console command, "tg" followed by any of:
+//      dest=<ID>       Destination node (ignored where there is only one peer)
+//      size=<bytes>    Payload length
+//      rate=<pps|max>  Packets per second, "max" sends as fast as the send
+//                      path takes them
+//      count=<n>       Stop after n packets (0 = no limit)
+//      time=<sec>      Stop after sec seconds (0 = no limit)
+// or one of "tg stop", "tg stats" and "tg reset".
+//
+// A payload is "TG:<run>:<seq>:" padded with 'x' to its size, so it passes
+// through the ';'-separated packet formats untouched.
+
+// Longest and shortest payload
+#define TRAFFIC_MAX_SIZE 1200
+#define TRAFFIC_MIN_SIZE 32
+
+// Defaults for the console command
+#define TRAFFIC_DEFAULT_SIZE 64
+#define TRAFFIC_DEFAULT_RATE 10
+#define TRAFFIC_DEFAULT_TIME 10
+
+// RTT samples kept for the percentiles (the most recent ones)
+#define TRAFFIC_RTT_SAMPLES 256
+
+// Sequence numbers the sink remembers, for duplicates and reordering
+#define TRAFFIC_WINDOW 256
+
+// Acks counted after the last packet is sent
+#define TRAFFIC_DRAIN_US 2000000
+
+// The sink reports a run once nothing has arrived for this long
+#define TRAFFIC_IDLE_US 3000000
+
+// What to send
+typedef struct traffic_cfg {
+    int dest;             // Destination ID
+    int size;             // Payload length
+    uint32_t rate;        // Packets per second, 0 to saturate
+    uint32_t count;       // Packets to send, 0 for no limit
+    uint32_t duration_ms; // Length of the run, 0 for no limit
+} traffic_cfg_t;
+
+// Sending side of a run
+typedef struct traffic_gen {
+    traffic_cfg_t cfg;
+    bool active;   // Sending
+    bool reported; // The report of the last run was printed
+    uint32_t run;  // Run ID, tells the sink when a new run starts
+    uint32_t seq;  // Next sequence number
+    uint64_t start_us;
+    uint64_t end_us;
+    uint64_t next_us; // Next send time when paced
+    uint32_t sent;
+    uint32_t errors; // Packets the send path failed to send
+    uint32_t acked;
+    uint64_t bytes;
+    uint32_t rtt_us[TRAFFIC_RTT_SAMPLES];
+    uint32_t rtt_count; // Samples ever taken
+} traffic_gen_t;
+
+// Receiving side of a run
+typedef struct traffic_sink {
+    bool receiving; // A run is being counted
+    bool reported;  // ... and its report was printed
+    uint32_t run;
+    uint32_t highest; // Highest sequence number seen
+    uint32_t received;
+    uint32_t unique;
+    uint32_t duplicates;
+    uint32_t reordered; // Arrived after a higher sequence number
+    uint64_t bytes;
+    uint64_t first_us;
+    uint64_t last_us;
+    uint32_t seen[TRAFFIC_WINDOW / 32]; // Bit per sequence number
+} traffic_sink_t;
+
+// Returns true if [msg] is a traffic payload
+bool traffic_is_payload(const char* msg);
+
+// Start a run of [cfg] at [now]
+void traffic_start(traffic_gen_t* g, const traffic_cfg_t* cfg, uint64_t now);
+
+// End the run early
+void traffic_stop(traffic_gen_t* g, uint64_t now);
+
+// Returns true if the next packet is due at [now]. Ends the run once its
+// count or duration is reached.
+bool traffic_due(traffic_gen_t* g, uint64_t now);
+
+// Write the next payload (NUL terminated) into [buf], which holds at least
+// TRAFFIC_MAX_SIZE + 1 bytes, and count it as sent. Returns its length.
+int traffic_next(traffic_gen_t* g, char* buf, uint64_t now);
+
+// The send path failed to send [msg], counted if it's one of the run's
+// payloads (and not, say, a packet being forwarded)
+void traffic_send_failed(traffic_gen_t* g, const char* msg);
+
+// Count an ack and its RTT, ignored outside of a run and its drain time
+void traffic_ack(traffic_gen_t* g, uint32_t rtt_us, uint64_t now);
+
+// Count a received payload
+void traffic_receive(traffic_sink_t* s, const char* msg, uint64_t now);
+
+// Returns true if a report is waiting to be printed by traffic_report()
+bool traffic_report_due(const traffic_gen_t* g, const traffic_sink_t* s,
+                        uint64_t now);
+
+// Print the reports that are due: the generator's once its drain time is up,
+// the sink's once it has been idle for TRAFFIC_IDLE_US
+void traffic_report(traffic_gen_t* g, traffic_sink_t* s, uint64_t now);
+
+// Earliest time after [now] at which a packet or a report is due, UINT64_MAX
+// if there is none
+uint64_t traffic_wake_time(const traffic_gen_t* g, const traffic_sink_t* s,
+                           uint64_t now);
+
+// Print both sides, whether or not a run is over
+void print_traffic(const traffic_gen_t* g, const traffic_sink_t* s,
+                   uint64_t now);
+
+// Handle the arguments of a "tg" console command. Returns true if a run was
+// started.
+bool traffic_command(const char* args, traffic_gen_t* g, traffic_sink_t* s,
+                     uint64_t now);
+
+#endif
@@ -9,6 +9,7 @@
 
 // C libraries
 #include <stdio.h>
+#include <string.h>
 
 // Pico
 #include "pico/cyw43_arch.h"
@@ -21,6 +22,12 @@
 
 char last_pico_found[100];
 
+// Scan for one SSID instead of every network (optional)
+// #define TARGET_SSID "picow_test"
+
+// Listen for beacons instead of sending probes
+#define PASSIVE_SCAN false
+
 // Wifi scan callback function, prints cyw43_ev_scan_result_t as a string
 static int print_result(void* env, const cyw43_ev_scan_result_t* result)
 {
@@ -68,14 +75,25 @@ int main()
 
     int scan_in_progress = false;
 
+    // Time the current scan started
+    absolute_time_t scan_start_time = nil_time;
+
     while (true) {
         // If past the time of next scan
         if (absolute_time_diff_us(get_absolute_time(), next_scan_time) < 0) {
             // Start a scan if no scan is in progress, otherwise wait 10s
             if (!scan_in_progress) {
-                // Scan options don't matter
                 cyw43_wifi_scan_options_t scan_options = {0};
 
+#ifdef TARGET_SSID
+                // Only look for the target network
+                scan_options.ssid_len = strlen(TARGET_SSID);
+                memcpy(scan_options.ssid, TARGET_SSID, scan_options.ssid_len);
+#endif
+
+                // 0 = active, 1 = passive
+                scan_options.scan_type = PASSIVE_SCAN ? 1 : 0;
+
                 // This function scans for nearby Wifi networks and runs the
                 // callback function each time a network is found.
                 int err = cyw43_wifi_scan(&cyw43_state, &scan_options, NULL,
@@ -84,6 +102,7 @@ int main()
                 if (err == 0) {
                     printf("\nPerforming wifi scan\n");
                     scan_in_progress = true;
+                    scan_start_time  = get_absolute_time();
                 } else {
                     printf("Failed to start scan: %d\n", err);
 
@@ -91,6 +110,11 @@ int main()
                     next_scan_time = make_timeout_time_ms(10000);
                 }
             } else if (!cyw43_wifi_scan_active(&cyw43_state)) {
+                printf("Scan took %lld ms\n",
+                       absolute_time_diff_us(scan_start_time,
+                                             get_absolute_time())
+                           / 1000);
+
                 // Reset the flag and schedule the next scan
                 next_scan_time   = make_timeout_time_ms(10000);
                 scan_in_progress = false;
@@ -0,0 +1,198 @@
+// C libraries
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Pico
+#include "pico/stdlib.h"
+
+// Local
+#include "conn_timing.h"
+#include "trace.h"
+#include "utils.h"
+
+// Durations of one phase
+typedef struct phase_hist {
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t buckets[CONN_TIMING_BUCKETS];
+} phase_hist_t;
+
+// One pass of the connect thread. Phases that didn't run are 0.
+typedef struct transition {
+    uint32_t start;    // Time it began (ms)
+    int target_ID;     // Target of the connect thread
+    int err;           // connect_to_network() error code
+    uint32_t total_us; // Begin to end
+    uint32_t phase_us[NUM_CONN_PHASES];
+} transition_t;
+
+static const char* phase_names[NUM_CONN_PHASES] = {
+    "shutdown_ap", "re_init_cyw43", "boot_station", "shutdown_station", "scan",
+    "associate",   "address",       "boot_ap"};
+
+static phase_hist_t hists[NUM_CONN_PHASES];
+
+static transition_t ring[CONN_TIMING_RING_SIZE];
+static unsigned int ring_head  = 0; // Next slot written
+static unsigned int ring_count = 0;
+
+// The open transition, if any
+static transition_t current;
+static uint64_t current_start = 0;
+static bool in_transition     = false;
+
+static int bucket_of(uint32_t us)
+{
+    if (us == 0) {
+        return 0;
+    }
+
+    int b = 31 - __builtin_clz(us);
+
+    return b < CONN_TIMING_BUCKETS ? b : CONN_TIMING_BUCKETS - 1;
+}
+
+const char* conn_phase_name(conn_phase_t phase)
+{
+    return phase < NUM_CONN_PHASES ? phase_names[phase] : "unknown";
+}
+
+void conn_timing_record(conn_phase_t phase, uint64_t start)
+{
+    uint64_t elapsed = time_us_64() - start;
+    uint32_t us      = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t) elapsed;
+
+    phase_hist_t* h = &hists[phase];
+
+    if (h->count == 0 || us < h->min_us) {
+        h->min_us = us;
+    }
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+    h->count++;
+    h->total_us += us;
+    h->buckets[bucket_of(us)]++;
+
+    TRACE(TR_CONN_PHASE, phase, us);
+
+    // A phase may run more than once per transition
+    if (in_transition) {
+        current.phase_us[phase] += us;
+    }
+}
+
+void conn_timing_begin(int target_ID)
+{
+    memset(&current, 0, sizeof(current));
+    current.start     = time_ms_32();
+    current.target_ID = target_ID;
+
+    current_start = time_us_64();
+    in_transition = true;
+
+    TRACE(TR_CONN_BEGIN, target_ID, 0);
+}
+
+void conn_timing_end(int err)
+{
+    if (!in_transition) {
+        return;
+    }
+
+    TRACE(TR_CONN_END, err, 0);
+
+    current.err      = err;
+    current.total_us = (uint32_t) (time_us_64() - current_start);
+
+    ring[ring_head] = current;
+    ring_head       = (ring_head + 1) % CONN_TIMING_RING_SIZE;
+    if (ring_count < CONN_TIMING_RING_SIZE) {
+        ring_count++;
+    }
+
+    in_transition = false;
+}
+
+void conn_timing_reset()
+{
+    memset(hists, 0, sizeof(hists));
+    ring_head     = 0;
+    ring_count    = 0;
+    in_transition = false;
+}
+
+// Print a duration in a readable unit
+static void print_duration(uint64_t us)
+{
+    if (us < 1000) {
+        printf("%llu us", us);
+    } else if (us < 1000000) {
+        printf("%.1f ms", us / 1e3);
+    } else {
+        printf("%.2f s", us / 1e6);
+    }
+}
+
+void print_conn_timing()
+{
+    printf("CONNECTION PHASES (count, min / avg / max)\n");
+
+    for (int p = 0; p < NUM_CONN_PHASES; p++) {
+        phase_hist_t* h = &hists[p];
+
+        if (h->count == 0) {
+            continue;
+        }
+
+        printf("\t%-16s %5lu  ", phase_names[p], (unsigned long) h->count);
+        print_duration(h->min_us);
+        printf(" / ");
+        print_duration(h->total_us / h->count);
+        printf(" / ");
+        print_duration(h->max_us);
+        printf("\n");
+
+        for (int b = 0; b < CONN_TIMING_BUCKETS; b++) {
+            if (h->buckets[b] == 0) {
+                continue;
+            }
+
+            printf("\t\t");
+            if (b == CONN_TIMING_BUCKETS - 1) {
+                printf(">= ");
+                print_duration(1ULL << b);
+            } else {
+                print_duration(b == 0 ? 0 : 1ULL << b);
+                printf(" - ");
+                print_duration(1ULL << (b + 1));
+            }
+            printf(": %lu\n", (unsigned long) h->buckets[b]);
+        }
+    }
+
+    printf("RECENT TRANSITIONS (oldest first)\n");
+
+    for (unsigned int i = 0; i < ring_count; i++) {
+        unsigned int slot = (ring_head + CONN_TIMING_RING_SIZE - ring_count + i)
+                            % CONN_TIMING_RING_SIZE;
+        transition_t* t = &ring[slot];
+
+        printf("\t%7.1fs target %2d err %d total ", t->start / 1e3,
+               t->target_ID, t->err);
+        print_duration(t->total_us);
+        printf(":");
+
+        for (int p = 0; p < NUM_CONN_PHASES; p++) {
+            if (t->phase_us[p] != 0) {
+                printf(" %s ", phase_names[p]);
+                print_duration(t->phase_us[p]);
+            }
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef CONN_TIMING_H
+#define CONN_TIMING_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Steps of a connection transition (one pass of the connect thread)
+typedef enum conn_phase {
+    CONN_PHASE_SHUTDOWN_AP,       // shutdown_ap()
+    CONN_PHASE_RE_INIT_CYW43,     // re_init_cyw43()
+    CONN_PHASE_BOOT_STATION,      // boot_station()
+    CONN_PHASE_SHUTDOWN_STATION,  // shutdown_station()
+    CONN_PHASE_SCAN,              // Wifi scan (or cache lookup)
+    CONN_PHASE_ASSOCIATE,         // Joining the AP
+    CONN_PHASE_ADDRESS,           // DHCP lease, or static configuration
+    CONN_PHASE_BOOT_AP,           // boot_ap()
+    NUM_CONN_PHASES
+} conn_phase_t;
+
+// Histogram bucket b counts durations in [2^b, 2^(b+1)) us, the last bucket
+// also counts everything longer (2^25 us is about 34 sec)
+#define CONN_TIMING_BUCKETS 26
+
+// Number of recent transitions kept
+#define CONN_TIMING_RING_SIZE 16
+
+// Name of [phase]
+const char* conn_phase_name(conn_phase_t phase);
+
+// Time a phase between [start] (time_us_64()) and now. Recorded into the
+// phase's histogram, and into the current transition if one is open.
+void conn_timing_record(conn_phase_t phase, uint64_t start);
+
+// Open a transition towards [target_ID]
+void conn_timing_begin(int target_ID);
+
+// Close the open transition, [err] is the connect_to_network() error code
+void conn_timing_end(int err);
+
+// Clear the histograms and the ring
+void conn_timing_reset();
+
+// Print the per-phase histograms and the recent transitions
+void print_conn_timing();
+
+#endif
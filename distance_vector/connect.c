@@ -1,14 +1,18 @@
 
 // C libraries
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 // Pico
 #include "boards/pico_w.h"
+#include "hardware/sync.h"
 #include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
 
 // Lightweight IP
+#include "lwip/dhcp.h"
 #include "lwip/ip_addr.h"
 #include "lwip/netif.h"
 
@@ -16,14 +20,65 @@
 #include "dhcpserver/dhcpserver.h"
 
 // Local
+#include "conn_timing.h"
 #include "connect.h"
 #include "layout.h"
 #include "node.h"
+#include "scan_cache.h"
+#include "ssid.h"
 
 int access_point = true;
 
+bool station_active = false;
+
+// SSID of the running access point
+static char hosted_ssid[SSID_LEN];
+
 char dest_addr_str[IP_ADDR_LEN] = "255.255.255.255";
 
+// My address and the destination's as the connection steps last set them, on
+// the network core. Core 0 only reads them through connect_take_addrs().
+static struct {
+    spin_lock_t* lock;
+    uint32_t changes; // Bumped by every update
+    char ip_addr[IP_ADDR_LEN];
+    char dest_addr[IP_ADDR_LEN];
+} net_addrs;
+
+// [net_addrs.changes] as of the last connect_take_addrs()
+static uint32_t addrs_taken = 0;
+
+static void set_addrs(const char* ip_addr, const char* dest_addr)
+{
+    uint32_t save = spin_lock_blocking(net_addrs.lock);
+    snprintf(net_addrs.ip_addr, IP_ADDR_LEN, "%s", ip_addr);
+    snprintf(net_addrs.dest_addr, IP_ADDR_LEN, "%s", dest_addr);
+    net_addrs.changes++;
+    spin_unlock(net_addrs.lock, save);
+}
+
+void connect_init()
+{
+    net_addrs.lock = spin_lock_init(spin_lock_claim_unused(true));
+}
+
+bool connect_take_addrs(char* ip_addr, char* dest_addr)
+{
+    bool changed  = false;
+    uint32_t save = spin_lock_blocking(net_addrs.lock);
+
+    if (net_addrs.changes != addrs_taken) {
+        snprintf(ip_addr, IP_ADDR_LEN, "%s", net_addrs.ip_addr);
+        snprintf(dest_addr, IP_ADDR_LEN, "%s", net_addrs.dest_addr);
+        addrs_taken = net_addrs.changes;
+        changed     = true;
+    }
+
+    spin_unlock(net_addrs.lock, save);
+
+    return changed;
+}
+
 // Bruce Land's TCP server structure. Stores metadata for an access point
 // hosted by a Pico-W. This includes the IPv4 address.
 typedef struct TCP_SERVER_T_ {
@@ -51,6 +106,8 @@ void generate_picow_ssid(char* buf, int picow_ID)
 
 int re_init_cyw43()
 {
+    uint64_t start = time_us_64();
+
     // Re-initialize Wifi chip
     cyw43_arch_deinit();
     printf("Initializing cyw43...");
@@ -60,11 +117,30 @@ int re_init_cyw43()
     }
     printf("initialized!\n");
 
+    conn_timing_record(CONN_PHASE_RE_INIT_CYW43, start);
+
     return 0;
 }
 
+void generate_ap_addr(char* buf, int ID)
+{
+#if CONCURRENT_AP_STA
+    // My station joins other nodes' subnets while my AP is up, so every AP
+    // needs its own. Uninitialized nodes never host and join at the same time
+    // and keep the default subnet.
+    if (ID >= 0) {
+        snprintf(buf, IP_ADDR_LEN, "192.168.%d.1", AP_SUBNET_BASE + ID);
+        return;
+    }
+#endif
+
+    snprintf(buf, IP_ADDR_LEN, "%s", AP_ADDR);
+}
+
 int boot_ap()
 {
+    uint64_t start = time_us_64();
+
     // Allocate TCP server state
     state = calloc(1, sizeof(TCP_SERVER_T));
     printf("Allocating TCP server state...");
@@ -81,14 +157,25 @@ int boot_ap()
     printf("Access point mode enabled!\n");
     printf("\tssid         = %s\n", self.wifi_ssid);
 
+    snprintf(hosted_ssid, SSID_LEN, "%s", self.wifi_ssid);
+
+    char ap_addr[IP_ADDR_LEN];
+    generate_ap_addr(ap_addr, self.ID);
+
     // The variable 'state' is a pointer to a TCP_SERVER_T struct
     // Set up the access point IP address and mask
-    ipaddr_aton(AP_ADDR, ip_2_ip4(&state->gw));
+    ipaddr_aton(ap_addr, ip_2_ip4(&state->gw));
     ipaddr_aton(MASK_ADDR, ip_2_ip4(&mask));
 
+    // The driver always brings the AP interface up as AP_ADDR
+    struct netif* ap_netif = &cyw43_state.netif[CYW43_ITF_AP];
+    cyw43_arch_lwip_begin();
+    netif_set_addr(ap_netif, ip_2_ip4(&state->gw), ip_2_ip4(&mask),
+                   ip_2_ip4(&state->gw));
+    cyw43_arch_lwip_end();
+
     // Configure target IP address
-    snprintf(self.ip_addr, IP_ADDR_LEN, "%s", AP_ADDR);
-    snprintf(dest_addr_str, IP_ADDR_LEN, "%s", STATION_ADDR);
+    set_addrs(ap_addr, STATION_ADDR);
 
     // Start the Dynamic Host Configuration Protocol (DHCP) server. Even though
     // in the program DHCP is not required, LwIP seems to need it!
@@ -106,20 +193,38 @@ int boot_ap()
     // printf("My IPv4 addr = %s\n", ip4addr_ntoa(&state->gw));
 
     // Print IP address (potentially better method)
-    printf("\tMy IPv4 addr = %s\n", ip4addr_ntoa(netif_ip4_addr(netif_list)));
+    printf("\tMy IPv4 addr = %s\n", ip4addr_ntoa(netif_ip4_addr(ap_netif)));
 
     access_point = true;
 
+    conn_timing_record(CONN_PHASE_BOOT_AP, start);
+
     return 0;
 }
 
+int ensure_ap()
+{
+    if (access_point && strcmp(hosted_ssid, self.wifi_ssid) == 0) {
+        return 0;
+    }
+
+    if (access_point) {
+        shutdown_ap();
+    }
+
+    return boot_ap();
+}
+
 void shutdown_ap()
 {
+    uint64_t start = time_us_64();
+
     printf("Shutting down access point...");
 
     // Disable access point
     cyw43_arch_disable_ap_mode();
-    access_point = false;
+    access_point   = false;
+    hosted_ssid[0] = '\0';
 
     // Disable the DHCP server
     dhcp_server_deinit(&dhcp_server);
@@ -128,58 +233,224 @@ void shutdown_ap()
     free(state);
 
     printf("success!\n");
+
+    conn_timing_record(CONN_PHASE_SHUTDOWN_AP, start);
 }
 
 // Boot up the station
 void boot_station()
 {
+    uint64_t start = time_us_64();
+
     printf("Booting station mode...");
 
     // Enable station
     cyw43_arch_enable_sta_mode();
+    station_active = true;
+#if !CONCURRENT_AP_STA
     access_point = false;
+#endif
 
     printf("success!\n");
+
+    conn_timing_record(CONN_PHASE_BOOT_STATION, start);
 }
 
 // Shutdown the station
 void shutdown_station()
 {
+    uint64_t start = time_us_64();
+
     printf("Shutting down station...");
 
     // Disable station
     cyw43_arch_disable_sta_mode();
+    station_active = false;
 
     printf("success!\n");
+
+    conn_timing_record(CONN_PHASE_SHUTDOWN_STATION, start);
+}
+
+// Addresses an association is configured with instead of asking DHCP
+typedef struct static_addr {
+    ip4_addr_t ip; // My address on the AP's subnet
+    ip4_addr_t gw; // The AP
+} static_addr_t;
+
+// Derive my address on [ssid]'s subnet from the node IDs. Every node hosts
+// its AP at a known address (see generate_ap_addr()) and IDs are unique once
+// neighbor finding is done, so host STATIC_HOST_BASE + <my ID> is mine alone.
+// Returns false if DHCP has to be used: I have no ID yet, or the network isn't
+// one of ours.
+static bool static_addr_for(char* ssid, static_addr_t* sa)
+{
+#if STATIC_ADDRESSING
+    ssid_info_t info;
+
+    if (self.ID == DEFAULT_ID
+        || !parse_ssid((const uint8_t*) ssid, strlen(ssid), &info)) {
+        return false;
+    }
+
+    char gw_str[IP_ADDR_LEN];
+    generate_ap_addr(gw_str, info.kind == SSID_PICOW ? info.ID : DEFAULT_ID);
+    ip4addr_aton(gw_str, &sa->gw);
+
+    IP4_ADDR(&sa->ip, ip4_addr1(&sa->gw), ip4_addr2(&sa->gw),
+             ip4_addr3(&sa->gw), STATIC_HOST_BASE + self.ID);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Wait for the join started at [start] to finish. With [sa], stop at
+// association, turn off the DHCP client and configure [sa] directly.
+// Otherwise wait for the DHCP lease. Returns 0 once the link is up.
+static int wait_for_link(uint64_t start, absolute_time_t until,
+                         const static_addr_t* sa)
+{
+    struct netif* sta_netif = &cyw43_state.netif[CYW43_ITF_STA];
+
+    // Time the association was seen, the rest is addressing
+    uint64_t associated = 0;
+
+    // Associated shows up as NOIP until DHCP is done
+    int ready  = (sa != NULL) ? CYW43_LINK_NOIP : CYW43_LINK_UP;
+    int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+
+    while (status != ready && !(sa != NULL && status == CYW43_LINK_UP)) {
+        // Failed, or the AP moved. Abandon the join.
+        if (status < 0 || time_reached(until)) {
+            cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+            return 1;
+        }
+
+        if (status == CYW43_LINK_NOIP && associated == 0) {
+            associated = time_us_64();
+            conn_timing_record(CONN_PHASE_ASSOCIATE, start);
+        }
+
+        sleep_ms(10);
+        status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+    }
+
+    // Static addressing stops at association, and DHCP may finish between
+    // two polls
+    if (associated == 0) {
+        associated = time_us_64();
+        conn_timing_record(CONN_PHASE_ASSOCIATE, start);
+    }
+
+    if (sa != NULL) {
+        ip4_addr_t mask;
+        ip4addr_aton(MASK_ADDR, &mask);
+
+        cyw43_arch_lwip_begin();
+        dhcp_stop(sta_netif);
+        netif_set_addr(sta_netif, &sa->ip, &mask, &sa->gw);
+        cyw43_arch_lwip_end();
+    }
+
+    conn_timing_record(CONN_PHASE_ADDRESS, associated);
+
+    return 0;
+}
+
+// Join [ssid] at [bssid] on [channel]. Naming the channel lets the chip skip
+// its own scan for the AP. Returns 0 once the link is up.
+static int fast_connect(char* ssid, const uint8_t* bssid, uint32_t channel,
+                        const static_addr_t* sa)
+{
+    uint64_t start = time_us_64();
+
+    int err = cyw43_wifi_join(&cyw43_state, strlen(ssid), (const uint8_t*) ssid,
+                              strlen(WIFI_PASSWORD),
+                              (const uint8_t*) WIFI_PASSWORD,
+                              CYW43_AUTH_WPA2_AES_PSK, bssid, channel);
+    if (err) {
+        return err;
+    }
+
+    return wait_for_link(start, make_timeout_time_ms(FAST_CONNECT_TIMEOUT_MS),
+                         sa);
+}
+
+// Join [ssid] wherever the chip finds it, returns 0 once the link is up
+static int slow_connect(char* ssid, const static_addr_t* sa)
+{
+    uint64_t start = time_us_64();
+
+    if (cyw43_arch_wifi_connect_async(ssid, WIFI_PASSWORD,
+                                      CYW43_AUTH_WPA2_AES_PSK)) {
+        return 1;
+    }
+
+    return wait_for_link(start, make_timeout_time_ms(CONNECT_TIMEOUT_MS), sa);
 }
 
 int connect_to_network(char* ssid)
 {
-    if (access_point) {
-        printf("ERROR: Can't connect to a network while in AP mode.\n");
+    if (!station_active) {
+        printf("ERROR: Can't connect to a network without the station.\n");
         return 1;
     }
 
     // Connect to the access point
     printf("Connecting to %s...", ssid);
-    if (cyw43_arch_wifi_connect_timeout_ms(ssid, WIFI_PASSWORD,
-                                           CYW43_AUTH_WPA2_AES_PSK, 30000)) {
+
+    uint64_t start = time_us_64();
+    bool fast      = false;
+
+    static_addr_t sa;
+    bool is_static = static_addr_for(ssid, &sa);
+
+    struct netif* sta_netif = &cyw43_state.netif[CYW43_ITF_STA];
+
+    // Don't let an address left over from an earlier static association look
+    // like a finished join
+    if (is_static) {
+        cyw43_arch_lwip_begin();
+        netif_set_addr(sta_netif, IP4_ADDR_ANY4, IP4_ADDR_ANY4, IP4_ADDR_ANY4);
+        cyw43_arch_lwip_end();
+    }
+
+    // Try the BSSID and channel from the last scan that saw the network
+    scan_entry_t e;
+    if (scan_cache_find(ssid, &e)) {
+        fast = (fast_connect(ssid, e.bssid, e.channel, is_static ? &sa : NULL)
+                == 0);
+        if (!fast) {
+            printf("fast connect failed...");
+        }
+    }
+    if (!fast && slow_connect(ssid, is_static ? &sa : NULL)) {
         printf("failed to connect.\n");
         return 1;
     } else {
-        printf("connected!\n");
+        printf("connected in %.2f sec%s\n",
+               (float) (time_us_64() - start) / 1e6,
+               fast ? " (fast)" : "");
         printf("\tssid         = %s\n", ssid);
         printf("\tpassword     = %s\n", WIFI_PASSWORD);
 
-        // Configure destination IP address as access point IP
-        snprintf(dest_addr_str, IP_ADDR_LEN, "%s", AP_ADDR);
+        // Configure destination IP address as access point IP, which the
+        // DHCP server hands out as the gateway
+        char gw_addr[IP_ADDR_LEN];
+        snprintf(gw_addr, IP_ADDR_LEN, "%s",
+                 ip4addr_ntoa(netif_ip4_gw(sta_netif)));
+
+        // Configure my address as assigned by DHCP, or derived from my ID
+        char ip_addr[IP_ADDR_LEN];
+        snprintf(ip_addr, IP_ADDR_LEN, "%s",
+                 ip4addr_ntoa(netif_ip4_addr(sta_netif)));
 
-        // Configure my address as assigned by DHCP
-        snprintf(self.ip_addr, IP_ADDR_LEN, "%s",
-                 ip4addr_ntoa(netif_ip4_addr(netif_list)));
+        set_addrs(ip_addr, gw_addr);
 
-        // Print address assigned by DHCP
-        printf("\tMy IPv4 addr = %s (DHCP)\n", self.ip_addr);
+        printf("\tMy IPv4 addr = %s (%s)\n", ip_addr,
+               is_static ? "static" : "DHCP");
 
         return 0;
     }
@@ -1,12 +1,22 @@
 #ifndef CONNECT_H
 #define CONNECT_H
 
+// C Libraries
+#include <stdbool.h>
+
 // Local
 #include "network_opts.h"
 
 // Wifi password
 #define WIFI_PASSWORD "password"
 
+// Timeout (ms) for joining a network by SSID
+#define CONNECT_TIMEOUT_MS 30000
+
+// Timeout (ms) for joining a network at a BSSID and channel seen in a recent
+// scan, before falling back to joining by SSID
+#define FAST_CONNECT_TIMEOUT_MS 5000
+
 // IP addresses
 #define AP_ADDR      "192.168.4.1"
 #define STATION_ADDR "192.168.4.10"
@@ -15,24 +25,44 @@
 // Flag for whether the pico is an access point
 extern int access_point;
 
+// Flag for whether the station interface is up
+extern bool station_active;
+
 // My IPv4 address
 extern char my_addr[IP_ADDR_LEN];
 
-// (Placeholder) Destination IPv4 address
+// (Placeholder) Destination IPv4 address, core 0's copy
 extern char dest_addr_str[IP_ADDR_LEN];
 
 // ID to which this pico is currently connected
 extern int connected_ID;
 
+// Claim the lock guarding the addresses set by the connection steps, call
+// before the network core starts
+void connect_init();
+
+// The connection steps run on the network core, so they don't write core 0's
+// self.ip_addr and dest_addr_str. Copy the addresses they set into [ip_addr]
+// and [dest_addr] if they changed since the last call, returns true if so.
+// Core 0 only.
+bool connect_take_addrs(char* ip_addr, char* dest_addr);
+
 // Generate a picow SSID
 void generate_picow_ssid(char* buf, int picow_ID);
 
 // Re-initialize the cyw43
 int re_init_cyw43();
 
+// Generate the address of [ID]'s access point
+void generate_ap_addr(char* buf, int ID);
+
 // Boot up the access point, returns 0 on success.
 int boot_ap();
 
+// Boot the access point if it is down, or restart it if my SSID has changed
+// since it was booted. Returns 0 if the access point is up.
+int ensure_ap();
+
 // Shutdown the access point, de-init DHCP, and free the TCP_SERVER state
 void shutdown_ap();
 
@@ -42,7 +72,10 @@ void boot_station();
 // Shutdown the station
 void shutdown_station();
 
-// Connect to a network and set a new IP address
+// Connect to a network and set a new IP address. If a recent scan saw the
+// network, join its BSSID on its channel first (skipping the driver's search
+// for the AP). With STATIC_ADDRESSING my address is derived from the node IDs
+// instead of leased over DHCP. Returns 0 on success.
 int connect_to_network(char* ssid);
 
 #endif
\ No newline at end of file
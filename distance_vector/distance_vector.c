@@ -14,14 +14,36 @@
 
 // Local
 #include "distance_vector.h"
+#include "log.h"
 #include "utils.h"
 
+nbr_score_fn_t nbr_score_fn = nbr_score_default;
+
+int nbr_score_default(node_t* n, nbr_t* nb, uint32_t now_ms)
+{
+    // Seconds since I last talked to this neighbor
+    int stale = (int) ((now_ms - nb->last_contact) / 1000);
+    if (stale > SCORE_STALE_MAX) {
+        stale = SCORE_STALE_MAX;
+    }
+
+    // Stronger signals (closer to 0 dBm) score higher
+    int link = nb->rssi - SCORE_RSSI_FLOOR;
+    if (link < 0) {
+        link = 0;
+    }
+
+    return SCORE_W_STALE * stale + SCORE_W_CHANGES * nb->dv_changes
+         + SCORE_W_ROUTES * nb->num_routes + link / 2
+         - SCORE_W_FAILS * nb->connect_fails;
+}
+
 void init_dist_vector_routing(node_t* n)
 {
     for (int id = 0; id < MAX_NODES; id++) {
 
         // If this ID is one of [n]'s neighbors
-        if (n->ID_is_nbr[id]) {
+        if (is_nbr(n, id)) {
 
             // (Placeholder) Calculate cost to this neighbor
             // (Can be changed later to be a function of RSSI)
@@ -49,13 +71,17 @@ void init_dist_vector_routing(node_t* n)
             }
 
             nb->up_to_date   = false; // Node is not up-to-date
-            nb->last_contact = time_us_64();
+            nb->last_contact = time_ms_32();
             nb->new_dv       = false; // Node has not sent me a new DV yet
 
+            nb->dv_changes    = MAX_NODES; // Hasn't heard any of my DV
+            nb->num_routes    = 1;         // Routes to itself
+            nb->rssi          = SCORE_RSSI_FLOOR;
+            nb->connect_fails = 0;
+
             // Store nbr_t pointer in nbrs[id]
             n->nbrs[id] = nb;
 
-            n->num_nbrs++;
         }
     }
 
@@ -63,57 +89,210 @@ void init_dist_vector_routing(node_t* n)
     n->dist_vector[n->ID] = 0;
 }
 
+static bool is_provisional(node_t* n, int id)
+{
+    return (n->provisional[id / 32] >> (id % 32)) & 1u;
+}
+
+static void clear_provisional(node_t* n, int id)
+{
+    n->provisional[id / 32] &= ~(1u << (id % 32));
+}
+
+// The shortest route to [id] that [n]'s neighbors' DVs offer. Sets [hop] to
+// the neighbor, or NO_ROUTE if there is none.
+static int best_route(node_t* n, int id, int* hop)
+{
+    int best = DIST_IF_NO_ROUTE;
+    *hop     = NO_ROUTE;
+
+    for (int n_id = 0; n_id < MAX_NODES; n_id++) {
+        nbr_t* nb = n->nbrs[n_id];
+
+        if (nb != NULL && nb->cost + nb->dist_vector[id] < best) {
+            best = nb->cost + nb->dist_vector[id];
+            *hop = nb->ID;
+        }
+    }
+
+    return best;
+}
+
+// [num_changed] entries of [n]'s DV changed, flag all nbrs as not up-to-date
+static void dv_changed(node_t* n, int num_changed)
+{
+    for (int n_id = 0; n_id < MAX_NODES; n_id++) {
+        if (n->nbrs[n_id] != NULL) {
+            nbr_t* other      = n->nbrs[n_id];
+            other->up_to_date = false;
+
+            // Saturate, the score only needs a rough count
+            int changes       = other->dv_changes + num_changed;
+            other->dv_changes = changes > UINT8_MAX ? UINT8_MAX : changes;
+        }
+    }
+}
+
 bool update_dist_vector_by_nbr_id(node_t* n, int nbr_ID)
 {
     // Break out of the function if nbr_ID is not actually a neighbor
-    if (n->nbrs[nbr_ID] == NULL) {
-        print_red;
-        printf("ERROR: ");
-        print_reset;
-        printf("Node %d is not a neighbor.\n", nbr_ID);
+    nbr_t* nb = get_nbr(n, nbr_ID);
+    if (nb == NULL) {
+        LOG_ERROR(LOG_MOD_DV, "Node %d is not a neighbor.", nbr_ID);
         return false;
     }
 
-    nbr_t* nb  = n->nbrs[nbr_ID];
     nb->new_dv = false;
 
     bool my_dv_updated = false;
+    int num_changed    = 0;
+    bool recount       = false;
 
     // Check for a new shortest path to each node
     for (int id = 0; id < MAX_NODES; id++) {
         int curr_dist = n->dist_vector[id];
         int new_dist  = nb->cost + nb->dist_vector[id];
 
+        // [nb]'s DV has the final word on a route resumed through it
+        if (is_provisional(n, id) && n->routing_table[id] == nb->ID) {
+            clear_provisional(n, id);
+
+            if (new_dist > curr_dist) {
+                int hop;
+                n->dist_vector[id]   = best_route(n, id, &hop);
+                n->routing_table[id] = hop;
+
+                my_dv_updated = true;
+                recount       = true;
+                num_changed++;
+
+                LOG_DEBUG(LOG_MOD_DV,
+                          "Resumed route to node %d withdrawn by %d", id,
+                          nbr_ID);
+                continue;
+            }
+        }
+
         if (new_dist < curr_dist) {
             my_dv_updated = true;
+            num_changed++;
+
+            // Move the route count from the old next-hop to the new one
+            int old_hop = n->routing_table[id];
+            if (old_hop != NO_ROUTE && n->nbrs[old_hop] != NULL) {
+                n->nbrs[old_hop]->num_routes--;
+            }
+            nb->num_routes++;
 
             n->dist_vector[id]   = new_dist;
             n->routing_table[id] = nb->ID;
 
-            printf("New dist to node %d through %d:\n", id, nbr_ID);
-            printf("\tself.dist_vector[%d]: %d --> %d\n", id, curr_dist,
-                   new_dist);
+            LOG_DEBUG(LOG_MOD_DV, "New dist to node %d through %d:", id, nbr_ID);
+            LOG_DEBUG(LOG_MOD_DV, "\tself.dist_vector[%d]: %d --> %d", id,
+                      curr_dist, new_dist);
         }
     }
 
+    if (recount) {
+        count_routes(n);
+    }
+
     // If my distance vector changed, flag all nbrs as not up-to-date
     if (my_dv_updated) {
-        for (int n_id = 0; n_id < MAX_NODES; n_id++) {
-            if (n->nbrs[n_id] != NULL) {
-                n->nbrs[n_id]->up_to_date = false;
-            }
-        }
+        dv_changed(n, num_changed);
     } else {
-        printf("No changes to distance vector.\n");
+        LOG_DEBUG(LOG_MOD_DV, "No changes to distance vector.");
     }
 
     return my_dv_updated;
 }
 
+void count_routes(node_t* n)
+{
+    for (int n_id = 0; n_id < MAX_NODES; n_id++) {
+        if (n->nbrs[n_id] != NULL) {
+            n->nbrs[n_id]->num_routes = 0;
+        }
+    }
+
+    for (int id = 0; id < MAX_NODES; id++) {
+        int hop = n->routing_table[id];
+
+        if (id != n->ID && hop >= 0 && hop < MAX_NODES
+            && n->nbrs[hop] != NULL) {
+            n->nbrs[hop]->num_routes++;
+        }
+    }
+}
+
+void mark_routes_provisional(node_t* n)
+{
+    for (int id = 0; id < MAX_NODES; id++) {
+        int hop = n->routing_table[id];
+
+        // My own entry and the routes to my neighbors are rebuilt at boot
+        if (id == n->ID || hop == NO_ROUTE || hop == id) {
+            continue;
+        }
+
+        if (get_nbr(n, hop) == NULL) {
+            n->dist_vector[id]   = DIST_IF_NO_ROUTE;
+            n->routing_table[id] = NO_ROUTE;
+        } else {
+            n->provisional[id / 32] |= (1u << (id % 32));
+        }
+    }
+}
+
+bool routes_provisional(node_t* n)
+{
+    for (int w = 0; w < NBR_SET_WORDS; w++) {
+        if (n->provisional[w] != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool drop_provisional_routes(node_t* n)
+{
+    int num_changed = 0;
+
+    for (int id = 0; id < MAX_NODES; id++) {
+        if (!is_provisional(n, id)) {
+            continue;
+        }
+
+        clear_provisional(n, id);
+
+        int hop;
+        int dist = best_route(n, id, &hop);
+
+        if (dist != n->dist_vector[id] || hop != n->routing_table[id]) {
+            n->dist_vector[id]   = dist;
+            n->routing_table[id] = hop;
+            num_changed++;
+        }
+    }
+
+    count_routes(n);
+
+    if (num_changed > 0) {
+        dv_changed(n, num_changed);
+    }
+
+    return num_changed > 0;
+}
+
 void str_to_dv(node_t* n, int nbr_ID, char* dv)
 {
     // Pointer to the neighbor that will store this vector
-    nbr_t* nb = n->nbrs[nbr_ID];
+    nbr_t* nb = get_nbr(n, nbr_ID);
+    if (nb == NULL) {
+        LOG_ERROR(LOG_MOD_DV, "Node %d is not a neighbor.", nbr_ID);
+        return;
+    }
 
     // Make a buffer because strtok() is destructive
     char tbuf[DV_MAX_LEN];
@@ -130,10 +309,7 @@ void str_to_dv(node_t* n, int nbr_ID, char* dv)
         token = strtok(NULL, "-");
 
         if (token == NULL) {
-            print_red;
-            printf("Warning :");
-            print_reset;
-            printf("Null token for ID = %d\n", id);
+            LOG_WARN(LOG_MOD_DV, "Null token for ID = %d", id);
         } else {
             nb->dist_vector[id] = atoi(token);
         }
@@ -143,7 +319,7 @@ void str_to_dv(node_t* n, int nbr_ID, char* dv)
     nb->new_dv = true;
 }
 
-void dv_to_str(char* buf, node_t* n, int recv_ID, int dv[], bool poison)
+void dv_to_str(char* buf, node_t* n, int recv_ID, cost_t dv[], bool poison)
 {
     char dv_str[3 * MAX_NODES];
 
@@ -230,13 +406,22 @@ void print_table(char* type, int ID, int values[])
 
 void print_dist_vector(node_t* n, int ID)
 {
+    // Widen the packed table for printing
+    int values[MAX_NODES];
+
     if (ID == n->ID) {
         // Print my own distance vector
-        print_table("dv", ID, n->dist_vector);
-    } else if (n->ID_is_nbr[ID]) {
+        for (int i = 0; i < MAX_NODES; i++) {
+            values[i] = n->dist_vector[i];
+        }
+        print_table("dv", ID, values);
+    } else if (is_nbr(n, ID) && n->nbrs[ID] != NULL) {
         // Print estimate of a neighbor's distance vector
         nbr_t* nb = n->nbrs[ID];
-        print_table("edv", ID, nb->dist_vector);
+        for (int i = 0; i < MAX_NODES; i++) {
+            values[i] = nb->dist_vector[i];
+        }
+        print_table("edv", ID, values);
     } else {
         print_yellow;
         printf("WARNING: ");
@@ -248,6 +433,12 @@ void print_dist_vector(node_t* n, int ID)
 
 void print_routing_table(node_t* n)
 {
+    // Widen the packed table for printing
+    int values[MAX_NODES];
+    for (int i = 0; i < MAX_NODES; i++) {
+        values[i] = n->routing_table[i];
+    }
+
     // Set type = "rt"
-    print_table("rt", n->ID, n->routing_table);
+    print_table("rt", n->ID, values);
 }
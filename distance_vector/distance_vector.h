@@ -7,20 +7,55 @@
 // Maximum length a distance vector could be when represented as a string
 #define DV_MAX_LEN (3 * MAX_NODES)
 
+// Weights for the default neighbor priority score
+#define SCORE_W_STALE    1    // Per second since last contact
+#define SCORE_STALE_MAX  300  // Staleness is capped at this many seconds
+#define SCORE_W_CHANGES  20   // Per DV entry the nbr hasn't heard about
+#define SCORE_W_ROUTES   10   // Per destination routed through the nbr
+#define SCORE_W_FAILS    30   // Per consecutive failed connection
+#define SCORE_RSSI_FLOOR -100 // RSSI (dBm) that contributes nothing
+
+// Scores how urgently neighbor [nb] needs my distance vector, higher is more
+// urgent. Must be O(1) because it runs in the scan callback.
+typedef int (*nbr_score_fn_t)(node_t* n, nbr_t* nb, uint32_t now_ms);
+
+// Scoring function used to pick the target of a DV push
+extern nbr_score_fn_t nbr_score_fn;
+
+// Default score, combines staleness, unheard DV changes, routes through the
+// neighbor, link quality (RSSI) and recent connection failures.
+int nbr_score_default(node_t* n, nbr_t* nb, uint32_t now_ms);
+
 // Initialize distance vector routing. Setup distance vectors for node_t [n] and
 // all of its neighbors.
 void init_dist_vector_routing(node_t* n);
 
-// Recalculate distance vector using neighboring distance vectors
+// Recalculate distance vector using neighboring distance vectors. A
+// provisional route through <nbr_ID> is confirmed, or replaced if <nbr_ID> now
+// has a longer one.
 bool update_dist_vector_by_nbr_id(node_t* n, int nbr_ID);
 
+// Recount the destinations [n] routes through each neighbor
+void count_routes(node_t* n);
+
+// Mark the routes [n] resumed from flash as provisional. Routes through a hop
+// that is no longer a neighbor are dropped right away.
+void mark_routes_provisional(node_t* n);
+
+// Returns true if any of [n]'s routes are still provisional
+bool routes_provisional(node_t* n);
+
+// Replace [n]'s unconfirmed routes with the best ones its neighbors' DVs offer
+// (or no route), returns true if [n]'s DV changed
+bool drop_provisional_routes(node_t* n);
+
 // Convert a string to a distance vector, and store it as the distance vector of
 // neighbor <nbr_ID>
 void str_to_dv(node_t* n, int nbr_ID, char* dv_str);
 
 // Convert a distance vector to a string, if [poison == true] do poisoned
 // reverse assuming this distance vector is being crafted for node #[recv_ID]
-void dv_to_str(char* buf, node_t* n, int recv_ID, int dv[], bool poison);
+void dv_to_str(char* buf, node_t* n, int recv_ID, cost_t dv[], bool poison);
 
 // Print a distance vector
 void print_dist_vector(node_t* n, int ID);
@@ -0,0 +1,264 @@
+// C libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pico
+#include "pico/rand.h"
+#include "pico/stdlib.h"
+
+// Hardware
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+// Local
+#include "emulate.h"
+#include "net_core.h"
+#include "persist.h"
+#include "utils.h"
+
+#ifdef USE_LAYOUT
+
+link_emu_t links[MAX_NODES][MAX_NODES];
+
+/************************************************
+ *  FLASH RECORD
+ ************************************************/
+
+// The topology lives in the sector just below the persisted node state. It is
+// only written by hand from the console, so it doesn't need wear levelling.
+#    define EMU_OFFSET                                                         \
+        (PICO_FLASH_SIZE_BYTES - (PERSIST_SECTORS + 1) * FLASH_SECTOR_SIZE)
+
+// Marks a programmed record
+#    define EMU_MAGIC 0x454d5531 // "EMU1"
+
+typedef struct emu_record {
+    uint32_t magic;
+    char board_IDs[NUM_BOARDS][20];
+    link_emu_t links[MAX_NODES][MAX_NODES];
+    uint32_t checksum;
+} emu_record_t;
+
+// Bytes programmed, the record rounded up to whole pages
+#    define EMU_RECORD_BYTES                                                   \
+        ((sizeof(emu_record_t) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE         \
+         * FLASH_PAGE_SIZE)
+
+// Simple additive checksum, the record is only checked once at boot
+static uint32_t emu_checksum(const emu_record_t* rec)
+{
+    const uint8_t* p = (const uint8_t*) rec;
+    uint32_t sum     = 0;
+
+    for (size_t i = 0; i < offsetof(emu_record_t, checksum); i++) {
+        sum = (sum << 1 | sum >> 31) + p[i];
+    }
+
+    return sum;
+}
+
+static int emu_load()
+{
+    const emu_record_t* rec = (const emu_record_t*) (XIP_BASE + EMU_OFFSET);
+
+    if (rec->magic != EMU_MAGIC || rec->checksum != emu_checksum(rec)) {
+        return 1;
+    }
+
+    memcpy(board_IDs, rec->board_IDs, sizeof(board_IDs));
+    memcpy(links, rec->links, sizeof(links));
+
+    return 0;
+}
+
+static void emu_save()
+{
+    // Pad the record out to whole pages
+    static uint8_t page[EMU_RECORD_BYTES];
+    memset(page, 0xFF, EMU_RECORD_BYTES);
+
+    emu_record_t* rec = (emu_record_t*) page;
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = EMU_MAGIC;
+    memcpy(rec->board_IDs, board_IDs, sizeof(board_IDs));
+    memcpy(rec->links, links, sizeof(links));
+    rec->checksum = emu_checksum(rec);
+
+    // Nothing may execute from flash meanwhile, see persist.c
+    net_core_pause();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(EMU_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(EMU_OFFSET, page, EMU_RECORD_BYTES);
+    restore_interrupts(ints);
+    net_core_resume();
+
+    printf("Saved emulated topology to flash\n");
+}
+
+static void emu_erase()
+{
+    net_core_pause();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(EMU_OFFSET, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+    net_core_resume();
+
+    printf("Erased emulated topology, the compiled layout is used on boot\n");
+}
+
+/************************************************
+ *  TOPOLOGY
+ ************************************************/
+
+// Set every link from the compiled connectivity array
+static void emu_from_layout()
+{
+    for (int i = 0; i < MAX_NODES; i++) {
+        for (int j = 0; j < MAX_NODES; j++) {
+            links[i][j].visible  = conn_array[i][j];
+            links[i][j].drop_pct = 0;
+            links[i][j].delay_ms = 0;
+            links[i][j].rssi     = 0;
+        }
+    }
+}
+
+void init_emulation()
+{
+    emu_from_layout();
+
+    if (emu_load() == 0) {
+        printf("Loaded emulated topology from flash\n");
+    }
+}
+
+static bool phys_in_range(int phys)
+{
+    return phys >= 0 && phys < MAX_NODES;
+}
+
+// Roll a [pct]% chance
+static bool chance(uint8_t pct)
+{
+    return pct > 0 && (get_rand_32() % 100) < pct;
+}
+
+bool emu_scan_visible(int my_phys, int their_phys)
+{
+    if (!phys_in_range(my_phys) || !phys_in_range(their_phys)) {
+        return false;
+    }
+
+    link_emu_t* l = &links[my_phys][their_phys];
+
+    return l->visible && !chance(l->drop_pct);
+}
+
+int emu_rssi(int my_phys, int their_phys, int measured)
+{
+    if (!phys_in_range(my_phys) || !phys_in_range(their_phys)
+        || links[my_phys][their_phys].rssi == 0) {
+        return measured;
+    }
+
+    return links[my_phys][their_phys].rssi;
+}
+
+bool emu_drop_packet(int my_phys, int their_phys)
+{
+    if (!phys_in_range(my_phys) || !phys_in_range(their_phys)) {
+        return false;
+    }
+
+    return chance(links[my_phys][their_phys].drop_pct);
+}
+
+unsigned int emu_delay_ms(int my_phys, int their_phys)
+{
+    if (!phys_in_range(my_phys) || !phys_in_range(their_phys)) {
+        return 0;
+    }
+
+    return links[my_phys][their_phys].delay_ms;
+}
+
+/************************************************
+ *  CONSOLE
+ ************************************************/
+
+// Commands (all IDs are physical IDs, links are set in both directions):
+//      emu                                 Print the topology
+//      emu link <a> <b> <drop> <ms> <rssi> Make a lossy/slow link visible
+//      emu cut <a> <b>                     Make a and b invisible
+//      emu board <phys> <unique ID>        Register a board (used on boot)
+//      emu layout                          Reset to the compiled layout
+//      emu save                            Save the topology to flash
+//      emu erase                           Erase the saved topology
+void emu_command(char* args)
+{
+    char cmd[16] = "";
+    int a, b, drop, delay, rssi;
+    char hex[20];
+
+    sscanf(args, "%15s", cmd);
+
+    if (strcmp(cmd, "link") == 0
+        && sscanf(args, "%*s %d %d %d %d %d", &a, &b, &drop, &delay, &rssi)
+               == 5
+        && phys_in_range(a) && phys_in_range(b) && a != b) {
+        link_emu_t l = {true, (uint8_t) drop, (uint16_t) delay, (int8_t) rssi};
+        links[a][b] = l;
+        links[b][a] = l;
+    } else if (strcmp(cmd, "cut") == 0
+               && sscanf(args, "%*s %d %d", &a, &b) == 2 && phys_in_range(a)
+               && phys_in_range(b)) {
+        links[a][b].visible = false;
+        links[b][a].visible = false;
+    } else if (strcmp(cmd, "board") == 0
+               && sscanf(args, "%*s %d %19s", &a, hex) == 2 && a >= 0
+               && a < NUM_BOARDS) {
+        snprintf(board_IDs[a], sizeof(board_IDs[a]), "%s", hex);
+    } else if (strcmp(cmd, "layout") == 0) {
+        emu_from_layout();
+    } else if (strcmp(cmd, "save") == 0) {
+        emu_save();
+        return;
+    } else if (strcmp(cmd, "erase") == 0) {
+        emu_erase();
+        return;
+    } else if (cmd[0] != '\0') {
+        print_red;
+        printf("ERROR: ");
+        print_reset;
+        printf("Bad emu command: %s\n", args);
+        return;
+    }
+
+    print_emulation();
+}
+
+void print_emulation()
+{
+    printf("EMULATED LINKS (phys. IDs, drop %% / delay ms / rssi)\n");
+
+    for (int i = 0; i < MAX_NODES; i++) {
+        for (int j = 0; j < MAX_NODES; j++) {
+            link_emu_t* l = &links[i][j];
+            if (l->visible && i < j) {
+                printf("\t%d <--> %d  %3d%% %5dms %4d\n", i, j, l->drop_pct,
+                       l->delay_ms, l->rssi);
+            }
+        }
+    }
+
+    printf("BOARDS\n");
+    for (int i = 0; i < NUM_BOARDS; i++) {
+        printf("\t%d: %s\n", i, board_IDs[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef EMULATE_H
+#define EMULATE_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local
+#include "layout.h"
+#include "network_opts.h"
+
+// Link emulation builds on the physical IDs of the layout, so it only exists
+// in the USE_LAYOUT binaries. The compiled layout is the default topology, it
+// can be replaced at runtime from the serial console or a record in flash.
+#ifdef USE_LAYOUT
+
+// Emulated properties of the link between two physical boards
+typedef struct link_emu {
+    bool visible;      // Can the two boards see each other at all?
+    uint8_t drop_pct;  // Chance (%) to drop a scan result or received packet
+    uint16_t delay_ms; // Extra latency added to received packets
+    int8_t rssi;       // RSSI reported by scans, 0 to use the measured RSSI
+} link_emu_t;
+
+// Emulated links, indexed by physical ID
+extern link_emu_t links[MAX_NODES][MAX_NODES];
+
+// Load the emulated topology. Starts from the compiled layout (init_layout()
+// must be called first), then applies the topology saved in flash if any.
+void init_emulation();
+
+// Returns true if a scan result from [their_phys] should be seen by [my_phys]
+bool emu_scan_visible(int my_phys, int their_phys);
+
+// RSSI of [their_phys] as seen by [my_phys], [measured] if not overridden
+int emu_rssi(int my_phys, int their_phys, int measured);
+
+// Returns true if a packet from [their_phys] should be dropped by [my_phys]
+bool emu_drop_packet(int my_phys, int their_phys);
+
+// Extra latency (ms) for packets from [their_phys] to [my_phys]
+unsigned int emu_delay_ms(int my_phys, int their_phys);
+
+// Handle an "emu ..." console command ([args] is the text after "emu")
+void emu_command(char* args);
+
+// Print the emulated topology
+void print_emulation();
+
+#endif
+
+#endif
@@ -110,6 +110,11 @@ int init_layout()
         }
     }
 
+    // Physical IDs of other nodes are unknown until they are scanned
+    for (int i = 0; i < MAX_NODES; i++) {
+        ID_to_phys_ID[i] = -1;
+    }
+
     // Check for conflicting entries
     for (int i = 0; i < MAX_NODES; i++) {
         for (int j = 0; j < MAX_NODES; j++) {
@@ -0,0 +1,224 @@
+// C libraries
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Pico
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+
+// Local
+#include "log.h"
+#include "utils.h"
+
+uint32_t log_drops = 0;
+
+// Drops already reported by log_drain()
+static uint32_t log_drops_reported = 0;
+
+// Producers on either core (and interrupts) take the lock to claim a slot.
+// There is a single consumer, the log thread, which only moves [tail], so it
+// reads records without the lock.
+static spin_lock_t* log_lock;
+
+// Wakes the log thread
+static void (*log_post_event)(uint32_t events) = NULL;
+
+static struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    log_record_t records[LOG_RING_SIZE];
+} log_ring;
+
+void log_init(void (*post_event)(uint32_t events))
+{
+    log_lock       = spin_lock_init(spin_lock_claim_unused(true));
+    log_post_event = post_event;
+}
+
+// Called without the lock, a dropped record also wakes the log thread so the
+// drop is reported
+static void log_notify()
+{
+    if (log_post_event != NULL) {
+        log_post_event(EV_LOG);
+    }
+}
+
+// Claim the next slot, returns NULL (and counts the drop) if the ring is full.
+// Called with the lock held.
+static log_record_t* log_claim(uint8_t level, uint8_t module, log_kind_t kind)
+{
+    uint32_t head = log_ring.head;
+
+    if (head - log_ring.tail == LOG_RING_SIZE) {
+        log_drops++;
+        return NULL;
+    }
+
+    log_record_t* r = &log_ring.records[head % LOG_RING_SIZE];
+    r->time_us      = time_us_32();
+    r->level        = level;
+    r->module       = module;
+    r->kind         = kind;
+    r->nargs        = 0;
+    r->has_str      = false;
+    r->fmt          = NULL;
+
+    return r;
+}
+
+// Publish the record claimed last. Called with the lock held.
+static void log_commit()
+{
+    __dmb();
+    log_ring.head = log_ring.head + 1;
+}
+
+// Copy [s] into [r], truncating it
+static void log_copy_str(log_record_t* r, const char* s)
+{
+    int i = 0;
+    for (; i < LOG_STR_LEN - 1 && s[i] != '\0'; i++) {
+        r->str[i] = s[i];
+    }
+    r->str[i] = '\0';
+}
+
+void log_write(uint8_t level, uint8_t module, const char* str, const char* fmt,
+               int nargs, ...)
+{
+    uint32_t save   = spin_lock_blocking(log_lock);
+    log_record_t* r = log_claim(level, module, LOG_KIND_FMT);
+
+    if (r != NULL) {
+        r->fmt = fmt;
+
+        // Every argument is a 32-bit word on the RP2040 (see log.h)
+        va_list ap;
+        va_start(ap, nargs);
+        for (int i = 0; i < nargs && i < LOG_MAX_ARGS; i++) {
+            r->args[r->nargs++] = va_arg(ap, uint32_t);
+        }
+        va_end(ap);
+
+        if (str != NULL) {
+            r->has_str = true;
+            log_copy_str(r, str);
+        }
+
+        log_commit();
+    }
+
+    spin_unlock(log_lock, save);
+
+    log_notify();
+}
+
+// The packet types are string literals, so the record can point to them
+// instead of copying the type
+static const char* packet_type_name(const char* type)
+{
+    for (int i = 0; i < NUM_PACKET_TYPES; i++) {
+        if (strcmp(packet_types[i], type) == 0) {
+            return packet_types[i];
+        }
+    }
+
+    return "n/a";
+}
+
+void log_packet(uint8_t level, const char* color, const char* dir,
+                const packet_t* p)
+{
+    const char* type = packet_type_name(p->packet_type);
+
+    uint32_t save   = spin_lock_blocking(log_lock);
+    log_record_t* r = log_claim(level, LOG_MOD_UDP, LOG_KIND_PACKET);
+
+    if (r != NULL) {
+        r->fmt     = color;
+        r->args[0] = (uint32_t) (uintptr_t) dir;
+        r->args[1] = (uint32_t) (uintptr_t) type;
+        r->args[2] = (uint32_t) p->src_id;
+        r->args[3] = (uint32_t) p->dest_id;
+        r->args[4] = (uint32_t) p->ack_num;
+        r->nargs   = 5;
+        r->has_str = true;
+        log_copy_str(r, p->msg);
+
+        log_commit();
+    }
+
+    spin_unlock(log_lock, save);
+
+    log_notify();
+}
+
+bool log_pending()
+{
+    return log_ring.tail != log_ring.head || log_drops != log_drops_reported;
+}
+
+static void log_print(const log_record_t* r)
+{
+    const uint32_t* a = r->args;
+
+    printf("[%4u.%03u] ", (unsigned int) (r->time_us / 1000000),
+           (unsigned int) (r->time_us / 1000 % 1000));
+
+    if (r->level == LOG_LEVEL_ERROR) {
+        print_red;
+        printf("ERROR: ");
+        print_reset;
+    } else if (r->level == LOG_LEVEL_WARN) {
+        print_yellow;
+        printf("WARNING: ");
+        print_reset;
+    }
+
+    if (r->kind == LOG_KIND_PACKET) {
+        printf("%s| %s %s: %d -> %d, ack #%u { %s }", r->fmt,
+               (const char*) (uintptr_t) a[0], (const char*) (uintptr_t) a[1],
+               (int) a[2], (int) a[3], (unsigned int) a[4], r->str);
+        print_reset;
+    } else if (r->has_str) {
+        printf(r->fmt, r->str, a[0], a[1], a[2], a[3], a[4]);
+    } else {
+        printf(r->fmt, a[0], a[1], a[2], a[3], a[4], a[5]);
+    }
+
+    printf("\n");
+}
+
+int log_drain(int max)
+{
+    // A copy, so the slot can be reused as soon as [tail] moves
+    static log_record_t r;
+    int n = 0;
+
+    while (n < max && log_ring.tail != log_ring.head) {
+        uint32_t tail = log_ring.tail;
+
+        __dmb();
+        r = log_ring.records[tail % LOG_RING_SIZE];
+        __dmb();
+        log_ring.tail = tail + 1;
+
+        log_print(&r);
+        n++;
+    }
+
+    // Report overflows since the last drain
+    uint32_t drops = log_drops;
+    if (drops != log_drops_reported) {
+        print_yellow;
+        printf("(%u log records dropped)\n", drops - log_drops_reported);
+        print_reset;
+        log_drops_reported = drops;
+    }
+
+    return n;
+}
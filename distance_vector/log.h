@@ -0,0 +1,139 @@
+#ifndef LOG_H
+#define LOG_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local
+#include "network_opts.h"
+#include "packet.h"
+
+// Deferred logging. LOG_*() copies a record (time, format and arguments) into
+// a RAM ring without formatting it, and the log thread formats and prints the
+// records later with log_drain(), so a thread that logs isn't held up for the
+// length of a UART transfer. Records are dropped (and counted) while the ring
+// is full. Safe from both cores and from interrupts.
+//
+// The records are formatted after the fact, so:
+//  - arguments are stored as 32-bit words: integer, char and pointer
+//    conversions only (no %f or %llu, scale floats and 64-bit times down)
+//  - a %s argument must outlive the record (a string literal or a buffer that
+//    doesn't change), except for the one copied by LOG_STR()
+//  - the format has no trailing newline, log_drain() adds it
+//
+// Records above LOG_LEVEL and from modules missing from LOG_MODULES
+// (network_opts.h) are compiled out.
+
+// Scheduler event posted with each record (application bit, clear of the ones
+// main.c and net_core.h use)
+#define EV_LOG (1u << 10) // A record is waiting for log_drain()
+
+// Levels
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+// Modules
+#define LOG_MOD_MAIN (1u << 0) // Thread activity in main.c
+#define LOG_MOD_UDP  (1u << 1) // Packets sent and received
+#define LOG_MOD_DV   (1u << 2) // Distance vector updates
+#define LOG_MOD_ALL  0xFFu
+
+// Records in the ring
+#define LOG_RING_SIZE 64
+
+// Arguments per record, and the length of the copied string
+#define LOG_MAX_ARGS 6
+#define LOG_STR_LEN  48
+
+// Colors for packet records
+#define LOG_COLOR_GREEN  "\x1b[32m"
+#define LOG_COLOR_CYAN   "\x1b[36m"
+#define LOG_COLOR_ORANGE "\x1b[38;2;255;165;0m"
+
+// Kinds of records
+typedef enum log_kind {
+    LOG_KIND_FMT,   // printf() of [fmt] and [args]
+    LOG_KIND_PACKET // One line summary of a packet
+} log_kind_t;
+
+// One record
+typedef struct log_record {
+    uint32_t time_us;            // time_us_32() when it was written
+    uint8_t level;               // LOG_LEVEL_*
+    uint8_t module;              // LOG_MOD_*
+    uint8_t kind;                // log_kind_t
+    uint8_t nargs;               // Arguments in [args]
+    bool has_str;                // Is [str] the first argument?
+    const char* fmt;             // Format (string literal)
+    uint32_t args[LOG_MAX_ARGS]; // Arguments
+    char str[LOG_STR_LEN];       // Copied string
+} log_record_t;
+
+// Records dropped because the ring was full
+extern uint32_t log_drops;
+
+// Returns true if [level] and [module] are compiled in
+#define LOG_ENABLED(level, module)                                             \
+    ((level) <= LOG_LEVEL && ((module) & LOG_MODULES) != 0)
+
+// Number of arguments (up to LOG_MAX_ARGS)
+#define LOG_NARGS(...)  LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+
+// Log printf([fmt], ...) at [level] for [module]
+#define LOG(level, module, fmt, ...)                                           \
+    do {                                                                       \
+        if (LOG_ENABLED(level, module)) {                                      \
+            log_write(level, module, NULL, fmt, LOG_NARGS(__VA_ARGS__),        \
+                      ##__VA_ARGS__);                                          \
+        }                                                                      \
+    } while (0)
+
+// Same as LOG(), [s] is copied into the record (truncated to LOG_STR_LEN) and
+// is the format's first argument
+#define LOG_STR(level, module, fmt, s, ...)                                    \
+    do {                                                                       \
+        if (LOG_ENABLED(level, module)) {                                      \
+            log_write(level, module, s, fmt, LOG_NARGS(__VA_ARGS__),           \
+                      ##__VA_ARGS__);                                          \
+        }                                                                      \
+    } while (0)
+
+#define LOG_ERROR(module, ...) LOG(LOG_LEVEL_ERROR, module, __VA_ARGS__)
+#define LOG_WARN(module, ...)  LOG(LOG_LEVEL_WARN, module, __VA_ARGS__)
+#define LOG_INFO(module, ...)  LOG(LOG_LEVEL_INFO, module, __VA_ARGS__)
+#define LOG_DEBUG(module, ...) LOG(LOG_LEVEL_DEBUG, module, __VA_ARGS__)
+
+// Log a summary of [p] at [level], [dir] is "Incoming" or "Outgoing" and
+// [color] one of the LOG_COLOR_*
+#define LOG_PACKET(level, color, dir, p)                                       \
+    do {                                                                       \
+        if (LOG_ENABLED(level, LOG_MOD_UDP)) {                                 \
+            log_packet(level, color, dir, p);                                  \
+        }                                                                      \
+    } while (0)
+
+// Claim the ring's spin lock, call before anything is logged. [post_event] is
+// called with EV_LOG after each record (pt_post_event() to wake the log
+// thread)
+void log_init(void (*post_event)(uint32_t events));
+
+// Append a record, use the macros above
+void log_write(uint8_t level, uint8_t module, const char* str, const char* fmt,
+               int nargs, ...);
+
+// Append a packet record, use LOG_PACKET()
+void log_packet(uint8_t level, const char* color, const char* dir,
+                const packet_t* p);
+
+// Returns true if there are records to print
+bool log_pending();
+
+// Format and print up to [max] records, returns the number printed
+int log_drain(int max);
+
+#endif
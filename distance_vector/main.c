@@ -17,6 +17,18 @@
 #include "hardware/irq.h"
 #include "hardware/timer.h"
 
+// Event trace, ahead of the scheduler for its hooks
+#include "trace.h"
+#if TRACE_EVENTS
+#    define PT_TRACE_RUN(num)   trace_thread_run(num)
+#    define PT_TRACE_YIELD(num) trace_thread_yield(num)
+#endif
+
+// Scheduler statistics
+#if SCHED_STATS
+#    define PT_STATS true
+#endif
+
 // Protothreads
 #include "protothreads/pt_cornell_rp2040_v1_1_2.h"
 
@@ -27,99 +39,73 @@
 #include "dhcpserver/dhcpserver.h"
 
 // Local
+#include "conn_timing.h"
 #include "connect.h"
 #include "distance_vector.h"
+#include "emulate.h"
+#include "log.h"
+#include "net_core.h"
 #include "node.h"
 #include "packet.h"
+#include "persist.h"
+#include "scan_cache.h"
+#include "tdma.h"
+#include "traffic.h"
+#include "trickle.h"
 #include "utils.h"
 #include "wifi_scan.h"
 
-/********************************
- *  DEBUGGING
- ********************************/
-
-#define PRINT_ON_RECV
-#define PRINT_ON_SEND
-
 /********************************
  *  UDP
  ********************************/
 
-// UDP constants
-#define UDP_PORT 4444 // Same port number on both devices
+// Scheduler events, the threads sleep until one they wait on is posted
+#define EV_SEND         (PT_EVENT_USER << 0)  // signal_send_thread was set
+#define EV_SENT         (PT_EVENT_USER << 1)  // The send thread sent a packet
+#define EV_CONNECT      (PT_EVENT_USER << 2)  // The connect thread has work
+#define EV_CONNECT_DONE (PT_EVENT_USER << 3)  // The connect thread is done
+#define EV_ACK_DONE     (PT_EVENT_USER << 4)  // The ack queue was emptied
+#define EV_RECV         (PT_EVENT_USER << 5)  // A packet was processed
+#define EV_TRAFFIC      (PT_EVENT_USER << 6)  // A traffic run was started
+#define EV_ROUTES       (PT_EVENT_USER << 7)  // The upkeep thread changed my DV
+#define EV_PERSIST      (PT_EVENT_USER << 12) // A save to flash is pending
 
 // UDP recv
 char recv_data[UDP_MSG_LEN_MAX];
-static struct udp_pcb* udp_recv_pcb;
-struct pt_sem new_udp_recv_s;
 
 // UDP send
 packet_t send_queue;
-static ip_addr_t dest_addr;
-static struct udp_pcb* udp_send_pcb;
 bool signal_send_thread = false;
 
-// UDP ack
-packet_t ack_queue;
-bool ack_queue_empty              = true;
-char return_addr_str[IP_ADDR_LEN] = "255.255.255.255";
-static ip_addr_t return_addr;
-static struct udp_pcb* udp_ack_pcb;
+// UDP ack. The recv thread can queue more acks while the ack thread waits on
+// the network core, so they're queued with their return addresses.
+#define ACK_QUEUE_LEN 4
+packet_t ack_queue[ACK_QUEUE_LEN];
+char ack_addrs[ACK_QUEUE_LEN][IP_ADDR_LEN];
+unsigned int ack_head     = 0; // Acks ever queued
+unsigned int ack_tail     = 0; // Acks ever taken by the ack thread
+unsigned int acks_pending = 0; // Queued and not sent yet
 struct pt_sem new_udp_ack_s;
 
-// UDP recv callback function
-void udp_recv_callback(void* arg, struct udp_pcb* upcb, struct pbuf* p,
-                       const ip_addr_t* addr, u16_t port)
-{
-    // Prevent "unused argument" compiler warning
-    LWIP_UNUSED_ARG(arg);
-
-    printf("You've got mail! (received a packet)\n");
-
-    if (p != NULL) {
-        // Copy the payload into the recv buffer
-        memcpy(recv_data, p->payload, UDP_MSG_LEN_MAX);
-
-        // Free the packet buffer
-        pbuf_free(p);
-
-        // Signal waiting threads
-        PT_SEM_SAFE_SIGNAL(pt, &new_udp_recv_s);
-    } else {
-        printf("ERROR: NULL pt in callback\n");
-    }
-}
-
-// Define the recv callback function
-int udp_recv_callback_init(void)
-{
-    // Create a new UDP PCB
-    udp_recv_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+/********************************
+ *  LOGGING
+ ********************************/
 
-    if (udp_recv_pcb != NULL) {
-        err_t err;
+// Records formatted by the log thread per turn
+#define LOG_DRAIN_BATCH 4
 
-        // Bind the UDP PCB to the socket
-        // - netif_ip4_addr returns the pico-w ip address
-        err = udp_bind(udp_recv_pcb, netif_ip4_addr(netif_list),
-                       UDP_PORT); // DHCP addr
+// Neighbor whose DV the log thread should print with mine, -1 for none
+int dv_tables_nbr = -1;
 
-        if (err == ERR_OK) {
-            // This function assigns the callback function for when a UDP
-            // packet is received
-            udp_recv(udp_recv_pcb, udp_recv_callback, NULL);
-        } else {
-            printf("UDP bind error\n");
-            return 1;
-        }
-    } else {
-        printf("ERROR: udpecho_raw_pcb was NULL\n");
-        return 1;
-    }
+/********************************
+ *  TRAFFIC
+ ********************************/
 
-    // Success
-    return 0;
-}
+// Load test started with the "tg" command (see traffic.h). The generator sends
+// through the send queue and the forwarding path like typed messages, the
+// sink counts the runs addressed to me.
+traffic_gen_t traffic_gen;
+traffic_sink_t traffic_sink;
 
 /************************************************
  *  WIFI CONNECT / DISCONNECT
@@ -131,6 +117,27 @@ int udp_recv_callback_init(void)
 // Signal protothread_connect that a new connection needs to be made
 bool signal_connect_thread = false;
 
+// Wake protothread_send to send the packet in the send queue
+void signal_send()
+{
+    signal_send_thread = true;
+    TRACE(TR_ENQUEUE, TRQ_SEND, 1);
+    pt_post_event(EV_SEND);
+}
+
+// Wake protothread_connect to make the connection to target_ID
+void signal_connect()
+{
+    signal_connect_thread = true;
+    pt_post_event(EV_CONNECT);
+}
+
+// True while protothread_connect is part way through a transition. It yields
+// during scans and network calls, and nothing may be sent until the new
+// connection is made. The recv thread holds back the packets that would queue
+// a send or a connection meanwhile.
+bool connect_in_progress = false;
+
 // ID to target during connection. Can take special values
 int connected_ID = ENABLE_AP;
 int target_ID    = ENABLE_AP;
@@ -138,6 +145,91 @@ int target_ID    = ENABLE_AP;
 // SSID of the target access point
 char target_ssid[SSID_LEN];
 
+/************************************************
+ *  RENDEZVOUS SCHEDULE
+ ************************************************/
+
+// My clock against the network time (see tdma.h)
+tdma_t tdma;
+
+// Network time (us), my own time until I've synced with my parent
+uint64_t net_time_us()
+{
+    return tdma_net_time(&tdma, time_us_64());
+}
+
+// Returns true if neighbors are reached on the slot schedule
+bool tdma_active()
+{
+#if TDMA_SCHEDULE
+    return tdma.synced;
+#else
+    return false;
+#endif
+}
+
+// My time at which [ID]'s next connect window opens
+uint64_t slot_wake_time(int ID)
+{
+    if (ID < CONNECT_TO_AP) {
+        return 0;
+    }
+
+    return tdma_next_window(ID, net_time_us()) - tdma.offset;
+}
+
+// The current association, kept open while traffic for the neighbor continues
+uint64_t assoc_start        = 0;     // Time the association was made
+unsigned int assoc_packets  = 0;     // Packets sent over it
+bool assoc_lingering        = false; // Waiting for more traffic?
+uint64_t assoc_linger_until = 0;     // Give up waiting at this time
+
+// Returns true if the current association hasn't used up its share of the
+// link (see ASSOC_MAX_PACKETS and ASSOC_MAX_MS)
+bool assoc_has_share_left()
+{
+    return assoc_packets < ASSOC_MAX_PACKETS
+           && time_us_64() - assoc_start < 1000ULL * ASSOC_MAX_MS;
+}
+
+// Returns true if a packet for [ID] can go out over the current association
+bool assoc_reusable(int ID)
+{
+    return ID >= CONNECT_TO_AP && ID == connected_ID && station_active
+           && assoc_has_share_left()
+           && (!tdma_active()
+               || tdma_hosting(ID, net_time_us() + TDMA_GUARD_US))
+           && cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA)
+                  == CYW43_LINK_UP;
+}
+
+// Returns true once a lingering association has been idle for
+// ASSOC_IDLE_TIMEOUT_MS, or its AP's slot is ending, and signals a return to
+// AP mode
+bool assoc_idle()
+{
+    if (!assoc_lingering) {
+        return false;
+    }
+
+    bool slot_over =
+        tdma_active()
+        && !tdma_hosting(connected_ID, net_time_us() + TDMA_GUARD_US);
+
+    if (!slot_over
+        && (signal_send_thread || time_us_64() < assoc_linger_until)) {
+        return false;
+    }
+
+    printf("Association with node %d idle, releasing it\n", connected_ID);
+
+    assoc_lingering = false;
+    target_ID       = ENABLE_AP;
+    signal_connect();
+
+    return true;
+}
+
 /************************************************
  *  STATE
  ************************************************/
@@ -155,22 +247,99 @@ phase_t phase = DO_NOTHING;
  *  ROUTING
  ************************************************/
 
-// Cooldown min and max durations in microseconds (us)
-#define COOLDOWN_MIN (15 * 1e6)
-#define COOLDOWN_MAX (30 * 1e6)
+// Trickle timer that schedules DV exchanges. It stays stopped until the first
+// DV is sent or received.
+trickle_t dv_trickle;
+
+// Push my DV to the next un-updated neighbor without waiting for the timer
+bool dv_push_asap = false;
+
+// Time of the push that retries a failed connection, UINT64_MAX for none
+uint64_t dv_retry_time = UINT64_MAX;
+
+// Time by which the routes resumed from flash must have been confirmed,
+// UINT64_MAX if there are none
+uint64_t routes_confirm_time = UINT64_MAX;
+
+// Time at which my state is saved to flash, UINT64_MAX if nothing changed
+uint64_t persist_time = UINT64_MAX;
+
+// Save my state once it stops changing, every change pushes the save back
+static void persist_later(void)
+{
+    persist_time = time_us_64() + PERSIST_QUIET_US;
+    pt_post_event(EV_PERSIST);
+}
+
+// The un-updated neighbor whose slot comes up first, NULL if there is none
+nbr_t* next_nbr_by_slot()
+{
+    uint64_t now       = net_time_us();
+    uint64_t best_time = UINT64_MAX;
+    nbr_t* best        = NULL;
+
+    for (int id = 0; id < MAX_NODES; id++) {
+        nbr_t* nb = self.nbrs[id];
+
+        if (nb != NULL && !nb->up_to_date
+            && tdma_next_window(id, now) < best_time) {
+            best      = nb;
+            best_time = tdma_next_window(id, now);
+        }
+    }
+
+    return best;
+}
 
-// Scan scheduling macros
-#define NO_SCAN   UINT64_MAX
-#define SCAN_ASAP 0
+// Time at which the connect thread has to look at the trickle timer or a
+// lingering association again, even if no event wakes it
+uint64_t connect_wake_time()
+{
+    uint64_t wake = trickle_next_event(&dv_trickle);
 
-// Time of next routing scan
-uint64_t next_dv_scan = NO_SCAN;
+    if (dv_retry_time < wake) {
+        wake = dv_retry_time;
+    }
+    if (assoc_lingering && assoc_linger_until < wake) {
+        wake = assoc_linger_until;
+    }
 
-// Generate a random uint64_t in the range [min, max]
-uint64_t rand_uint64(uint64_t min, uint64_t max)
+    return wake;
+}
+
+// Returns true if it is time for a routing scan. Polls the trickle timer, and
+// suppresses the scan if enough neighbors have already sent me a consistent DV
+// this interval or if every neighbor has already heard my current DV.
+bool dv_scan_due()
 {
-    float rand = (float) (get_rand_32()) / UINT32_MAX;
-    return (uint64_t) (min + (max - min) * rand);
+    if (dv_push_asap) {
+        return true;
+    }
+
+    // Retry after a failed connection, the neighbor is still un-updated
+    if (time_us_64() >= dv_retry_time) {
+        dv_retry_time = UINT64_MAX;
+        if (num_unupdated_nbrs(&self) > 0) {
+            printf("Retrying the failed connection\n");
+            dv_push_asap = true;
+            return true;
+        }
+    }
+
+    trickle_event_t ev = trickle_poll(&dv_trickle, time_us_64());
+
+    if (ev == TRICKLE_TRANSMIT) {
+        if (num_unupdated_nbrs(&self) > 0) {
+            dv_push_asap = true;
+        } else {
+            printf("Trickle: all neighbors have my DV, skipping scan\n");
+        }
+    } else if (ev == TRICKLE_SUPPRESS) {
+        printf("Trickle: heard %u consistent DVs, suppressing scan\n",
+               dv_trickle.c);
+    }
+
+    return dv_push_asap;
 }
 
 /************************************************
@@ -192,38 +361,86 @@ static PT_THREAD(protothread_connect(struct pt* pt))
     // Error code for connect_to_network()
     static int connect_err;
 
+    // Target of this pass. The other threads may ask for the next one (in
+    // target_ID) while this one yields.
+    static int target;
+
     // Destination ID
     int dest_ID;
 
     // Buffer for composing messages
     static char msg_buf[TOK_LEN];
 
-    // Amount of time to stay in AP mode after scanning and not seeing anyone
-    uint64_t cooldown_usec;
+    // Targeted scans
+    static scan_filter_t scan_filter = {NULL, false};
+    static char scan_ssid[SSID_LEN];
+
+    // Start of the phase being timed
+    static uint64_t phase_start;
+
+    // Call to the network core
+    static net_call_t net;
 
     while (true) {
 
         // Wait until signalled AND there are no pending ACKs
-        PT_YIELD_UNTIL(pt,
-                       (signal_connect_thread || time_us_64() > next_dv_scan)
-                           && ack_queue_empty);
+        PT_WAIT_EVENT_UNTIL(pt,
+                            EV_CONNECT | EV_ACK_DONE | EV_SENT | EV_RECV
+                                | EV_ROUTES,
+                            connect_wake_time(),
+                            acks_pending == 0
+                                && (signal_connect_thread || dv_scan_due()
+                                    || assoc_idle()));
 
         printf("\n========== CONNECT THREAD ==========\n");
         // printf("target_ID: %d\n", target_ID);
 
         // If the thread was triggered by a scan, set target to scan
-        if (!signal_connect_thread && time_us_64() > next_dv_scan) {
+        if (!signal_connect_thread && dv_push_asap) {
             printf("Scan scheduled:\n");
             printf("\tcurr time    = %.1f sec\n", (float) time_us_64() / 1e6);
-            printf("\tnext_dv_scan = %.1f sec\n", (float) next_dv_scan / 1e6);
+            printf("\tinterval     = %.1f sec\n", (float) dv_trickle.i / 1e6);
 
-            target_ID = DV_SCAN;
+            dv_push_asap = false;
+            target_ID    = DV_SCAN;
         }
 
-        printf("target_ID: %d\n", target_ID);
+        target = target_ID;
+        printf("target_ID: %d\n", target);
 
         signal_connect_thread = false;
 
+        // More traffic for the neighbor I'm still associated with, skip the
+        // reconnection
+        if (assoc_reusable(target)) {
+            assoc_packets++;
+            assoc_lingering = false;
+            printf("Reusing the association with node %d (packet %u)\n",
+                   target, assoc_packets);
+            pt_post_event(EV_CONNECT_DONE);
+            continue;
+        }
+
+        connect_in_progress = true;
+
+        // Join the target at the start of its slot, hosting my AP until then
+        if (tdma_active() && target >= CONNECT_TO_AP
+            && !tdma_in_window(target, net_time_us())) {
+            printf("Waiting %.1f sec for node %d's slot\n",
+                   (float) (tdma_next_window(target, net_time_us())
+                            - net_time_us())
+                       / 1e6,
+                   target);
+
+            PT_WAIT_EVENT_UNTIL(pt, EV_ACK_DONE, slot_wake_time(target),
+                                acks_pending == 0
+                                    && tdma_in_window(target, net_time_us()));
+        }
+
+        assoc_lingering = false;
+
+        conn_timing_begin(target);
+
         // Reset error code
         connect_err = 0;
 
@@ -231,58 +448,110 @@ static PT_THREAD(protothread_connect(struct pt* pt))
          *  Toggle connection state
          ************************************************/
 
-        if (target_ID != ENABLE_AP) {
+#if CONCURRENT_AP_STA
+        // My AP stays up the whole time. It's only restarted when my SSID
+        // changes, i.e. when a pidog has just been given an ID.
+        if (self.ID != DEFAULT_ID) {
+            generate_picow_ssid(self.wifi_ssid, self.ID);
+        }
+        PT_NET_CALL(pt, &net, NET_ENSURE_AP, 0, NULL);
+        static int ap_err;
+        ap_err = net.result;
+
+        // Drop the current association, and join again unless I'm going back
+        // to hosting only
+        if (station_active) {
+            PT_NET_CALL(pt, &net, NET_SHUTDOWN_STATION, 0, NULL);
+        }
+        if (target != ENABLE_AP) {
+            PT_NET_CALL(pt, &net, NET_BOOT_STATION, 0, NULL);
+        } else if (ap_err == 0) {
+            connected_ID = target;
+        }
+#else
+        if (target != ENABLE_AP) {
             // Set mode to station mode
             if (access_point) {
-                shutdown_ap();
+                PT_NET_CALL(pt, &net, NET_SHUTDOWN_AP, 0, NULL);
 #if RE_INIT_CYW43_BTW_MODES
-                re_init_cyw43();
+                PT_NET_CALL(pt, &net, NET_RE_INIT_CYW43, 0, NULL);
 #endif
-                boot_station();
+                PT_NET_CALL(pt, &net, NET_BOOT_STATION, 0, NULL);
 
                 // Set dest addr to the access point
                 snprintf(dest_addr_str, IP_ADDR_LEN, "%s", AP_ADDR);
             } else {
-                shutdown_station();
-                boot_station();
+                PT_NET_CALL(pt, &net, NET_SHUTDOWN_STATION, 0, NULL);
+                PT_NET_CALL(pt, &net, NET_BOOT_STATION, 0, NULL);
             }
-        } else if (target_ID == ENABLE_AP) {
+        } else if (target == ENABLE_AP) {
             if (!access_point) {
-                shutdown_station();
+                PT_NET_CALL(pt, &net, NET_SHUTDOWN_STATION, 0, NULL);
 #if RE_INIT_CYW43_BTW_MODES
-                re_init_cyw43();
+                PT_NET_CALL(pt, &net, NET_RE_INIT_CYW43, 0, NULL);
 #endif
                 // Turn on the access point
                 generate_picow_ssid(self.wifi_ssid, self.ID);
 
                 // Only set connected_ID if the AP successfully booted
-                if (boot_ap() == 0) {
-                    connected_ID = target_ID;
+                PT_NET_CALL(pt, &net, NET_BOOT_AP, 0, NULL);
+                if (net.result == 0) {
+                    connected_ID = target;
                 }
             }
         }
+#endif
 
         /************************************************
          *  Perform scan or connect behavior
          ************************************************/
 
-        if (target_ID == DV_SCAN) {
+        if (target == DV_SCAN) {
 
             if (num_unupdated_nbrs(&self) == 0 && phase == DV_ROUTING) {
                 print_dist_vector(&self, self.ID);
                 print_routing_table(&self);
 
-                next_dv_scan = NO_SCAN;
-
                 // Signal for AP mode
-                target_ID             = ENABLE_AP;
-                signal_connect_thread = true;
+                target_ID = ENABLE_AP;
+                signal_connect();
 
                 // Don't scan anymore until your DV updates
                 phase = DO_NOTHING;
 
             } else {
-                scan_wifi(DV_ROUTE_SCAN);
+                if (tdma_active()) {
+                    // The schedule says when each neighbor hosts, so there's
+                    // nothing to scan for
+                    routing_scan_result = next_nbr_by_slot();
+                } else {
+                    // With a single neighbor left to update, only look for its
+                    // network
+                    scan_filter.ssid    = NULL;
+                    scan_filter.passive = false;
+                    if (num_unupdated_nbrs(&self) == 1) {
+                        for (int id = 0; id < MAX_NODES; id++) {
+                            if (self.nbrs[id] != NULL
+                                && !self.nbrs[id]->up_to_date) {
+                                generate_picow_ssid(scan_ssid, id);
+                                scan_filter.ssid = scan_ssid;
+                            }
+                        }
+                    }
+
+                    // A network the cache has seen before is known to be
+                    // beaconing, so listen for it instead of probing
+                    scan_entry_t seen;
+                    if (scan_filter.ssid != NULL
+                        && scan_cache_find(scan_filter.ssid, &seen)) {
+                        scan_filter.passive = true;
+                    }
+
+                    // Other threads keep running while the radio scans
+                    phase_start = time_us_64();
+                    PT_SCAN_WIFI_FILTERED(pt, DV_ROUTE_SCAN, &scan_filter);
+                    conn_timing_record(CONN_PHASE_SCAN, phase_start);
+                }
 
                 if (routing_scan_result != NULL) {
                     dest_ID = routing_scan_result->ID;
@@ -292,66 +561,74 @@ static PT_THREAD(protothread_connect(struct pt* pt))
                     send_queue =
                         new_packet("dv", dest_ID, self.ID, self.ip_addr,
                                    self.counter, time_us_64(), msg_buf);
-                    signal_send_thread = true;
+                    signal_send();
 
                     // Signal for a reconnection
-                    printf("Changing target_ID: %d", target_ID);
+                    printf("Changing target_ID: %d", target);
                     target_ID = dest_ID;
                     printf(" --> %d\n", target_ID);
 
-                    signal_connect_thread = true;
-
-                    next_dv_scan = time_us_64() + COOLDOWN_MIN;
+                    signal_connect();
 
                 } else {
-                    // Stay in AP mode for a random number of microseconds
-                    cooldown_usec = rand_uint64(COOLDOWN_MIN, COOLDOWN_MAX);
-                    next_dv_scan  = time_us_64() + cooldown_usec;
-                    printf("Waiting %.1f sec before scanning again (random)\n",
-                           (float) cooldown_usec / 1e6);
+                    // Stay in AP mode until the next trickle event
+                    printf("Waiting %.1f sec before scanning again (trickle)\n",
+                           (float) (trickle_next_event(&dv_trickle)
+                                    - time_us_64())
+                               / 1e6);
 
                     // Signal for AP mode
-                    target_ID             = ENABLE_AP;
-                    signal_connect_thread = true;
+                    target_ID = ENABLE_AP;
+                    signal_connect();
                 }
             }
 
-        } else if (target_ID == NF_SCAN) {
+        } else if (target == NF_SCAN) {
 
             // Give time for whoever sent you the token to boot back up
-            printf("Waiting for nearby APs to boot:\n\t");
-            sleep_ms_progress_bar(AP_BOOT_TIME, 30);
+            printf("Waiting %d ms for nearby APs to boot...\n", AP_BOOT_TIME);
+            PT_YIELD_usec(1000 * AP_BOOT_TIME);
 
             // Scan for targets
-            scan_wifi(NBR_FIND_SCAN);
+            phase_start = time_us_64();
+            PT_SCAN_WIFI(pt, NBR_FIND_SCAN);
+            conn_timing_record(CONN_PHASE_SCAN, phase_start);
 
             if (pidogs_found) {
                 // Copy the result into target_ssid
                 snprintf(target_ssid, SSID_LEN, "%s", nbr_find_scan_result);
 
                 // Try to connect to wifi
-                connect_err = connect_to_network(target_ssid);
+                PT_NET_CALL(pt, &net, NET_CONNECT, 0, target_ssid);
+                connect_err = net.result;
+
+                // The pidog is renamed once it has the token, so don't trust
+                // the cache for the next scan
+                scan_cache_forget(target_ssid);
             } else {
                 // Flag that neighbors have been recorded
                 if (!self.knows_nbrs) {
                     self.knows_nbrs = true;
 
                     init_dist_vector_routing(&self);
+
+                    // Remember my ID and neighbors across reboots
+                    persist_later();
                 }
 
                 if (self.ID == MASTER_ID) {
                     // Master node has received token back, and has no
                     // uninitialized neighbors.
-                    target_ID             = ENABLE_AP;
-                    signal_connect_thread = true;
+                    target_ID = ENABLE_AP;
+                    signal_connect();
 
                     // (Placeholder) Dequeue the token from the send thread
                     signal_send_thread = false;
                 } else {
                     // If node is not the master node, hand the token
                     // back to the parent node
-                    target_ID             = self.parent_ID;
-                    signal_connect_thread = true;
+                    target_ID = self.parent_ID;
+                    signal_connect();
 
                     print_green;
                     printf("\nNO UNINITIALIZED NEIGHBORS, SEND TOKEN BACK TO "
@@ -360,54 +637,56 @@ static PT_THREAD(protothread_connect(struct pt* pt))
                 }
             }
 
-        } else if (target_ID >= CONNECT_TO_AP) {
+        } else if (target >= CONNECT_TO_AP) {
 
             // Connect to someone else's network
-            generate_picow_ssid(target_ssid, target_ID);
+            generate_picow_ssid(target_ssid, target);
 
             // Try to connect to wifi
-            connect_err = connect_to_network(target_ssid);
+            PT_NET_CALL(pt, &net, NET_CONNECT, 0, target_ssid);
+            connect_err = net.result;
 
             // Update time of last contact
-            if (phase == DV_ROUTING && self.nbrs[target_ID] != NULL) {
-                self.nbrs[target_ID]->last_contact = time_us_64();
+            if (phase == DV_ROUTING && self.nbrs[target] != NULL) {
+                self.nbrs[target]->last_contact = time_ms_32();
+
+                // Track failures, they lower the nbr's priority score
+                if (connect_err == 0) {
+                    self.nbrs[target]->connect_fails = 0;
+                } else {
+                    if (self.nbrs[target]->connect_fails < UINT8_MAX) {
+                        self.nbrs[target]->connect_fails++;
+                    }
+                }
             }
 
             if (connect_err == 0) {
                 // If successful, change the connected_id number
-                connected_ID = target_ID;
-            } else {
-                // If failed, go back to AP mode
-                target_ID             = ENABLE_AP;
-                signal_connect_thread = true;
+                connected_ID = target;
 
-                if (phase == DV_ROUTING) {
-                    next_dv_scan = time_us_64() + COOLDOWN_MIN;
-                }
+                assoc_start   = time_us_64();
+                assoc_packets = 1;
+            } else {
+                // The AP is gone or refused me, rescan before picking it again
+                scan_cache_forget(target_ssid);
+
+                // If failed, go back to AP mode. The neighbor is still not
+                // up-to-date, retry it without waiting for the trickle
+                // interval (or for a transmission it may suppress).
+                target_ID = ENABLE_AP;
+                signal_connect();
+                dv_retry_time = time_us_64() + DV_RETRY_US;
             }
-        } else if (target_ID != ENABLE_AP) {
+        } else if (target != ENABLE_AP) {
             // Invalid target error
             print_red;
             printf("ERROR: ");
             print_reset;
-            printf("target_ID = %d\n", target_ID);
-        }
-
-        /************************************************
-         *  Re-initialize UDP
-         ************************************************/
-
-        // Re-initialize UDP recv callback function
-        udp_remove(udp_recv_pcb);
-        printf("Initializing recv callback...");
-        if (udp_recv_callback_init()) {
-            printf("receive callback failed to initialize.");
-        } else {
-            printf("success!\n");
+            printf("target_ID = %d\n", target);
         }
 
         // Print the results of neighbor finding
-        if (phase == NB_FINDING && self.knows_nbrs && access_point) {
+        if (phase == NB_FINDING && self.knows_nbrs && !station_active) {
             print_neighbors();
 
             // Print distance vector and routing table
@@ -420,6 +699,10 @@ static PT_THREAD(protothread_connect(struct pt* pt))
             phase = DO_NOTHING;
         }
 
+        conn_timing_end(connect_err);
+        connect_in_progress = false;
+        pt_post_event(EV_CONNECT_DONE);
+
         PT_YIELD(pt);
     }
 
@@ -433,84 +716,65 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
 {
     PT_BEGIN(pt);
 
-    // Create a new UDP PCB
-    udp_send_pcb              = udp_new();
-    udp_send_pcb->remote_port = UDP_PORT;
-    udp_send_pcb->local_port  = UDP_PORT;
-
     // Outgoing packet
     static packet_t send_buf;
 
     // Payload
     static char buffer[UDP_MSG_LEN_MAX];
-    static int udp_send_length;
 
-    // The address of the pbuf payload
-    static char* req;
+    // Call to the network core
+    static net_call_t net;
 
     // Error code
     static err_t er;
 
     while (true) {
 
-        PT_YIELD_UNTIL(pt, signal_send_thread && !signal_connect_thread
-                               && !access_point);
+        PT_WAIT_EVENT_UNTIL(pt, EV_SEND | EV_CONNECT_DONE, PT_NO_WAKE_TIME,
+                            signal_send_thread && !signal_connect_thread
+                                && !connect_in_progress && station_active);
         signal_send_thread = false;
 
-        printf("\n========== SEND THREAD ==========\n");
-
-        // Assign target pico IP address, string -> ip_addr_t
-        ipaddr_aton(dest_addr_str, &dest_addr);
+        LOG_DEBUG(LOG_MOD_MAIN, "========== SEND THREAD ==========");
 
         // Pop the head of the queue
         send_buf = send_queue;
+        TRACE(TR_DEQUEUE, TRQ_SEND, 0);
 
         // Set the return IP address of the packet
         snprintf(send_buf.ip_addr, IP_ADDR_LEN, "%s", self.ip_addr);
 
+        // Stamp the packet as it leaves. The ack echoes the stamp back for the
+        // RTT, and my children follow my clock through it (see tdma.h).
+        send_buf.timestamp = net_time_us();
+
         // Convert to string
         packet_to_str(buffer, send_buf);
 
-        // Allocate pbuf
-        udp_send_length = strlen(buffer);
-        struct pbuf* p =
-            pbuf_alloc(PBUF_TRANSPORT, udp_send_length + 1, PBUF_RAM);
-
-        // Clear the payload and write to it
-        req = (char*) p->payload; // Cast from void* to char*
-        memset(req, 0, udp_send_length + 1);
-        memcpy(req, buffer, udp_send_length);
-
-#ifdef PRINT_ON_SEND
-        // Print formatted packet contents
-        print_orange;
-        printf("| Outgoing...\n");
-        print_packet(buffer, send_buf);
-        print_reset;
-#endif
+        // Log formatted packet contents
+        LOG_PACKET(LOG_LEVEL_DEBUG, LOG_COLOR_ORANGE, "Outgoing", &send_buf);
 
-        if (!access_point) { // Print destination addr
-            printf("Destination IPv4 addr: %s\n", ip4addr_ntoa(&dest_addr));
+        if (station_active) { // Log destination addr
+            LOG_STR(LOG_LEVEL_DEBUG, LOG_MOD_UDP, "Destination IPv4 addr: %s",
+                    dest_addr_str);
         } else {
-            print_red;
-            printf("ERROR: ");
-            print_reset;
-            printf("An access point is using the send thread!\n");
+            LOG_ERROR(LOG_MOD_MAIN, "The send thread ran without a station!");
         }
 
         // Send packet
-        cyw43_arch_lwip_begin();
-        er = udp_sendto(udp_send_pcb, p, &dest_addr, UDP_PORT);
-        cyw43_arch_lwip_end();
+        net_call_init(&net, NET_UDP_SEND, 0, buffer);
+        net.addr = dest_addr_str;
+        PT_NET_WAIT(pt, &net);
+        er = net.result;
 
         if (er == ERR_OK) {
             self.counter++;
         } else {
-            printf("Failed to send UDP packet! error=%d\n", er);
+            LOG_ERROR(LOG_MOD_UDP, "Failed to send UDP packet! error=%d", er);
+            traffic_send_failed(&traffic_gen, send_buf.msg);
         }
 
-        // Free the packet buffer
-        pbuf_free(p);
+        pt_post_event(EV_SENT);
 
         PT_YIELD(pt);
     }
@@ -521,6 +785,113 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
 // ==================================================
 // UDP recv thread
 // ==================================================
+
+#ifdef USE_LAYOUT
+// Packets held back by the emulated latency of their link. Each one is
+// released on its own, so a slow link doesn't hold up the packets behind it.
+#    define DELAY_QUEUE_LEN 4
+
+typedef struct delayed_packet {
+    bool used;
+    uint64_t arrival_us; // Time it was taken from the rx queue
+    uint64_t release_us; // Time it's handed to the recv thread
+    packet_t packet;
+} delayed_packet_t;
+
+delayed_packet_t delay_queue[DELAY_QUEUE_LEN];
+
+// Free slot of the delay queue, NULL if it's full
+delayed_packet_t* delay_slot()
+{
+    for (int i = 0; i < DELAY_QUEUE_LEN; i++) {
+        if (!delay_queue[i].used) {
+            return &delay_queue[i];
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+// Take the next received packet into [packet], and the time it arrived into
+// [arrival_us]. Returns false if there is none. With USE_LAYOUT the packets go
+// through the emulated loss and latency of the link to their sender first.
+bool recv_next(packet_t* packet, uint64_t* arrival_us)
+{
+#ifdef USE_LAYOUT
+    uint64_t now = time_us_64();
+    delayed_packet_t* slot;
+
+    // Move the received packets into the delay queue. The ones that don't
+    // fit wait in the rx queue.
+    while ((slot = delay_slot()) != NULL && net_rx_pop(recv_data)) {
+        slot->packet = str_to_packet(recv_data);
+
+        int src_ID      = slot->packet.src_id;
+        int src_phys_ID = (src_ID >= 0 && src_ID < MAX_NODES)
+                            ? ID_to_phys_ID[src_ID]
+                            : -1;
+
+        if (emu_drop_packet(self.physical_ID, src_phys_ID)) {
+            LOG_INFO(LOG_MOD_UDP, "Dropped packet from node %d (emulated loss)",
+                     src_ID);
+            continue;
+        }
+
+        slot->used       = true;
+        slot->arrival_us = now;
+        slot->release_us =
+            now + 1000ULL * emu_delay_ms(self.physical_ID, src_phys_ID);
+    }
+
+    // Release the packet that's due first
+    delayed_packet_t* next = NULL;
+
+    for (int i = 0; i < DELAY_QUEUE_LEN; i++) {
+        if (delay_queue[i].used && delay_queue[i].release_us <= now
+            && (next == NULL || delay_queue[i].release_us < next->release_us)) {
+            next = &delay_queue[i];
+        }
+    }
+
+    if (next == NULL) {
+        return false;
+    }
+
+    *packet     = next->packet;
+    *arrival_us = next->arrival_us;
+    next->used  = false;
+
+    return true;
+#else
+    if (!net_rx_pop(recv_data)) {
+        return false;
+    }
+
+    // Convert the contents of the received packet to a packet_t
+    *packet     = str_to_packet(recv_data);
+    *arrival_us = time_us_64();
+
+    return true;
+#endif
+}
+
+// Time at which the next delayed packet is released, PT_NO_WAKE_TIME if none
+// is held back
+uint64_t recv_wake_time()
+{
+    uint64_t wake = PT_NO_WAKE_TIME;
+
+#ifdef USE_LAYOUT
+    for (int i = 0; i < DELAY_QUEUE_LEN; i++) {
+        if (delay_queue[i].used && delay_queue[i].release_us < wake) {
+            wake = delay_queue[i].release_us;
+        }
+    }
+#endif
+
+    return wake;
+}
 static PT_THREAD(protothread_udp_recv(struct pt* pt))
 {
     PT_BEGIN(pt);
@@ -529,11 +900,14 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
     static uint64_t timestamp;
 
     // Round trip time
-    static float rtt_ms;
+    static uint32_t rtt_us;
 
     // Incoming packet
     static packet_t recv_buf;
 
+    // Time the packet was taken from the rx queue
+    static uint64_t arrival_us;
+
     // Datatype of the received packet
     static bool is_data, is_ack, is_token, is_dv;
     static bool ack_is_data, ack_is_token, ack_is_dv;
@@ -547,13 +921,13 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
     static bool dv_updated = false;
 
     while (true) {
-        // Wait until the buffer is written
-        PT_SEM_SAFE_WAIT(pt, &new_udp_recv_s);
-
-        printf("\n========== RECEIVE THREAD ==========\n");
+        // Wait until a packet is queued (and its emulated latency is over)
+        if (!recv_next(&recv_buf, &arrival_us)) {
+            PT_WAIT_EVENT_UNTIL(pt, EV_NET_RX, recv_wake_time(),
+                                recv_next(&recv_buf, &arrival_us));
+        }
 
-        // Convert the contents of the received packet to a packet_t
-        recv_buf = str_to_packet(recv_data);
+        LOG_DEBUG(LOG_MOD_MAIN, "========== RECEIVE THREAD ==========");
 
         // Determine the packet type
         is_data  = (strcmp(recv_buf.packet_type, "data") == 0);
@@ -561,55 +935,67 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
         is_token = (strcmp(recv_buf.packet_type, "token") == 0);
         is_dv    = (strcmp(recv_buf.packet_type, "dv") == 0);
 
-#ifndef PRINT_ON_RECV
-        // Print ack
+        // Log formatted packet contents
+        LOG_PACKET(LOG_LEVEL_DEBUG,
+                   (recv_buf.dest_id == self.ID && !is_ack) ? LOG_COLOR_GREEN
+                                                            : LOG_COLOR_CYAN,
+                   "Incoming", &recv_buf);
         if (is_ack) {
-            printf("Received ack for %3d", recv_buf.ack_num);
+            rtt_us = (uint32_t) (net_time_us() - recv_buf.timestamp);
+            LOG_INFO(LOG_MOD_UDP, "Received ack for %3u, RTT %u us",
+                     recv_buf.ack_num, rtt_us);
         }
-#else
-        // Print formatted packet contents
-        if (recv_buf.dest_id == self.ID && !is_ack) {
-            print_green;
-        } else {
-            print_cyan;
-        }
-        printf("| Incoming...\n");
-        print_packet(recv_data, recv_buf);
-        if (is_ack) {
-            rtt_ms = (time_us_64() - recv_buf.timestamp) / 1000.0f;
-            printf("|\tRTT:       %.2f ms\n", rtt_ms);
-        }
-        print_reset;
-#endif
 
-        // Forward the packet to the next hop router
-        if (is_data && recv_buf.dest_id != self.ID) {
-            send_queue         = recv_buf;
-            send_queue.src_id  = self.ID;
-            signal_send_thread = true;
-
-            // Request reconnection
-            target_ID             = self.routing_table[recv_buf.dest_id];
-            signal_connect_thread = true;
+        // Count load test packets that have reached me
+        if (is_data && recv_buf.dest_id == self.ID
+            && traffic_is_payload(recv_buf.msg)) {
+            traffic_receive(&traffic_sink, recv_buf.msg, time_us_64());
+            pt_post_event(EV_TRAFFIC);
         }
 
-        /************************************************
-         *  Type-specific behavior
-         ************************************************/
-
         // If data or token was received, respond with ACK
-        if (!is_ack) {
+        if (!is_ack && ack_head - ack_tail == ACK_QUEUE_LEN) {
+            LOG_ERROR(LOG_MOD_UDP, "Ack queue full, not acking %3u",
+                      recv_buf.ack_num);
+        } else if (!is_ack) {
             // Assign return address
-            strcpy(return_addr_str, recv_buf.ip_addr);
+            snprintf(ack_addrs[ack_head % ACK_QUEUE_LEN], IP_ADDR_LEN, "%s",
+                     recv_buf.ip_addr);
 
             // Write to the ack queue
-            ack_queue = new_packet("ack", recv_buf.src_id, self.ID,
-                                   self.ip_addr, recv_buf.ack_num,
-                                   recv_buf.timestamp, recv_buf.packet_type);
+            ack_queue[ack_head % ACK_QUEUE_LEN] =
+                new_packet("ack", recv_buf.src_id, self.ID, self.ip_addr,
+                           recv_buf.ack_num, recv_buf.timestamp,
+                           recv_buf.packet_type);
+            ack_head++;
+            acks_pending++;
+            TRACE(TR_ENQUEUE, TRQ_ACK, ack_head - ack_tail);
 
             // Signal ACK thread
             PT_SEM_SAFE_SIGNAL(pt, &new_udp_ack_s);
-            ack_queue_empty = false;
+        }
+
+        // Forwarded data, the token and acks queue a send or ask for a
+        // connection. The connect thread may be using both in the middle of a
+        // transition, so they wait for it to finish.
+        if ((is_data && recv_buf.dest_id != self.ID) || is_token || is_ack) {
+            PT_WAIT_EVENT_UNTIL(pt, EV_CONNECT_DONE, PT_NO_WAKE_TIME,
+                                !connect_in_progress);
+        }
+
+        /************************************************
+         *  Type-specific behavior
+         ************************************************/
+
+        // Forward the packet to the next hop router
+        if (is_data && recv_buf.dest_id != self.ID) {
+            send_queue        = recv_buf;
+            send_queue.src_id = self.ID;
+            signal_send();
+
+            // Request reconnection
+            target_ID = self.routing_table[recv_buf.dest_id];
+            signal_connect();
         }
 
         if (is_ack) {
@@ -618,24 +1004,42 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
             ack_is_dv    = (strcmp(recv_buf.msg, "dv") == 0);
 
             if (ack_is_data) {
-                printf("Data has been ack'ed\n");
+                LOG_INFO(LOG_MOD_MAIN, "Data has been ack'ed");
 
-                // Signal connect thread to re-enable AP mode
-                target_ID             = ENABLE_AP;
-                signal_connect_thread = true;
+                // The first hop's RTT, acks aren't end to end
+                traffic_ack(&traffic_gen, rtt_us, time_us_64());
+
+                if (assoc_has_share_left()) {
+                    // Stay associated for a while in case more traffic for
+                    // this neighbor follows
+                    assoc_lingering = true;
+                    assoc_linger_until =
+                        time_us_64() + 1000ULL * ASSOC_IDLE_TIMEOUT_MS;
+                } else {
+                    // Signal connect thread to re-enable AP mode
+                    target_ID = ENABLE_AP;
+                    signal_connect();
+                }
             } else if (ack_is_token) {
-                printf("Token has been ack'ed\n");
+                LOG_INFO(LOG_MOD_MAIN, "Token has been ack'ed");
 
                 led_off();
 
                 // Signal connect thread to re-enable AP mode
-                target_ID             = ENABLE_AP;
-                signal_connect_thread = true;
+                target_ID = ENABLE_AP;
+                signal_connect();
             } else if (ack_is_dv) {
-                printf("DV has been ack'ed\n");
+                LOG_INFO(LOG_MOD_MAIN, "DV has been ack'ed");
 
-                self.nbrs[recv_buf.src_id]->up_to_date   = true;
-                self.nbrs[recv_buf.src_id]->last_contact = time_us_64();
+                nbr_t* nb = get_nbr(&self, recv_buf.src_id);
+                if (nb == NULL) {
+                    LOG_ERROR(LOG_MOD_MAIN, "DV ack from non-neighbor %d",
+                              recv_buf.src_id);
+                } else {
+                    nb->up_to_date   = true;
+                    nb->last_contact = time_ms_32();
+                    nb->dv_changes   = 0;
+                }
 
                 // If you successfully sent a DV, try sending another one out
                 // immediately.
@@ -644,12 +1048,12 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
                 // simultaneously. The Picos cannot acheive this so this is the
                 // closest I can get.
                 target_ID    = DV_SCAN;
-                next_dv_scan = SCAN_ASAP;
+                dv_push_asap = true;
             }
         }
 
         if (is_token) {
-            printf("Received the token\n");
+            LOG_INFO(LOG_MOD_MAIN, "Received the token");
 
             led_on();
 
@@ -659,10 +1063,10 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
 
             if (self.ID == DEFAULT_ID) {
                 // Give myself an ID, increment the token
-                printf("Assigning myself an ID number:\n");
-                printf("\tMy ID:     %3d --> ", self.ID);
+                LOG_INFO(LOG_MOD_MAIN, "Assigning myself an ID number:");
+                LOG_INFO(LOG_MOD_MAIN, "\tMy ID:     %3d --> %3d", self.ID,
+                         token_id_number);
                 self.ID = token_id_number++;
-                printf("%3d\n", self.ID);
 
 #ifdef USE_LAYOUT
                 // Register my physical ID
@@ -670,20 +1074,20 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
 #endif
 
                 // Parent node is whoever gave you the token
-                printf("\tParent ID: %3d --> ", self.parent_ID);
+                LOG_INFO(LOG_MOD_MAIN, "\tParent ID: %3d --> %3d",
+                         self.parent_ID, recv_buf.src_id);
                 self.parent_ID = recv_buf.src_id;
-                printf("%3d\n", self.parent_ID);
             }
 
             // Place incremented token in the send queue
             snprintf(msg_buf, TOK_LEN, "%d", token_id_number);
             send_queue = new_packet("token", target_ID, self.ID, STATION_ADDR,
                                     self.counter, time_us_64(), msg_buf);
-            signal_send_thread = true;
+            signal_send();
 
             // Signal connect thread to scan for neighbors
-            target_ID             = NF_SCAN;
-            signal_connect_thread = true;
+            target_ID = NF_SCAN;
+            signal_connect();
 
         } else if (is_dv) {
             phase = DV_ROUTING;
@@ -693,20 +1097,44 @@ static PT_THREAD(protothread_udp_recv(struct pt* pt))
 
             dv_updated = update_dist_vector_by_nbr_id(&self, recv_buf.src_id);
 
-            // Delay sending your DV out in case more people try to send you DVs
-            printf("Delaying next scan: (old) %.1f sec ",
-                   (float) next_dv_scan / 1e6);
-            next_dv_scan = time_us_64() + (10 * 1e6);
-            printf("--> %.1f sec (new)\n", (float) next_dv_scan / 1e6);
-            printf("\tcurrent time = %.1f sec\n", (float) time_us_64() / 1e6);
+            // A DV that changes mine is an inconsistency, shrink the trickle
+            // interval so the change propagates quickly. Otherwise the sender
+            // already agrees with me, which counts towards suppression. The
+            // first DV starts the timer either way, so I push my own.
+            if (dv_updated) {
+                trickle_reset(&dv_trickle, time_us_64());
+                persist_later();
+            } else if (!dv_trickle.running) {
+                trickle_reset(&dv_trickle, time_us_64());
+            } else {
+                trickle_consistent(&dv_trickle);
+            }
+            LOG_INFO(LOG_MOD_DV, "Next trickle event: %u ms (interval %u ms)",
+                     (uint32_t) (trickle_next_event(&dv_trickle) / 1000),
+                     (uint32_t) (dv_trickle.i / 1000));
 
-            // Print DV and neighbor's DV
-            print_dist_vector(&self, recv_buf.src_id);
-            print_dist_vector(&self, self.ID);
+            // The log thread prints the neighbor's DV, my DV and my routing
+            // table once it has caught up
+            dv_tables_nbr = recv_buf.src_id;
+            pt_post_event(EV_LOG);
 
-            print_routing_table(&self);
         }
 
+#if TDMA_SCHEDULE
+        // Follow my parent's clock, which it stamped the packet with
+        if (!is_ack && recv_buf.src_id == self.parent_ID) {
+            if (!tdma.synced) {
+                LOG_INFO(LOG_MOD_MAIN,
+                         "Following node %d's clock for the slot schedule",
+                         self.parent_ID);
+            }
+            tdma_sync(&tdma, arrival_us, recv_buf.timestamp);
+        }
+#endif
+
+        // The packet may have changed what the other threads wait on
+        pt_post_event(EV_RECV);
+
         PT_YIELD(pt);
     }
 
@@ -720,20 +1148,18 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
 {
     PT_BEGIN(pt);
 
-    // Create a new UDP PCB
-    udp_ack_pcb              = udp_new();
-    udp_ack_pcb->remote_port = UDP_PORT;
-    udp_ack_pcb->local_port  = UDP_PORT;
-
     // Outgoing packet
     static packet_t ack_buf;
 
     // Payload
     static char buffer[UDP_MSG_LEN_MAX];
-    static int udp_ack_length;
 
-    // The address of the pbuf payload
-    static char* req;
+    // Destination, the recv thread may reuse the slot while the ack is on its
+    // way
+    static char addr[IP_ADDR_LEN];
+
+    // Call to the network core
+    static net_call_t net;
 
     // Error code
     static err_t er;
@@ -742,50 +1168,36 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
         // Wait until the buffer is written
         PT_SEM_SAFE_WAIT(pt, &new_udp_ack_s);
 
-        printf("\n========== ACK THREAD ==========\n");
+        LOG_DEBUG(LOG_MOD_MAIN, "========== ACK THREAD ==========");
 
         // Assign target pico IP address
-        ipaddr_aton(return_addr_str, &return_addr);
+        snprintf(addr, IP_ADDR_LEN, "%s", ack_addrs[ack_tail % ACK_QUEUE_LEN]);
 
         // Pop the head of the queue
-        ack_buf = ack_queue;
+        ack_buf = ack_queue[ack_tail % ACK_QUEUE_LEN];
+        ack_tail++;
+        TRACE(TR_DEQUEUE, TRQ_ACK, ack_head - ack_tail);
 
         // Convert to string
         packet_to_str(buffer, ack_buf);
 
-        // Allocate pbuf
-        udp_ack_length = strlen(buffer);
-        struct pbuf* p =
-            pbuf_alloc(PBUF_TRANSPORT, udp_ack_length + 1, PBUF_RAM);
-
-        // Clear the payload and write to it
-        req = (char*) p->payload; // Cast from void* to char*
-        memset(req, 0, udp_ack_length + 1);
-        memcpy(req, buffer, udp_ack_length);
-
-#ifdef PRINT_ON_SEND
-        // Print formatted packet contents
-        print_cyan;
-        printf("| Outgoing...\n");
-        print_packet(buffer, ack_buf);
-        print_reset;
-#endif
+        // Log formatted packet contents
+        LOG_PACKET(LOG_LEVEL_DEBUG, LOG_COLOR_CYAN, "Outgoing", &ack_buf);
 
         // Send packet
-        cyw43_arch_lwip_begin();
-        er = udp_sendto(udp_ack_pcb, p, &return_addr, UDP_PORT);
-        cyw43_arch_lwip_end();
+        net_call_init(&net, NET_UDP_ACK, 0, buffer);
+        net.addr = addr;
+        PT_NET_WAIT(pt, &net);
+        er = net.result;
 
-        // The thread protothread_connect waits on this flag
-        ack_queue_empty = true;
+        // The thread protothread_connect waits for the last ack to go out
+        acks_pending--;
+        pt_post_event(EV_ACK_DONE);
 
         if (er != ERR_OK) {
-            printf("Failed to send UDP ack! error=%d\n", er);
+            LOG_ERROR(LOG_MOD_UDP, "Failed to send UDP ack! error=%d", er);
         }
 
-        // Free the packet buffer
-        pbuf_free(p);
-
         PT_YIELD(pt);
     }
 
@@ -830,10 +1242,55 @@ static PT_THREAD(protothread_serial(struct pt* pt))
             // Load the token into the send queue
             send_queue = new_packet("token", target_ID, self.ID, self.ip_addr,
                                     self.counter, time_us_64(), "1");
-            signal_send_thread = true;
+            signal_send();
 
+#ifdef USE_LAYOUT
+        } else if (strncmp(pt_serial_in_buffer, "emu", 3) == 0) {
+            // Change the emulated topology
+            emu_command(pt_serial_in_buffer + 3);
+#endif
+        } else if (strcmp(pt_serial_in_buffer, "forget") == 0) {
+            // Boot from scratch (neighbor finding) after the next reset
+            persist_erase();
         } else if (strcmp(pt_serial_in_buffer, "dv") == 0) {
-            next_dv_scan = SCAN_ASAP;
+            trickle_reset(&dv_trickle, time_us_64());
+            dv_push_asap = true;
+            pt_post_event(EV_CONNECT);
+        } else if (strcmp(pt_serial_in_buffer, "scans") == 0) {
+            print_scan_cache();
+        } else if (strcmp(pt_serial_in_buffer, "timing") == 0) {
+            print_conn_timing();
+        } else if (strcmp(pt_serial_in_buffer, "timing reset") == 0) {
+            conn_timing_reset();
+        } else if (strncmp(pt_serial_in_buffer, "tg", 2) == 0
+                   && (pt_serial_in_buffer[2] == ' '
+                       || pt_serial_in_buffer[2] == '\0')) {
+            if (traffic_command(pt_serial_in_buffer + 2, &traffic_gen,
+                                &traffic_sink, time_us_64())) {
+                dest_ID = traffic_gen.cfg.dest;
+
+                if (dest_ID < 0 || dest_ID >= MAX_NODES || dest_ID == self.ID
+                    || self.routing_table[dest_ID] == NO_ROUTE) {
+                    print_red;
+                    printf("ERROR: ");
+                    print_reset;
+                    printf("No route to node %d\n", dest_ID);
+                    traffic_stop(&traffic_gen, time_us_64());
+                }
+            }
+            pt_post_event(EV_TRAFFIC);
+#if TRACE_EVENTS
+        } else if (strcmp(pt_serial_in_buffer, "trace") == 0) {
+            trace_dump();
+        } else if (strcmp(pt_serial_in_buffer, "trace clear") == 0) {
+            trace_clear();
+#endif
+#if SCHED_STATS
+        } else if (strcmp(pt_serial_in_buffer, "sched") == 0) {
+            pt_print_stats();
+        } else if (strcmp(pt_serial_in_buffer, "sched reset") == 0) {
+            pt_reset_stats();
+#endif
         } else {
             snprintf(tbuf, UDP_MSG_LEN_MAX, "%s", pt_serial_in_buffer);
 
@@ -850,11 +1307,131 @@ static PT_THREAD(protothread_serial(struct pt* pt))
 
             send_queue = new_packet("data", dest_ID, self.ID, self.ip_addr,
                                     self.counter, time_us_64(), msg_buffer);
-            signal_send_thread = true;
+            signal_send();
 
             // Signal for a reconnection
-            target_ID             = self.routing_table[dest_ID];
-            signal_connect_thread = true;
+            target_ID = self.routing_table[dest_ID];
+            signal_connect();
+        }
+    }
+
+    PT_END(pt);
+}
+
+// =================================================
+// Traffic generator thread
+// =================================================
+
+// Returns true if the send queue and the connect thread are free for the next
+// load test packet
+bool traffic_path_free()
+{
+    return !signal_send_thread && !signal_connect_thread
+           && !connect_in_progress;
+}
+
+static PT_THREAD(protothread_traffic(struct pt* pt))
+{
+    PT_BEGIN(pt);
+
+    // Payload of the next packet
+    static char payload[TRAFFIC_MAX_SIZE + 1];
+
+    while (true) {
+        // Paced runs wake on the clock, saturating ones whenever the send
+        // thread or the connect thread finishes
+        PT_WAIT_EVENT_UNTIL(
+            pt, EV_TRAFFIC | EV_SENT | EV_CONNECT_DONE,
+            traffic_wake_time(&traffic_gen, &traffic_sink, time_us_64()),
+            traffic_report_due(&traffic_gen, &traffic_sink, time_us_64())
+                || (traffic_due(&traffic_gen, time_us_64())
+                    && traffic_path_free()));
+
+        traffic_report(&traffic_gen, &traffic_sink, time_us_64());
+
+        if (traffic_due(&traffic_gen, time_us_64()) && traffic_path_free()) {
+            traffic_next(&traffic_gen, payload, time_us_64());
+
+            // Same path as a typed message
+            send_queue = new_packet("data", traffic_gen.cfg.dest, self.ID,
+                                    self.ip_addr, self.counter, time_us_64(),
+                                    payload);
+            signal_send();
+
+            target_ID = self.routing_table[traffic_gen.cfg.dest];
+            signal_connect();
+        }
+    }
+
+    PT_END(pt);
+}
+
+// =================================================
+// Log thread
+// =================================================
+static PT_THREAD(protothread_log(struct pt* pt))
+{
+    PT_BEGIN(pt);
+
+    while (true) {
+        // Every record is formatted and printed here, a few per turn so the
+        // other threads aren't held up for long. Records post EV_LOG, and
+        // what's left over from the last batch is due on the next turn.
+        PT_WAIT_EVENT_UNTIL(pt, EV_LOG,
+                            log_pending() ? time_us_64() : PT_NO_WAKE_TIME,
+                            log_pending() || dv_tables_nbr >= 0);
+
+        log_drain(LOG_DRAIN_BATCH);
+
+        // The tables are printed from the live state once the records that
+        // came before them are out
+        if (!log_pending() && dv_tables_nbr >= 0) {
+            print_dist_vector(&self, dv_tables_nbr);
+            print_dist_vector(&self, self.ID);
+            print_routing_table(&self);
+
+            dv_tables_nbr = -1;
+        }
+    }
+
+    PT_END(pt);
+}
+
+// =================================================
+// Upkeep thread
+// =================================================
+static uint64_t upkeep_wake_time(void)
+{
+    return routes_confirm_time < persist_time ? routes_confirm_time
+                                              : persist_time;
+}
+
+static PT_THREAD(protothread_upkeep(struct pt* pt))
+{
+    PT_BEGIN(pt);
+
+    while (true) {
+        PT_WAIT_EVENT_UNTIL(pt, EV_PERSIST, upkeep_wake_time(),
+                            time_us_64() >= upkeep_wake_time());
+
+        // Routes resumed from flash that no DV has confirmed in time go
+        if (time_us_64() >= routes_confirm_time) {
+            routes_confirm_time = UINT64_MAX;
+
+            if (routes_provisional(&self) && drop_provisional_routes(&self)) {
+                printf("Dropped resumed routes that weren't confirmed\n");
+
+                // Spread the change like one learned from a DV
+                trickle_reset(&dv_trickle, time_us_64());
+                persist_later();
+                pt_post_event(EV_ROUTES);
+            }
+        }
+
+        // My DV has settled, save it
+        if (time_us_64() >= persist_time) {
+            persist_time = UINT64_MAX;
+            persist_save(&self);
         }
     }
 
@@ -868,12 +1445,26 @@ static PT_THREAD(protothread_serial(struct pt* pt))
 void core_1_main()
 {
     printf("Core 1 launched!\n");
+
+#if NETWORK_ON_CORE1
+    // Own the radio and lwIP from here on (see net_core.h)
+    net_core_run();
+#endif
 }
 
 /********************************
  *  CORE 0 MAIN
  ********************************/
 
+// Label the next thread added to core 0 in the trace and the scheduler stats
+static void name_thread(const char* name)
+{
+    TRACE_NAME_THREAD(pt_task_count, name);
+#if SCHED_STATS
+    pt_stats_name(pt_task_count, name);
+#endif
+}
+
 int main()
 {
 // If this pico is the master node, set is_master to true. The macro is defined
@@ -888,6 +1479,13 @@ int main()
     // Initialize all stdio types
     stdio_init_all();
 
+    // Logging is used by interrupts and both cores
+    log_init(pt_post_event);
+
+    // So are the scan cache and the addresses set by the connection steps
+    scan_cache_init();
+    connect_init();
+
 #ifdef SERIAL_OVER_USB
     // Press ENTER to start if using serial over USB. This gives you time to
     // restart the PuTTY terminal before initialization starts.
@@ -908,6 +1506,9 @@ int main()
     // Initialize the connectivity array
     init_layout();
 
+    // Load the emulated topology, replaces board_IDs if it was saved in flash
+    init_emulation();
+
     if (is_master) {
         // Print out the network adjacency list
         print_adj_list(DEFAULT_ID, true);
@@ -918,10 +1519,71 @@ int main()
 
     // Initialize this node
     self = new_node(is_master);
+    print_struct_sizes();
+
+    // The master's clock is the network time for the slot schedule
+    tdma_init(&tdma, is_master);
+
+#ifdef USE_LAYOUT
+    // Register my own physical ID (the master already has its ID)
+    if (is_master) {
+        ID_to_phys_ID[MASTER_ID] = self.physical_ID;
+    }
+#endif
+
+    // Initialize the (stopped) DV trickle timer
+    trickle_init(&dv_trickle, DV_TRICKLE_IMIN, DV_TRICKLE_DOUBLINGS,
+                 DV_TRICKLE_K);
+
+    // Resume from the state saved in flash, if there is any. Neighbor finding
+    // is skipped and the stored neighbors start out un-updated, so they are
+    // re-validated by the first round of DV exchanges, and so are the routes
+    // (see protothread_upkeep).
+    static persist_record_t saved;
+    bool resumed = (persist_load(&saved) == 0);
+
+    if (resumed) {
+        persist_apply(&self, &saved);
+#ifdef USE_LAYOUT
+        ID_to_phys_ID[self.ID] = self.physical_ID;
+#endif
+        generate_picow_ssid(self.wifi_ssid, self.ID);
+
+        init_dist_vector_routing(&self);
+        persist_apply_costs(&self, &saved);
+
+        // The saved routes may have gone stale while I was down, they only
+        // last until ROUTE_CONFIRM_US unless their next hop confirms them
+        mark_routes_provisional(&self);
+        count_routes(&self);
+        if (routes_provisional(&self)) {
+            routes_confirm_time = time_us_64() + ROUTE_CONFIRM_US;
+        }
+
+        printf("Resumed from flash (seq %u):\n", (unsigned int) saved.seq);
+        printf("\tMy ID:        %d\n", self.ID);
+        printf("\tParent ID:    %d\n", self.parent_ID);
+        printf("\tNeighbors:    %d\n", num_nbrs(&self));
+
+        phase = DV_ROUTING;
+        trickle_reset(&dv_trickle, time_us_64());
+    }
+
+    // Calls to the network core wake the protothreads when they're done
+    static net_call_t net;
+    net_core_init(pt_post_event);
+
+#if NETWORK_ON_CORE1
+    // Core 1 brings up the chip, so the cyw43 interrupt and the lwIP callbacks
+    // run there
+    multicore_reset_core1();
+    multicore_launch_core1(&core_1_main);
+#endif
 
     // Initialize Wifi chip
     printf("Initializing cyw43...");
-    if (cyw43_arch_init()) {
+    net_call_init(&net, NET_INIT, 0, NULL);
+    if (net_call_blocking(&net)) {
         print_red;
         printf("failed.\n");
         print_reset;
@@ -931,27 +1593,38 @@ int main()
         printf("initialized!\n");
     }
 
-    if (is_master) {
+    if (resumed) {
+        // Already know my ID and neighbors, host my picow_<ID> network
+        net_call_init(&net, NET_BOOT_AP, 0, NULL);
+        net_call_blocking(&net);
+
+    } else if (is_master) {
         // If all Pico-Ws boot at the same time, this delay gives the other
         // nodes time to setup before the master tries to scan.
         printf("Waiting for nearby APs to boot:\n\t");
         sleep_ms_progress_bar(2 * AP_BOOT_TIME, 30);
 
-        boot_station();
+        net_call_init(&net, NET_BOOT_STATION, 0, NULL);
+        net_call_blocking(&net);
 
         // Perform a wifi scan, copy the result to target_ssid
         scan_wifi(NBR_FIND_SCAN);
         snprintf(target_ssid, SSID_LEN, "%s", nbr_find_scan_result);
 
-        connect_to_network(target_ssid);
+        net_call_init(&net, NET_CONNECT, 0, target_ssid);
+        net_call_blocking(&net);
+        scan_cache_forget(target_ssid);
 
     } else {
-        boot_ap();
+        net_call_init(&net, NET_BOOT_AP, 0, NULL);
+        net_call_blocking(&net);
     }
 
-    // Initialize UDP recv callback function
+    // Create the UDP PCB. It's bound to every interface, so it stays valid
+    // through the connect thread's AP/station switches.
     printf("Initializing recv callback...");
-    if (udp_recv_callback_init()) {
+    net_call_init(&net, NET_UDP_INIT, 0, NULL);
+    if (net_call_blocking(&net)) {
         print_red;
         printf("failed.\n");
         print_reset;
@@ -962,26 +1635,50 @@ int main()
     // Some threads use semaphores to signal each other when buffers are
     // written. If a thread tries to aquire a semaphore that is unavailable,
     // it yields to the next thread in the scheduler.
-    PT_SEM_SAFE_INIT(&new_udp_recv_s, 0);
     PT_SEM_SAFE_INIT(&new_udp_ack_s, 0);
 
+#if !NETWORK_ON_CORE1
     // Launch multicore
     multicore_reset_core1();
     multicore_launch_core1(&core_1_main);
+#endif
 
     // Start protothreads
     printf("Starting Protothreads on Core 0!\n\n");
     print_reset;
 
-    pt_add_thread(protothread_udp_send);
-    pt_add_thread(protothread_udp_recv);
-    pt_add_thread(protothread_udp_ack);
-    pt_add_thread(protothread_serial);
-    pt_add_thread(protothread_connect);
+#if PRIORITY_SCHED
+    // Received packets and acks don't wait behind the other threads
+    pt_sched_method = SCHED_PRIORITY;
+#endif
+
+    // Threads are numbered in the order they're added. Round robin ignores
+    // the priorities and deadlines.
+    name_thread("send");
+    pt_add_thread_prio(protothread_udp_send, PT_PRIO_NORMAL,
+                       PT_DEFAULT_DEADLINE_US);
+    name_thread("recv");
+    pt_add_thread_prio(protothread_udp_recv, PT_PRIO_HIGH, RECV_DEADLINE_US);
+    name_thread("ack");
+    pt_add_thread_prio(protothread_udp_ack, PT_PRIO_HIGH, ACK_DEADLINE_US);
+    name_thread("serial");
+    pt_add_thread_prio(protothread_serial, PT_PRIO_LOW, PT_DEFAULT_DEADLINE_US);
+    name_thread("connect");
+    pt_add_thread_prio(protothread_connect, PT_PRIO_NORMAL,
+                       PT_DEFAULT_DEADLINE_US);
+    name_thread("log");
+    pt_add_thread_prio(protothread_log, PT_PRIO_LOW, PT_DEFAULT_DEADLINE_US);
+    name_thread("traffic");
+    pt_add_thread_prio(protothread_traffic, PT_PRIO_NORMAL,
+                       PT_DEFAULT_DEADLINE_US);
+    name_thread("upkeep");
+    pt_add_thread_prio(protothread_upkeep, PT_PRIO_LOW, PT_DEFAULT_DEADLINE_US);
     pt_schedule_start;
 
+#if !NETWORK_ON_CORE1
     // De-initialize the cyw43 architecture.
     cyw43_arch_deinit();
+#endif
 
     return 0;
 }
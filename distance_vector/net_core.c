@@ -0,0 +1,414 @@
+// C libraries
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Pico
+#include "hardware/sync.h"
+#include "pico/cyw43_arch.h"
+#include "pico/multicore.h"
+#include "pico/time.h"
+
+// LwIP
+#include "lwip/udp.h"
+
+// Local
+#include "connect.h"
+#include "log.h"
+#include "net_core.h"
+#include "node.h"
+#include "packet.h"
+#include "trace.h"
+#include "wifi_scan.h"
+
+uint32_t net_rx_drops = 0;
+
+// Posts scheduler events, see net_core_init()
+static void (*net_post_event)(uint32_t events) = NULL;
+
+// Names for dumps, in net_op_t order
+static const char* net_op_names[NUM_NET_OPS] = {
+    "init",
+    "boot_ap",
+    "ensure_ap",
+    "shutdown_ap",
+    "boot_station",
+    "shutdown_station",
+    "re_init_cyw43",
+    "connect",
+    "scan_start",
+    "udp_init",
+    "udp_send",
+    "udp_ack"};
+
+// The one UDP PCB, only touched by the network core. Sends, acks and the recv
+// callback all share it.
+static struct udp_pcb* udp_pcb = NULL;
+
+/************************************************
+ *  QUEUES
+ ************************************************/
+
+// Both queues have a single producer and a single consumer. The producer only
+// writes [head] and the consumer only writes [tail], so neither side takes a
+// lock: a barrier between filling (or emptying) a slot and moving the index is
+// enough for the other core to see the slot before the index. The indices run
+// freely and wrap around the slots.
+
+// Calls from the core 0 threads to the network core. The threads are
+// cooperative, so they never push at the same time.
+static struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    net_call_t* slots[NET_CALL_QUEUE_LEN];
+} call_queue;
+
+// Packets from the recv callback to the recv thread
+static struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    char slots[NET_RX_QUEUE_LEN][UDP_MSG_LEN_MAX];
+} rx_queue;
+
+static void net_notify(uint32_t events)
+{
+    if (net_post_event != NULL) {
+        net_post_event(events);
+    } else {
+        __sev();
+    }
+}
+
+#if NETWORK_ON_CORE1
+static bool call_queue_push(net_call_t* call)
+{
+    uint32_t head = call_queue.head;
+
+    if (head - call_queue.tail == NET_CALL_QUEUE_LEN) {
+        return false;
+    }
+
+    call_queue.slots[head % NET_CALL_QUEUE_LEN] = call;
+    __dmb();
+    call_queue.head = head + 1;
+
+    TRACE(TR_ENQUEUE, TRQ_NET_CALL, head + 1 - call_queue.tail);
+
+    // Wake the network core
+    __sev();
+
+    return true;
+}
+
+static net_call_t* call_queue_pop()
+{
+    uint32_t tail = call_queue.tail;
+
+    if (tail == call_queue.head) {
+        return NULL;
+    }
+
+    __dmb();
+    net_call_t* call = call_queue.slots[tail % NET_CALL_QUEUE_LEN];
+    __dmb();
+    call_queue.tail = tail + 1;
+
+    TRACE(TR_DEQUEUE, TRQ_NET_CALL, call_queue.head - (tail + 1));
+
+    return call;
+}
+#endif
+
+bool net_rx_pop(char* buf)
+{
+    uint32_t tail = rx_queue.tail;
+
+    if (tail == rx_queue.head) {
+        return false;
+    }
+
+    __dmb();
+    memcpy(buf, rx_queue.slots[tail % NET_RX_QUEUE_LEN], UDP_MSG_LEN_MAX);
+    __dmb();
+    rx_queue.tail = tail + 1;
+
+    TRACE(TR_DEQUEUE, TRQ_RX, rx_queue.head - (tail + 1));
+
+    return true;
+}
+
+/************************************************
+ *  UDP
+ ************************************************/
+
+// UDP recv callback function, runs on the core that initialized the cyw43
+static void udp_recv_callback(void* arg, struct udp_pcb* upcb, struct pbuf* p,
+                              const ip_addr_t* addr, u16_t port)
+{
+    // Prevent "unused argument" compiler warning
+    LWIP_UNUSED_ARG(arg);
+
+    LOG_DEBUG(LOG_MOD_UDP, "You've got mail! (received a packet)");
+
+    if (p == NULL) {
+        LOG_ERROR(LOG_MOD_UDP, "NULL pbuf in callback");
+        return;
+    }
+
+    uint32_t head = rx_queue.head;
+
+    if (head - rx_queue.tail == NET_RX_QUEUE_LEN) {
+        net_rx_drops++;
+        TRACE(TR_PKT_DROP, p->tot_len, head - rx_queue.tail);
+        LOG_ERROR(LOG_MOD_UDP, "Receive queue full, dropped the packet");
+    } else {
+        // Copy the payload into the next free slot
+        char* slot = rx_queue.slots[head % NET_RX_QUEUE_LEN];
+        u16_t len  = pbuf_copy_partial(p, slot, UDP_MSG_LEN_MAX - 1, 0);
+        slot[len]  = '\0';
+
+        __dmb();
+        rx_queue.head = head + 1;
+
+        TRACE(TR_PKT_RX, len, head + 1 - rx_queue.tail);
+
+        // Signal the recv thread
+        net_notify(EV_NET_RX);
+    }
+
+    // Free the packet buffer
+    pbuf_free(p);
+}
+
+// Create the PCB, once. It's bound to IP_ANY_TYPE rather than to an address,
+// so it receives on whichever interface is up and outlives the AP/station
+// switches (and re_init_cyw43(), lwIP is only initialized once). Later calls
+// do nothing.
+static int net_udp_init()
+{
+    if (udp_pcb != NULL) {
+        return 0;
+    }
+
+    int ret = 0;
+
+    cyw43_arch_lwip_begin();
+
+    // Create a new UDP PCB
+    udp_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+
+    if (udp_pcb != NULL) {
+        // Receive on every interface, whatever its address
+        err_t err = udp_bind(udp_pcb, IP_ANY_TYPE, UDP_PORT);
+
+        if (err == ERR_OK) {
+            // This function assigns the callback function for when a UDP
+            // packet is received
+            udp_recv(udp_pcb, udp_recv_callback, NULL);
+        } else {
+            printf("UDP bind error\n");
+            udp_remove(udp_pcb);
+            udp_pcb = NULL;
+            ret     = 1;
+        }
+    } else {
+        printf("ERROR: udpecho_raw_pcb was NULL\n");
+        ret = 1;
+    }
+
+    cyw43_arch_lwip_end();
+
+    return ret;
+}
+
+// Send [payload] to [addr_str] from [pcb], returns the lwIP error code
+static int net_udp_send(struct udp_pcb* pcb, const char* addr_str,
+                        const char* payload)
+{
+    // NET_UDP_INIT failed
+    if (pcb == NULL) {
+        return ERR_CONN;
+    }
+
+    // Assign target pico IP address, string -> ip_addr_t
+    ip_addr_t addr;
+    ipaddr_aton(addr_str, &addr);
+
+    // Allocate pbuf
+    int len        = strlen(payload);
+    struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, len + 1, PBUF_RAM);
+
+    if (p == NULL) {
+        return ERR_MEM;
+    }
+
+    // Clear the payload and write to it
+    char* req = (char*) p->payload;
+    memset(req, 0, len + 1);
+    memcpy(req, payload, len);
+
+    // Send packet
+    cyw43_arch_lwip_begin();
+    err_t er = udp_sendto(pcb, p, &addr, UDP_PORT);
+    cyw43_arch_lwip_end();
+
+    TRACE(TR_PKT_TX, len, er);
+
+    // Free the packet buffer
+    pbuf_free(p);
+
+    return er;
+}
+
+/************************************************
+ *  CALLS
+ ************************************************/
+
+static int net_execute(net_call_t* call)
+{
+    switch (call->op) {
+    case NET_INIT:
+        return cyw43_arch_init();
+    case NET_BOOT_AP:
+        return boot_ap();
+    case NET_ENSURE_AP:
+        return ensure_ap();
+    case NET_SHUTDOWN_AP:
+        shutdown_ap();
+        return 0;
+    case NET_BOOT_STATION:
+        boot_station();
+        return 0;
+    case NET_SHUTDOWN_STATION:
+        shutdown_station();
+        return 0;
+    case NET_RE_INIT_CYW43:
+        return re_init_cyw43();
+    case NET_CONNECT:
+        return connect_to_network((char*) call->str);
+    case NET_SCAN_START:
+        return scan_wifi_start_filtered((scan_type_t) call->arg, call->filter);
+    case NET_UDP_INIT:
+        return net_udp_init();
+    case NET_UDP_SEND:
+    case NET_UDP_ACK:
+        return net_udp_send(udp_pcb, call->addr, call->str);
+    case NUM_NET_OPS:
+        break;
+    }
+
+    return -1;
+}
+
+// Execute [call] and hand its result back to whoever is waiting on it
+static void net_complete(net_call_t* call)
+{
+    TRACE(TR_NET_CALL_BEGIN, call->op, 0);
+    call->result = net_execute(call);
+    TRACE(TR_NET_CALL_END, call->op, call->result);
+
+    __dmb();
+    call->done = true;
+
+    net_notify(EV_NET_DONE);
+}
+
+const char* net_op_name(net_op_t op)
+{
+    return op < NUM_NET_OPS ? net_op_names[op] : "unknown";
+}
+
+void net_core_init(void (*post_event)(uint32_t events))
+{
+    net_post_event = post_event;
+}
+
+void net_call_init(net_call_t* call, net_op_t op, int arg, const char* str)
+{
+    call->op        = op;
+    call->arg       = arg;
+    call->str       = str;
+    call->addr      = NULL;
+    call->filter    = NULL;
+    call->submitted = false;
+    call->result    = 0;
+    call->done      = false;
+}
+
+bool net_call_poll(net_call_t* call)
+{
+    if (!call->submitted) {
+#if NETWORK_ON_CORE1
+        if (!call_queue_push(call)) {
+            return false;
+        }
+        call->submitted = true;
+#else
+        call->submitted = true;
+        net_complete(call);
+#endif
+    }
+
+    if (!call->done) {
+        return false;
+    }
+
+    // Don't read the result before the flag
+    __dmb();
+
+    // Pick up the addresses the call may have set
+    connect_take_addrs(self.ip_addr, dest_addr_str);
+
+    return true;
+}
+
+int net_call_blocking(net_call_t* call)
+{
+    while (!net_call_poll(call)) {
+        // The network core signals when it's done
+        __wfe();
+    }
+
+    return call->result;
+}
+
+void net_core_run()
+{
+#if NETWORK_ON_CORE1
+    // Let core 0 park this core while it writes to flash
+    multicore_lockout_victim_init();
+
+    while (true) {
+        net_call_t* call = call_queue_pop();
+
+        if (call != NULL) {
+            net_complete(call);
+        } else if (scan_status.active) {
+            // Keep an eye on the scan, the driver doesn't say when it's done
+            best_effort_wfe_or_timeout(make_timeout_time_us(SCAN_POLL_US));
+
+            if (scan_wifi_radio_poll()) {
+                net_notify(EV_NET_SCAN);
+            }
+        } else {
+            // Sleep until a call is queued, interrupts still run
+            __wfe();
+        }
+    }
+#endif
+}
+
+void net_core_pause()
+{
+#if NETWORK_ON_CORE1
+    multicore_lockout_start_blocking();
+#endif
+}
+
+void net_core_resume()
+{
+#if NETWORK_ON_CORE1
+    multicore_lockout_end_blocking();
+#endif
+}
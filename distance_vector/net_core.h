@@ -0,0 +1,127 @@
+#ifndef NET_CORE_H
+#define NET_CORE_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local
+#include "network_opts.h"
+
+// Split of the work between the cores (with NETWORK_ON_CORE1). Core 1 brings
+// the cyw43 up, so the driver's interrupt and every lwIP callback run there,
+// and it executes every call that touches the radio or lwIP: the connection
+// steps (connect.h), starting scans and sending packets. Core 0 keeps routing,
+// the application threads and the console. It hands calls to core 1 through a
+// lock-free queue and yields until they're done, and received packets come
+// back through another one.
+//
+// Without NETWORK_ON_CORE1 the calls are executed on the spot, so the threads
+// go through the same code either way.
+//
+// The connect thread's state machine (when to scan, who to connect to, the
+// TDMA slots) stays on core 0 on purpose: it's driven by the routing state,
+// and moving it would put the node and its neighbors in the hands of both
+// cores. Only the steps are shipped to core 1, one call at a time. Whatever a
+// step learns is handed back rather than written into core 0's state: scan
+// results through the scan cache (which has its own lock) and the scan-done
+// flag (wifi_scan.h), and addresses through connect_take_addrs().
+
+// Same port number on both devices
+#define UDP_PORT 4444
+
+// Scheduler events posted to the protothreads (application bits, clear of the
+// ones main.c uses)
+#define EV_NET_DONE (1u << 8)  // A network call finished
+#define EV_NET_RX   (1u << 9)  // A packet is waiting for net_rx_pop()
+#define EV_NET_SCAN (1u << 11) // The radio finished a scan
+
+// Outstanding calls and received packets that can be queued
+#define NET_CALL_QUEUE_LEN 8
+#define NET_RX_QUEUE_LEN   4
+
+// Calls executed by the network core
+typedef enum net_op {
+    NET_INIT,             // cyw43_arch_init()
+    NET_BOOT_AP,          // boot_ap()
+    NET_ENSURE_AP,        // ensure_ap()
+    NET_SHUTDOWN_AP,      // shutdown_ap()
+    NET_BOOT_STATION,     // boot_station()
+    NET_SHUTDOWN_STATION, // shutdown_station()
+    NET_RE_INIT_CYW43,    // re_init_cyw43()
+    NET_CONNECT,          // connect_to_network([str])
+    NET_SCAN_START,       // scan_wifi_start_filtered([arg], [filter])
+    NET_UDP_INIT,         // Create the UDP PCB, once at boot
+    NET_UDP_SEND,         // Send [str] to [addr]
+    NET_UDP_ACK,          // Send the ack [str] to [addr]
+    NUM_NET_OPS
+} net_op_t;
+
+struct scan_filter;
+
+// One call. It's owned by the caller, who must leave it (and the strings it
+// points to) alone until net_call_poll() returns true.
+typedef struct net_call {
+    net_op_t op;                      // What to do
+    int arg;                          // Integer argument
+    const char* str;                  // SSID or packet
+    const char* addr;                 // Destination IPv4 address
+    const struct scan_filter* filter; // Scan filter
+    bool submitted;                   // Has it been queued?
+    int result;                       // Return value of the call
+    volatile bool done;               // Has [result] been written?
+} net_call_t;
+
+// Packets dropped because the receive queue was full
+extern uint32_t net_rx_drops;
+
+// Name of [op]
+const char* net_op_name(net_op_t op);
+
+// Set the function that posts scheduler events (pt_post_event). It's passed in
+// because the protothreads header can only be included by main.c.
+void net_core_init(void (*post_event)(uint32_t events));
+
+// Fill in [call] for [op]
+void net_call_init(net_call_t* call, net_op_t op, int arg, const char* str);
+
+// Hand [call] to the network core if it hasn't been yet (and the queue has
+// room), returns true once it's done and its result is in place. Without
+// NETWORK_ON_CORE1 the call is executed by the first poll.
+bool net_call_poll(net_call_t* call);
+
+// Submit [call] and block until it's done, for use outside of protothreads.
+// Returns the result.
+int net_call_blocking(net_call_t* call);
+
+// Copy the oldest received packet into [buf] (UDP_MSG_LEN_MAX bytes), returns
+// false if there is none
+bool net_rx_pop(char* buf);
+
+// Body of core 1, executes calls forever
+void net_core_run();
+
+// Park core 1 in RAM (with NETWORK_ON_CORE1) so core 0 can erase or program
+// flash, which core 1's code and interrupt handlers run from. Call from core 0
+// and keep it short, calls and received packets wait meanwhile.
+void net_core_pause();
+void net_core_resume();
+
+// Wait for a prepared [call] from inside a protothread, yielding to the other
+// threads until it's done. Doesn't yield if it's done right away.
+#define PT_NET_WAIT(pt, call)                                                  \
+    do {                                                                       \
+        if (!net_call_poll(call)) {                                            \
+            PT_WAIT_EVENT_UNTIL(pt, EV_NET_DONE, PT_NO_WAKE_TIME,              \
+                                net_call_poll(call));                          \
+        }                                                                      \
+    } while (0)
+
+// Execute [op] from inside a protothread, the result is in [call]->result
+#define PT_NET_CALL(pt, call, op, arg, str)                                    \
+    do {                                                                       \
+        net_call_init(call, op, arg, str);                                     \
+        PT_NET_WAIT(pt, call);                                                 \
+    } while (0)
+
+#endif
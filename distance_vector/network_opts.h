@@ -16,4 +16,84 @@
 #define NO_ROUTE         -1
 #define DEFAULT_COST     1
 
+// Trickle timer for DV exchanges. Imin is in microseconds, Imax is Imin doubled
+// DV_TRICKLE_DOUBLINGS times (10 s --> 160 s), and K is the number of
+// consistent DVs that suppress my own push during an interval.
+#define DV_TRICKLE_IMIN      (10 * 1000000ULL)
+#define DV_TRICKLE_DOUBLINGS 4
+#define DV_TRICKLE_K         2
+
+// A failed connection is retried this long after it failed, whatever the
+// trickle interval
+#define DV_RETRY_US (15 * 1000000ULL)
+
+// Routes resumed from flash are provisional until their next hop's DV confirms
+// them, the ones still unconfirmed after ROUTE_CONFIRM_US are dropped
+#define ROUTE_CONFIRM_US (60 * 1000000ULL)
+
+// My state is saved to flash once my DV has been quiet for PERSIST_QUIET_US,
+// so a burst of DV updates costs one flash erase instead of one each
+#define PERSIST_QUIET_US (5 * 1000000ULL)
+
+// Scan results are reused for SCAN_CACHE_TTL_MS after a scan before the radio
+// scans again (see scan_cache.h)
+#define SCAN_CACHE_TTL_MS 5000
+
+// Keep my access point up while joining neighbors as a station, instead of
+// switching between the two for every hop. Each AP then needs a subnet of its
+// own, node <ID> hosts 192.168.<AP_SUBNET_BASE + ID>.1.
+#define CONCURRENT_AP_STA false
+#define AP_SUBNET_BASE    10
+
+// Stay associated with a neighbor for ASSOC_IDLE_TIMEOUT_MS after an ack from
+// it, in case more traffic for it follows. An association carries at most
+// ASSOC_MAX_PACKETS packets and lasts at most ASSOC_MAX_MS, after that I go
+// back to hosting so other neighbors get their turn.
+#define ASSOC_IDLE_TIMEOUT_MS 500
+#define ASSOC_MAX_PACKETS     8
+#define ASSOC_MAX_MS          5000
+
+// Configure the station's address from node IDs instead of waiting for a DHCP
+// lease on every association. Node <ID> takes host STATIC_HOST_BASE + ID on
+// its neighbors' subnets, above the DHCP server's pool, which still serves
+// nodes without an ID and foreign clients.
+#define STATIC_ADDRESSING false
+#define STATIC_HOST_BASE  100
+
+// Reach neighbors on a slot schedule instead of scanning for them (see
+// tdma.h). Joins start in a TDMA_WINDOW_MS window that opens TDMA_GUARD_MS into
+// the target's slot, the guard absorbs clock error. A slot must fit a join, a
+// packet and the return to AP mode.
+#define TDMA_SCHEDULE  false
+#define TDMA_SLOT_MS   4000
+#define TDMA_GUARD_MS  200
+#define TDMA_WINDOW_MS 1000
+
+// Run the radio, lwIP and the connection steps on core 1 (see net_core.h).
+// Core 0 keeps routing, the application threads and the console, and hands
+// network calls to core 1 through lock-free queues.
+#define NETWORK_ON_CORE1 false
+
+// Deferred logging (see log.h). Records above LOG_LEVEL, or from modules that
+// aren't in LOG_MODULES, are compiled out. LOG_LEVEL_DEBUG includes the packet
+// dumps.
+#define LOG_LEVEL   LOG_LEVEL_DEBUG
+#define LOG_MODULES LOG_MOD_ALL
+
+// Event trace (see trace.h): per-core rings of scheduler, packet, queue, scan
+// and connection events, dumped with the "trace" console command
+#define TRACE_EVENTS false
+
+// Run the protothreads by priority instead of in list order (SCHED_PRIORITY in
+// the pt header). The recv and ack threads go first, with deadlines of
+// RECV_DEADLINE_US and ACK_DEADLINE_US once woken, the console and the log
+// flush go last.
+#define PRIORITY_SCHED   false
+#define RECV_DEADLINE_US 2000
+#define ACK_DEADLINE_US  1000
+
+// Scheduler statistics: runs, run time and event-to-run latency per thread,
+// printed by the "sched" console command
+#define SCHED_STATS false
+
 #endif
\ No newline at end of file
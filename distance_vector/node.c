@@ -14,6 +14,15 @@
 
 node_t self;
 
+// Fail the build if the node layout regresses. A neighbor is a timestamp, six
+// single byte fields, two flags and one byte per DV entry.
+_Static_assert(MAX_NODES <= INT8_MAX, "node IDs must fit in a node_id_t");
+_Static_assert(POISON_DIST <= UINT8_MAX, "distances must fit in a cost_t");
+_Static_assert(sizeof(nbr_t) <= 12 + MAX_NODES + 3,
+               "nbr_t grew past its packed layout");
+_Static_assert(sizeof(((node_t*) 0)->nbr_set) * 8 >= MAX_NODES,
+               "neighbor bitset is too small for MAX_NODES");
+
 node_t new_node(int is_master)
 {
     printf("Initializing node...\n");
@@ -65,21 +74,62 @@ node_t new_node(int is_master)
     n.knows_nbrs = false;
 
     // Initialize with no neighbors
+    for (int w = 0; w < NBR_SET_WORDS; w++) {
+        n.nbr_set[w] = 0;
+    }
     for (int i = 0; i < MAX_NODES; i++) {
-        n.ID_is_nbr[i] = false;
-        n.nbrs[i]      = NULL;
+        n.nbrs[i] = NULL;
     }
-    n.num_nbrs = 0;
 
     // Initialize with empty DV and routing table
     for (int i = 0; i < MAX_NODES; i++) {
         n.dist_vector[i]   = DIST_IF_NO_ROUTE;
         n.routing_table[i] = NO_ROUTE;
     }
+    for (int w = 0; w < NBR_SET_WORDS; w++) {
+        n.provisional[w] = 0;
+    }
 
     return n;
 }
 
+bool is_nbr(node_t* n, int ID)
+{
+    if (ID < 0 || ID >= MAX_NODES) {
+        return false;
+    }
+
+    return (n->nbr_set[ID / 32] >> (ID % 32)) & 1u;
+}
+
+nbr_t* get_nbr(node_t* n, int ID)
+{
+    if (ID < 0 || ID >= MAX_NODES) {
+        return NULL;
+    }
+
+    return n->nbrs[ID];
+}
+
+void set_nbr(node_t* n, int ID)
+{
+    if (ID < 0 || ID >= MAX_NODES) {
+        return;
+    }
+
+    n->nbr_set[ID / 32] |= (1u << (ID % 32));
+}
+
+int num_nbrs(node_t* n)
+{
+    int count = 0;
+    for (int w = 0; w < NBR_SET_WORDS; w++) {
+        count += __builtin_popcount(n->nbr_set[w]);
+    }
+
+    return count;
+}
+
 int num_unupdated_nbrs(node_t* n)
 {
     int num_unupdated = 0;
@@ -96,6 +146,16 @@ int num_unupdated_nbrs(node_t* n)
     return num_unupdated;
 }
 
+void print_struct_sizes()
+{
+    printf("Struct sizes:\n");
+    printf("\tnode_t       = %u bytes\n", (unsigned int) sizeof(node_t));
+    printf("\tnbr_t        = %u bytes (x %d nbrs max)\n",
+           (unsigned int) sizeof(nbr_t), MAX_NODES);
+    printf("\tnbr bitset   = %u bytes\n",
+           (unsigned int) sizeof(((node_t*) 0)->nbr_set));
+}
+
 void print_neighbors()
 {
     print_green;
@@ -113,7 +173,7 @@ void print_neighbors()
     // Print neighbors
     printf("\tNeighbors:  [ ");
     for (int i = 0; i < MAX_NODES; i++) {
-        if (self.ID_is_nbr[i]) {
+        if (is_nbr(&self, i)) {
             printf("%d ", i);
         }
     }
@@ -136,7 +196,7 @@ void print_neighbors()
     // Print neighbors
     printf("\tNeighbors:  [ ");
     for (int i = 0; i < MAX_NODES; i++) {
-        if (self.ID_is_nbr[i]) {
+        if (is_nbr(&self, i)) {
             printf("%d ", ID_to_phys_ID[i]);
         }
     }
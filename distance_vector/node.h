@@ -3,6 +3,7 @@
 
 // C Libraries
 #include <stdbool.h>
+#include <stdint.h>
 
 // Local
 #include "layout.h"
@@ -12,41 +13,57 @@
 #define MASTER_ID  0
 #define DEFAULT_ID -1
 
-// Neighbor struct
+// Node IDs are signed so that DEFAULT_ID and NO_ROUTE (-1) still fit
+typedef int8_t node_id_t;
+
+// Link costs and distances, never larger than POISON_DIST
+typedef uint8_t cost_t;
+
+// Number of 32-bit words in the neighbor bitset
+#define NBR_SET_WORDS ((MAX_NODES + 31) / 32)
+
+// Neighbor struct. Fields read by every table scan come first, the estimate of
+// the neighbor's distance vector is only read when its DV is recomputed.
 typedef struct nbr {
-    int ID;                     // ID number
-    int cost;                   // Cost of sending a packet to this neighbor
-    int dist_vector[MAX_NODES]; // Estimate of nbr's distance vector
+    uint32_t last_contact; // Last time (ms since boot) I talked to this nbr
 
-    bool up_to_date;       // Is this nbr up-to-date on my DV?
-    uint64_t last_contact; // Last time I tried/succeeded talking to this nbr
+    node_id_t ID;          // ID number
+    cost_t cost;           // Cost of sending a packet to this neighbor
+    int8_t rssi;           // Signal strength of nbr's AP during the last scan
+    uint8_t dv_changes;    // Entries of my DV changed since nbr last heard it
+    uint8_t num_routes;    // Number of destinations I route through this nbr
+    uint8_t connect_fails; // Consecutive failed attempts to connect to nbr
 
-    bool new_dv; // New DV for this node that I haven't read yet?
+    bool up_to_date : 1; // Is this nbr up-to-date on my DV?
+    bool new_dv : 1;     // New DV for this node that I haven't read yet?
+
+    cost_t dist_vector[MAX_NODES]; // Estimate of nbr's distance vector
 } nbr_t;
 
-// Node struct
+// Node struct. The hot routing state comes first, followed by the identity
+// strings that are only touched when (re)connecting.
 typedef struct node {
 
-    int ID;        // ID number
-    int parent_ID; // Parent node ID number
+    node_id_t ID;        // ID number
+    node_id_t parent_ID; // Parent node ID number
 
-#ifdef USE_LAYOUT
-    int physical_ID; // Physical ID number
-#endif
+    bool knows_nbrs; // Has the node been assigned an ID and found its neighbors
 
-    unsigned int counter; // Count number of packets sent
+    uint32_t nbr_set[NBR_SET_WORDS]; // Bitset, bit <ID> is set if ID is a nbr
+    nbr_t* nbrs[MAX_NODES];          // Neighbor data, indexed by ID number
 
-    char wifi_ssid[SSID_LEN];  // My SSID when hosting an access point
-    char ip_addr[IP_ADDR_LEN]; // IPv4 address
+    cost_t dist_vector[MAX_NODES];       // My distance vector
+    node_id_t routing_table[MAX_NODES];  // My routing table
+    uint32_t provisional[NBR_SET_WORDS]; // Bit <ID>: resumed, unconfirmed route
 
-    int knows_nbrs; // Has the node been assigned an ID and found its neighbors
+    unsigned int counter; // Count number of packets sent
 
-    int ID_is_nbr[MAX_NODES]; // Hashmap (<ID>, <bool>), true if ID is neighbor
-    nbr_t* nbrs[MAX_NODES];   // Neighbor data, indexed by ID number
-    int num_nbrs;             // Number of neighbors
+#ifdef USE_LAYOUT
+    int8_t physical_ID; // Physical ID number
+#endif
 
-    int dist_vector[MAX_NODES];   // My distance vector
-    int routing_table[MAX_NODES]; // My routing table
+    char wifi_ssid[SSID_LEN];  // My SSID when hosting an access point
+    char ip_addr[IP_ADDR_LEN]; // IPv4 address
 
 } node_t;
 
@@ -56,9 +73,25 @@ extern node_t self;
 // Create a new node with default values
 node_t new_node(int is_master);
 
+// Returns true if [ID] is one of [n]'s neighbors
+bool is_nbr(node_t* n, int ID);
+
+// Returns [n]'s neighbor entry for [ID], NULL if [ID] is out of range or not
+// a neighbor
+nbr_t* get_nbr(node_t* n, int ID);
+
+// Mark [ID] as one of [n]'s neighbors
+void set_nbr(node_t* n, int ID);
+
+// Return the number of neighbors that [n] has
+int num_nbrs(node_t* n);
+
 // Return the number of un-updated neighbors that [n] has
 int num_unupdated_nbrs(node_t* n);
 
+// Print the sizes of the node and neighbor structs
+void print_struct_sizes();
+
 // Print results of neighbor search
 void print_neighbors();
 
@@ -115,9 +115,9 @@ packet_t str_to_packet(char* s)
         op.timestamp = strtoull(timestamp_str, NULL, 10);
     }
 
-    // Contents
+    // Contents. Not copy_field(), the message can be far longer than TOK_LEN
     token = strtok(NULL, ";");
-    copy_field(op.msg, token);
+    snprintf(op.msg, UDP_MSG_LEN_MAX, "%s", token == NULL ? "n/a" : token);
 
     return op;
 }
@@ -13,6 +13,9 @@
 // Packet types
 #define NUM_PACKET_TYPES 4
 
+// Names of the packet types
+extern const char* packet_types[NUM_PACKET_TYPES];
+
 // Structure that stores an outgoing packet
 typedef struct packet {
     char packet_type[TOK_LEN];
@@ -0,0 +1,401 @@
+// C libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PERSIST_HOST
+// Pico
+#    include "pico/stdlib.h"
+
+// Hardware
+#    include "hardware/flash.h"
+#    include "hardware/sync.h"
+#endif
+
+// Local
+#include "layout.h"
+#include "persist.h"
+
+#ifndef PERSIST_HOST
+#    include "net_core.h"
+#endif
+
+/************************************************
+ *  FLASH BACKEND
+ ************************************************/
+
+#ifdef PERSIST_HOST
+
+// Same geometry as the RP2040's external flash
+#    define FLASH_SECTOR_SIZE     4096
+#    define FLASH_PAGE_SIZE       256
+#    define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+
+#endif
+
+// Offset of the persistence region from the start of flash
+#define PERSIST_OFFSET                                                         \
+    (PICO_FLASH_SIZE_BYTES - PERSIST_SECTORS * FLASH_SECTOR_SIZE)
+
+// Size of the persistence region
+#define PERSIST_SIZE (PERSIST_SECTORS * FLASH_SECTOR_SIZE)
+
+// Each record occupies one page
+#define SLOTS_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define NUM_SLOTS        (PERSIST_SECTORS * SLOTS_PER_SECTOR)
+
+_Static_assert(sizeof(persist_record_t) <= FLASH_PAGE_SIZE,
+               "persist_record_t must fit in one flash page");
+
+#ifdef PERSIST_HOST
+
+// The emulated flash region, loaded from and written back to a file
+static uint8_t host_flash[PERSIST_SIZE];
+static bool host_flash_loaded = false;
+
+static void host_flash_load()
+{
+    if (host_flash_loaded) {
+        return;
+    }
+
+    // A missing file is a blank (erased) chip
+    memset(host_flash, 0xFF, PERSIST_SIZE);
+
+    FILE* f = fopen(PERSIST_HOST_FILE, "rb");
+    if (f != NULL) {
+        size_t n = fread(host_flash, 1, PERSIST_SIZE, f);
+        (void) n;
+        fclose(f);
+    }
+
+    host_flash_loaded = true;
+}
+
+static void host_flash_store()
+{
+    FILE* f = fopen(PERSIST_HOST_FILE, "wb");
+    if (f == NULL) {
+        printf("ERROR: Can't open %s\n", PERSIST_HOST_FILE);
+        return;
+    }
+    fwrite(host_flash, 1, PERSIST_SIZE, f);
+    fclose(f);
+}
+
+static const uint8_t* flash_read_ptr(uint32_t offset)
+{
+    host_flash_load();
+    return &host_flash[offset];
+}
+
+static void flash_erase_sector(uint32_t offset)
+{
+    host_flash_load();
+    memset(&host_flash[offset], 0xFF, FLASH_SECTOR_SIZE);
+    host_flash_store();
+}
+
+static void flash_program_page(uint32_t offset, const uint8_t* page)
+{
+    host_flash_load();
+
+    // NOR flash can only clear bits, emulate that so torn or repeated writes
+    // behave like they would on the chip
+    for (int i = 0; i < FLASH_PAGE_SIZE; i++) {
+        host_flash[offset + i] &= page[i];
+    }
+    host_flash_store();
+}
+
+#else
+
+static const uint8_t* flash_read_ptr(uint32_t offset)
+{
+    // Flash is memory mapped through XIP
+    return (const uint8_t*) (XIP_BASE + PERSIST_OFFSET + offset);
+}
+
+static void flash_erase_sector(uint32_t offset)
+{
+    // Nothing may execute from flash while it is being erased. Core 1 is
+    // parked if it runs the network, and this core's interrupts are off.
+    net_core_pause();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(PERSIST_OFFSET + offset, FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+    net_core_resume();
+}
+
+static void flash_program_page(uint32_t offset, const uint8_t* page)
+{
+    net_core_pause();
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_program(PERSIST_OFFSET + offset, page, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+    net_core_resume();
+}
+
+#endif
+
+/************************************************
+ *  RECORDS
+ ************************************************/
+
+// Bitwise CRC-32 (IEEE 802.3), small and only run on save and boot
+static uint32_t crc32(const uint8_t* data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+// CRC over every field before [crc]
+static uint32_t record_crc(const persist_record_t* rec)
+{
+    return crc32((const uint8_t*) rec, offsetof(persist_record_t, crc));
+}
+
+// Read slot [slot] into [rec], returns true if it holds a valid record
+static bool read_slot(int slot, persist_record_t* rec)
+{
+    memcpy(rec, flash_read_ptr(slot * FLASH_PAGE_SIZE), sizeof(*rec));
+
+    return rec->magic == PERSIST_MAGIC && rec->crc == record_crc(rec);
+}
+
+// Returns true if slot [slot] has not been programmed since the last erase
+static bool slot_is_erased(int slot)
+{
+    const uint8_t* p = flash_read_ptr(slot * FLASH_PAGE_SIZE);
+
+    for (int i = 0; i < FLASH_PAGE_SIZE; i++) {
+        if (p[i] != 0xFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Find the valid record with the highest sequence number. Returns its slot, or
+// -1 if there are no valid records.
+static int find_newest(persist_record_t* newest)
+{
+    persist_record_t rec;
+    int newest_slot = -1;
+
+    for (int slot = 0; slot < NUM_SLOTS; slot++) {
+        if (read_slot(slot, &rec)
+            && (newest_slot < 0 || rec.seq > newest->seq)) {
+            *newest     = rec;
+            newest_slot = slot;
+        }
+    }
+
+    return newest_slot;
+}
+
+int persist_load(persist_record_t* rec)
+{
+    if (find_newest(rec) < 0) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// Fill [rec] from [n], leaving magic, seq and crc for the caller
+static void record_from_node(persist_record_t* rec, node_t* n)
+{
+    memset(rec, 0, sizeof(*rec));
+
+    rec->ID        = n->ID;
+    rec->parent_ID = n->parent_ID;
+
+    memcpy(rec->nbr_set, n->nbr_set, sizeof(rec->nbr_set));
+    memcpy(rec->dist_vector, n->dist_vector, sizeof(rec->dist_vector));
+    memcpy(rec->routing_table, n->routing_table, sizeof(rec->routing_table));
+
+    for (int id = 0; id < MAX_NODES; id++) {
+        rec->nbr_cost[id] =
+            (n->nbrs[id] != NULL) ? n->nbrs[id]->cost : DEFAULT_COST;
+
+#ifdef USE_LAYOUT
+        rec->phys_IDs[id] = ID_to_phys_ID[id];
+#else
+        rec->phys_IDs[id] = -1;
+#endif
+    }
+}
+
+int persist_save(node_t* n)
+{
+    persist_record_t newest;
+    persist_record_t rec;
+
+    int newest_slot = find_newest(&newest);
+
+    record_from_node(&rec, n);
+
+    // Skip the write if nothing changed, saves wear on the flash
+    if (newest_slot >= 0) {
+        rec.magic = newest.magic;
+        rec.seq   = newest.seq;
+        rec.crc   = newest.crc;
+        if (memcmp(&rec, &newest, sizeof(rec)) == 0) {
+            return 0;
+        }
+    }
+
+    rec.magic = PERSIST_MAGIC;
+    rec.seq   = (newest_slot >= 0) ? newest.seq + 1 : 0;
+    rec.crc   = record_crc(&rec);
+
+    // Find the next writable slot after the newest record. Entering a new
+    // sector erases it, which never touches the sector holding the newest
+    // record because there are at least two sectors.
+    int slot = (newest_slot + 1) % NUM_SLOTS;
+    for (int tries = 0; tries < NUM_SLOTS; tries++) {
+        if (slot_is_erased(slot)) {
+            break;
+        }
+
+        if (slot % SLOTS_PER_SECTOR == 0) {
+            flash_erase_sector(slot * FLASH_PAGE_SIZE);
+            break;
+        }
+
+        // Skip over a torn or corrupt slot
+        slot = (slot + 1) % NUM_SLOTS;
+    }
+
+    // Pad the record out to a full page
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, FLASH_PAGE_SIZE);
+    memcpy(page, &rec, sizeof(rec));
+
+    flash_program_page(slot * FLASH_PAGE_SIZE, page);
+
+    // Read it back
+    persist_record_t check;
+    if (!read_slot(slot, &check) || check.seq != rec.seq) {
+        printf("ERROR: Persisted record failed verification (slot %d)\n",
+               slot);
+        return 1;
+    }
+
+    printf("Saved state to flash (slot %d, seq %u)\n", slot,
+           (unsigned int) rec.seq);
+
+    return 0;
+}
+
+void persist_apply(node_t* n, persist_record_t* rec)
+{
+    n->ID         = rec->ID;
+    n->parent_ID  = rec->parent_ID;
+    n->knows_nbrs = true;
+
+    memcpy(n->nbr_set, rec->nbr_set, sizeof(n->nbr_set));
+    memcpy(n->dist_vector, rec->dist_vector, sizeof(n->dist_vector));
+    memcpy(n->routing_table, rec->routing_table, sizeof(n->routing_table));
+
+#ifdef USE_LAYOUT
+    for (int id = 0; id < MAX_NODES; id++) {
+        ID_to_phys_ID[id] = rec->phys_IDs[id];
+    }
+#endif
+}
+
+void persist_apply_costs(node_t* n, persist_record_t* rec)
+{
+    for (int id = 0; id < MAX_NODES; id++) {
+        if (n->nbrs[id] != NULL) {
+            n->nbrs[id]->cost = rec->nbr_cost[id];
+        }
+    }
+}
+
+void persist_erase()
+{
+    for (int s = 0; s < PERSIST_SECTORS; s++) {
+        flash_erase_sector(s * FLASH_SECTOR_SIZE);
+    }
+
+    printf("Erased persisted state\n");
+}
+
+/************************************************
+ *  HOST TOOL
+ ************************************************/
+
+// Build with `make persist_host` to inspect and exercise a flash image on a
+// computer. Usage: persist_host [dump | erase | save <ID>]
+#ifdef PERSIST_HOST_MAIN
+
+int main(int argc, char** argv)
+{
+    persist_record_t rec;
+
+    if (argc >= 2 && strcmp(argv[1], "erase") == 0) {
+        persist_erase();
+        return 0;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "save") == 0) {
+        // Save a node with a line of neighbors on either side of it
+        node_t n;
+        memset(&n, 0, sizeof(n));
+
+        n.ID        = atoi(argv[2]);
+        n.parent_ID = n.ID - 1;
+        for (int id = 0; id < MAX_NODES; id++) {
+            n.dist_vector[id]   = (id > n.ID) ? id - n.ID : n.ID - id;
+            n.routing_table[id] = (id > n.ID) ? n.ID + 1 : n.ID - 1;
+        }
+        n.routing_table[n.ID] = n.ID;
+        for (int id = n.ID - 1; id <= n.ID + 1; id += 2) {
+            if (id >= 0 && id < MAX_NODES) {
+                n.nbr_set[id / 32] |= (1u << (id % 32));
+            }
+        }
+
+        return persist_save(&n);
+    }
+
+    // Dump
+    int used = 0;
+    for (int slot = 0; slot < NUM_SLOTS; slot++) {
+        used += !slot_is_erased(slot);
+    }
+    printf("Slots used: %d / %d\n", used, NUM_SLOTS);
+
+    if (persist_load(&rec)) {
+        printf("No valid record\n");
+        return 1;
+    }
+
+    printf("seq %u: ID %d, parent %d\n", (unsigned int) rec.seq, rec.ID,
+           rec.parent_ID);
+    printf("\t ID | nbr | cost | dist | next-hop\n");
+    for (int id = 0; id < MAX_NODES; id++) {
+        printf("\t%3d | %3d | %4d | %4d | %4d\n", id,
+               (int) ((rec.nbr_set[id / 32] >> (id % 32)) & 1u),
+               rec.nbr_cost[id], rec.dist_vector[id], rec.routing_table[id]);
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local
+#include "network_opts.h"
+#include "node.h"
+
+// Records are written round-robin into the last PERSIST_SECTORS sectors of
+// flash, one record per page, so each sector is only erased once every
+// (sector size / page size) saves.
+#define PERSIST_SECTORS 2
+
+// Marks a programmed record, erased flash reads back as 0xFFFFFFFF
+#define PERSIST_MAGIC 0x44564e31 // "DVN1"
+
+// Compile with PERSIST_HOST to emulate flash with a file (PERSIST_HOST_FILE)
+// instead of the on-board flash, so records can be inspected off-device.
+#ifdef PERSIST_HOST
+#    define PERSIST_HOST_FILE "persist_flash.bin"
+#endif
+
+// A snapshot of the state needed to skip neighbor finding after a reboot
+typedef struct persist_record {
+    uint32_t magic; // PERSIST_MAGIC
+    uint32_t seq;   // Incremented on every save, the highest valid seq wins
+
+    node_id_t ID;        // My ID
+    node_id_t parent_ID; // My parent's ID
+
+    uint32_t nbr_set[NBR_SET_WORDS];    // My neighbors
+    cost_t nbr_cost[MAX_NODES];         // Link cost to each neighbor
+    cost_t dist_vector[MAX_NODES];      // My distance vector
+    node_id_t routing_table[MAX_NODES]; // My routing table
+    int8_t phys_IDs[MAX_NODES];         // Physical IDs (USE_LAYOUT only)
+
+    uint32_t crc; // CRC-32 of every field above
+} persist_record_t;
+
+// Load the newest valid record into [rec], returns 0 on success
+int persist_load(persist_record_t* rec);
+
+// Save [n]'s identity, neighbors and routes. Nothing is written if the state
+// is identical to the newest record. Returns 0 on success.
+int persist_save(node_t* n);
+
+// Apply a loaded record to [n]. Neighbors are allocated by the caller (see
+// init_dist_vector_routing()) and get their costs from persist_apply_costs().
+void persist_apply(node_t* n, persist_record_t* rec);
+
+// Copy the stored link costs into [n]'s allocated neighbors
+void persist_apply_costs(node_t* n, persist_record_t* rec);
+
+// Erase every record, the next boot starts from scratch
+void persist_erase();
+
+#endif
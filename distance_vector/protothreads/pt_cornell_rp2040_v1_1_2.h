@@ -480,6 +480,7 @@ struct pt {
 
 struct pt_sem {
     unsigned int count;
+    spin_lock_t* lock; // PT_SEM_SAFE_*: this semaphore's hardware spinlock
 };
 
 /**
@@ -554,7 +555,8 @@ struct pt_sem {
     do {                                                                       \
         static uint64_t time_thread;                                           \
         time_thread = time_us_64() + (uint64_t) delay_time;                    \
-        PT_YIELD_UNTIL(pt, (time_us_64() >= time_thread));                     \
+        PT_WAIT_EVENT_UNTIL(pt, 0, time_thread,                                \
+                            (time_us_64() >= time_thread));                    \
     } while (0);
 
 // macro to return system time
@@ -566,7 +568,8 @@ struct pt_sem {
 //
 #define PT_YIELD_INTERVAL(interval_time)                                       \
     do {                                                                       \
-        PT_YIELD_UNTIL(pt, (time_us_64() >= pt_interval_marker));              \
+        PT_WAIT_EVENT_UNTIL(pt, 0, pt_interval_marker,                         \
+                            (time_us_64() >= pt_interval_marker));             \
         pt_interval_marker = time_us_64() + (uint64_t) interval_time;          \
     } while (0);
 //
@@ -576,35 +579,59 @@ struct pt_sem {
 // NOTE that the default semaphore is not
 // multi-core safe, but is OK one one core
 // The SAFE versions work across cores, but have more overhead
-
-spin_lock_t* sem_lock;
+//
+// Every semaphore has its own spinlock, claimed by its first
+// PT_SEM_SAFE_INIT, so semaphores never contend with each other. Once the
+// free spinlocks run out, semaphores share the SDK's striped ones. The lock
+// is held for a few instructions with interrupts off.
+
+// the spinlock of [s], claimed the first time it's needed. Every macro goes
+// through here, so a semaphore can be used before PT_SEM_SAFE_INIT. Only the
+// first use may race with the other core, initialize shared semaphores
+// before launching it.
+static inline spin_lock_t* pt_sem_safe_lock(struct pt_sem* s)
+{
+    if (s->lock == NULL) {
+        int num = spin_lock_claim_unused(false);
+        // a claimed lock is ours to reset, a striped one isn't
+        s->lock = num >= 0 ? spin_lock_init(num)
+                           : spin_lock_instance(next_striped_spin_lock_num());
+    }
+    return s->lock;
+}
 
 #define PT_SEM_SAFE_INIT(s, c)                                                 \
     do {                                                                       \
-        sem_lock = spin_lock_init(25);                                         \
-        spin_lock_unsafe_blocking(sem_lock);                                   \
-        (s)->count = c;                                                        \
-        spin_unlock_unsafe(sem_lock);                                          \
+        spin_lock_t* lock = pt_sem_safe_lock(s);                               \
+        uint32_t save     = spin_lock_blocking(lock);                          \
+        (s)->count        = c;                                                 \
+        spin_unlock(lock, save);                                               \
     } while (0)
 
+// the lock is taken after LC_SET, so the thread holds it whether it got here
+// first or resumed here
 #define PT_SEM_SAFE_WAIT(pt, s)                                                \
     do {                                                                       \
-        spin_lock_unsafe_blocking(sem_lock);                                   \
         PT_YIELD_FLAG = 0;                                                     \
         LC_SET((pt)->lc);                                                      \
+        pt_wait_on(PT_EVENT_SEM, PT_NO_WAKE_TIME);                             \
+        spin_lock_t* lock = pt_sem_safe_lock(s);                               \
+        uint32_t save     = spin_lock_blocking(lock);                          \
         if ((PT_YIELD_FLAG == 0) || !((s)->count > 0)) {                       \
-            spin_unlock_unsafe(sem_lock);                                      \
+            spin_unlock(lock, save);                                           \
             return PT_YIELDED;                                                 \
         }                                                                      \
         --(s)->count;                                                          \
-        spin_unlock_unsafe(sem_lock);                                          \
+        spin_unlock(lock, save);                                               \
     } while (0)
 
 #define PT_SEM_SAFE_SIGNAL(pt, s)                                              \
     do {                                                                       \
-        spin_lock_unsafe_blocking(sem_lock);                                   \
+        spin_lock_t* lock = pt_sem_safe_lock(s);                               \
+        uint32_t save     = spin_lock_blocking(lock);                          \
         ++(s)->count;                                                          \
-        spin_unlock_unsafe(sem_lock);                                          \
+        spin_unlock(lock, save);                                               \
+        pt_post_event(PT_EVENT_SEM);                                           \
     } while (0)
 
 // ==================================================================
@@ -681,13 +708,135 @@ static struct pt pt_sched1;
 int pt_task_count  = 0;
 int pt_task_count1 = 0;
 
+// optional per-thread statistics, define PT_STATS as true before including
+// this file to keep them. They're compiled out otherwise.
+#ifndef PT_STATS
+#    define PT_STATS false
+#endif
+
+#if PT_STATS
+typedef struct pt_stats {
+    uint32_t runs;           // calls of the thread function
+    uint64_t run_us;         // time spent in them
+    uint32_t run_max_us;     // longest call
+    uint32_t wakes;          // runs after a wait on events was satisfied
+    uint64_t latency_us;     // time from the event to those runs
+    uint32_t latency_max_us; // longest of them
+} pt_stats_t;
+#endif
+
 // The task structure
 struct ptx {
     struct pt pt;              // thread context
     int num;                   // thread number
     char (*pf)(struct pt* pt); // pointer to thread function
+    uint32_t wait_events;      // events that wake the thread
+    uint64_t wake_time;        // time (us) the thread wakes up regardless
+    int priority;              // SCHED_PRIORITY: lower runs first
+    uint64_t deadline_us;      // SCHED_PRIORITY: run within this once woken
+    bool ready;                // SCHED_PRIORITY: woken, waiting to run
+    uint64_t due;              // SCHED_PRIORITY: wake time + deadline
+#if PT_STATS
+    const char* name;   // for pt_print_stats()
+    uint64_t posted_at; // time of the event that woke it, 0 if none did
+    pt_stats_t stats;
+#endif
 };
 
+//====================================================================
+// EVENT FLAGS
+// A thread waits on a mask of event bits and/or a wake time. Producers
+// (other threads, lwIP callbacks, timers) post bits with pt_post_event().
+// The scheduler only runs threads that have been woken, and sleeps the
+// core with __wfe() until an event or the earliest wake time otherwise.
+//
+// Waits that don't name their events (PT_YIELD_UNTIL and friends) wake
+// on every event and are polled every PT_POLL_US, so threads that haven't
+// been converted keep working. Every thread is also woken at least every
+// PT_MAX_SLEEP_US in case a producer forgets to post.
+//
+// So the core only sleeps while every thread is in a named wait. Still
+// polled here: PT_SEM_WAIT (use PT_SEM_SAFE_*), the multicore FIFO macros
+// and the serial threads' short waits for room in the UART FIFO.
+
+// events reserved by this file, applications use the other bits
+#define PT_EVENT_ALL  0xFFFFFFFFu
+#define PT_EVENT_SEM  (1u << 31) // PT_SEM_SAFE_SIGNAL
+#define PT_EVENT_USER (1u << 0)  // first application event
+
+#define PT_NO_WAKE_TIME UINT64_MAX
+#define PT_POLL_US      1000
+#define PT_MAX_SLEEP_US 100000
+
+// pending events, one word per core
+static volatile uint32_t pt_events[2];
+// thread being run on each core
+static struct ptx* pt_current[2];
+#if PT_STATS
+// time of the oldest pending event, one word per core
+static uint64_t pt_events_time[2];
+// ... as of the last pt_take_events() on each core
+static uint64_t pt_taken_time[2];
+#endif
+
+// short critical sections, safe from interrupts and the other core
+#define pt_event_lock spin_lock_instance(PICO_SPINLOCK_ID_STRIPED_LAST)
+
+// post [events] to both cores and wake them, safe from an interrupt
+static inline void pt_post_event(uint32_t events)
+{
+    uint32_t save = spin_lock_blocking(pt_event_lock);
+#if PT_STATS
+    uint64_t now = time_us_64();
+    for (int core = 0; core < 2; core++) {
+        if (pt_events[core] == 0) {
+            pt_events_time[core] = now;
+        }
+    }
+#endif
+    pt_events[0] |= events;
+    pt_events[1] |= events;
+    spin_unlock(pt_event_lock, save);
+    __sev();
+}
+
+// take (and clear) the events pending on [core]
+static inline uint32_t pt_take_events(uint core)
+{
+    uint32_t save   = spin_lock_blocking(pt_event_lock);
+    uint32_t events = pt_events[core];
+    pt_events[core] = 0;
+#if PT_STATS
+    pt_taken_time[core] = pt_events_time[core];
+#endif
+    spin_unlock(pt_event_lock, save);
+    return events;
+}
+
+// called from the running thread: wake it on [events] or at [wake_time],
+// and no later than PT_MAX_SLEEP_US from now (PT_NO_WAKE_TIME included)
+static inline void pt_wait_on(uint32_t events, uint64_t wake_time)
+{
+    struct ptx* ptx = pt_current[get_core_num()];
+    if (ptx != NULL) {
+        uint64_t latest  = time_us_64() + PT_MAX_SLEEP_US;
+        ptx->wait_events = events;
+        ptx->wake_time   = wake_time < latest ? wake_time : latest;
+    }
+}
+
+// yield until [cond], only re-checking it when one of [events] is posted or
+// at [wake_time] (PT_NO_WAKE_TIME for none)
+#define PT_WAIT_EVENT_UNTIL(pt, events, wake_time, cond)                       \
+    do {                                                                       \
+        PT_YIELD_FLAG = 0;                                                     \
+        LC_SET((pt)->lc);                                                      \
+        pt_wait_on(events, wake_time);                                         \
+        if ((PT_YIELD_FLAG == 0) || !(cond)) {                                 \
+            return PT_YIELDED;                                                 \
+        }                                                                      \
+    } while (0)
+
 // === extended structure for scheduler ===============
 // an array of task structures
 #define MAX_THREADS 10
@@ -695,48 +844,76 @@ static struct ptx pt_thread_list[MAX_THREADS];
 // core 1
 static struct ptx pt_thread_list1[MAX_THREADS];
 
+// priorities for SCHED_PRIORITY, lower numbers run first. Any int works,
+// these are just the usual levels.
+#define PT_PRIO_HIGH   0
+#define PT_PRIO_NORMAL 4
+#define PT_PRIO_LOW    8
+
+// deadline of threads added without one
+#define PT_DEFAULT_DEADLINE_US PT_MAX_SLEEP_US
+
 // see https://github.com/edartuz/c-ptx/tree/master/src
 // and the license above
-// add an entry to the thread list
-// struct ptx *pt_add( char (*pf)(struct pt *pt), int rate) {
-int pt_add(char (*pf)(struct pt* pt))
+// add an entry to [list], which holds [count] threads
+static int pt_add_to(struct ptx* list, int* count, char (*pf)(struct pt* pt),
+                     int priority, uint64_t deadline_us)
 {
-    if (pt_task_count < (MAX_THREADS)) {
+    if (*count < (MAX_THREADS)) {
         // get the current thread table entry
-        struct ptx* ptx = &pt_thread_list[pt_task_count];
+        struct ptx* ptx = &list[*count];
         // enter the tak data into the thread table
-        ptx->num = pt_task_count;
+        ptx->num = *count;
         // function pointer
         ptx->pf = pf;
+        // run it as soon as the scheduler starts
+        ptx->wait_events = PT_EVENT_ALL;
+        ptx->wake_time   = 0;
+        // only used by SCHED_PRIORITY
+        ptx->priority    = priority;
+        ptx->deadline_us = deadline_us;
+        ptx->ready       = false;
+        ptx->due         = 0;
+#if PT_STATS
+        ptx->posted_at = 0;
+        memset(&ptx->stats, 0, sizeof(ptx->stats));
+#endif
         //
         PT_INIT(&ptx->pt);
         // count of number of defined threads
-        pt_task_count++;
+        (*count)++;
         // return current entry
-        return pt_task_count - 1;
+        return *count - 1;
     }
     return 0;
 }
 
-// core 1 -- add an entry to the thread list
+// add an entry to the thread list
 // struct ptx *pt_add( char (*pf)(struct pt *pt), int rate) {
+int pt_add(char (*pf)(struct pt* pt))
+{
+    return pt_add_to(pt_thread_list, &pt_task_count, pf, PT_PRIO_NORMAL,
+                     PT_DEFAULT_DEADLINE_US);
+}
+
+// core 1 -- add an entry to the thread list
 int pt_add1(char (*pf)(struct pt* pt))
 {
-    if (pt_task_count1 < (MAX_THREADS)) {
-        // get the current thread table entry
-        struct ptx* ptx = &pt_thread_list1[pt_task_count1];
-        // enter the tak data into the thread table
-        ptx->num = pt_task_count1;
-        // function pointer
-        ptx->pf = pf;
-        //
-        PT_INIT(&ptx->pt);
-        // count of number of defined threads
-        pt_task_count1++;
-        // return current entry
-        return pt_task_count1 - 1;
-    }
-    return 0;
+    return pt_add_to(pt_thread_list1, &pt_task_count1, pf, PT_PRIO_NORMAL,
+                     PT_DEFAULT_DEADLINE_US);
+}
+
+// add an entry with a priority and a deadline (us), see SCHED_PRIORITY
+int pt_add_prio(char (*pf)(struct pt* pt), int priority, uint64_t deadline_us)
+{
+    return pt_add_to(pt_thread_list, &pt_task_count, pf, priority, deadline_us);
+}
+
+// core 1 -- add an entry with a priority and a deadline (us)
+int pt_add_prio1(char (*pf)(struct pt* pt), int priority, uint64_t deadline_us)
+{
+    return pt_add_to(pt_thread_list1, &pt_task_count1, pf, priority,
+                     deadline_us);
 }
 
 /* Scheduler
@@ -766,34 +943,247 @@ SOFTWARE.
 // https://github.com/edartuz/c-ptx
 // see license above
 
+// optional hooks around every run of a thread, define them before including
+// this file (main.c points them at the event trace)
+#ifndef PT_TRACE_RUN
+#    define PT_TRACE_RUN(num)
+#endif
+#ifndef PT_TRACE_YIELD
+#    define PT_TRACE_YIELD(num)
+#endif
+
+// === statistics =======================================
+// per thread: runs, time spent running, and the latency from an event to the
+// run of a thread that waited on it (semaphores, event flags). The latency
+// counts from the oldest event pending when the scheduler took them, so it's
+// an upper bound when several arrive together. Polled waits (PT_YIELD_UNTIL
+// and friends) and timers aren't counted as wakes.
+#if PT_STATS
+// a wait of [ptx] on named events was satisfied by [events] on [core]
+static inline void pt_stats_woken(struct ptx* ptx, uint32_t events, uint core)
+{
+    if (ptx->wait_events != PT_EVENT_ALL && (events & ptx->wait_events)) {
+        ptx->posted_at = pt_taken_time[core];
+    }
+}
+
+// [ptx] ran from [start] to [end]
+static inline void pt_stats_ran(struct ptx* ptx, uint64_t start, uint64_t end)
+{
+    pt_stats_t* st = &ptx->stats;
+    uint32_t us    = end - start;
+
+    st->runs++;
+    st->run_us += us;
+    if (us > st->run_max_us) {
+        st->run_max_us = us;
+    }
+
+    if (ptx->posted_at != 0) {
+        uint32_t latency = start - ptx->posted_at;
+
+        st->wakes++;
+        st->latency_us += latency;
+        if (latency > st->latency_max_us) {
+            st->latency_max_us = latency;
+        }
+        ptx->posted_at = 0;
+    }
+}
+
+// label thread [num] of this core in pt_print_stats(), before or after it's
+// added
+void pt_stats_name(int num, const char* name)
+{
+    if (num < 0 || num >= MAX_THREADS) {
+        return;
+    }
+    if (get_core_num() == 1) {
+        pt_thread_list1[num].name = name;
+    } else {
+        pt_thread_list[num].name = name;
+    }
+}
+
+static void pt_print_list_stats(struct ptx* list, int count, int core)
+{
+    for (int i = 0; i < count; i++) {
+        pt_stats_t* st = &list[i].stats;
+
+        printf("%4d %2d %-10s %9u %10llu %8u %8u %9u %8u %8u\n", core, i,
+               list[i].name != NULL ? list[i].name : "-",
+               (unsigned int) st->runs, (unsigned long long) st->run_us,
+               (unsigned int) (st->runs ? st->run_us / st->runs : 0),
+               (unsigned int) st->run_max_us, (unsigned int) st->wakes,
+               (unsigned int) (st->wakes ? st->latency_us / st->wakes : 0),
+               (unsigned int) st->latency_max_us);
+    }
+}
+
+// print the statistics of both cores' threads (times in us)
+void pt_print_stats()
+{
+    printf("%4s %2s %-10s %9s %10s %8s %8s %9s %8s %8s\n", "core", "#",
+           "thread", "runs", "run_us", "avg_us", "max_us", "wakes", "lat_avg",
+           "lat_max");
+    pt_print_list_stats(pt_thread_list, pt_task_count, 0);
+    pt_print_list_stats(pt_thread_list1, pt_task_count1, 1);
+}
+
+// forget the statistics of both cores' threads
+void pt_reset_stats()
+{
+    for (int i = 0; i < pt_task_count; i++) {
+        memset(&pt_thread_list[i].stats, 0, sizeof(pt_stats_t));
+    }
+    for (int i = 0; i < pt_task_count1; i++) {
+        memset(&pt_thread_list1[i].stats, 0, sizeof(pt_stats_t));
+    }
+}
+#endif
+
+// run [ptx] once on [core]
+static inline void pt_run(struct ptx* ptx, uint core)
+{
+#if PT_STATS
+    uint64_t start = time_us_64();
+#endif
+
+    pt_current[core] = ptx;
+    PT_TRACE_RUN(ptx->num);
+    (ptx->pf)(&ptx->pt);
+    PT_TRACE_YIELD(ptx->num);
+    pt_current[core] = NULL;
+
+#if PT_STATS
+    pt_stats_ran(ptx, start, time_us_64());
+#endif
+}
+
 // choose schedule method
 #define SCHED_ROUND_ROBIN 0
 #define SCHED_RATE        1
+#define SCHED_PRIORITY    2
 int pt_sched_method = SCHED_ROUND_ROBIN;
 
+// run the woken threads in [list] in order, forever. Sleeps until the next
+// event or wake time when none is ready.
+static void pt_run_threads(struct ptx* list, int* count)
+{
+    uint core = get_core_num();
+
+    while (1) {
+        uint32_t events = pt_take_events(core);
+        uint64_t now    = time_us_64();
+        uint64_t wake   = now + PT_MAX_SLEEP_US;
+        bool ran        = false;
+
+        for (int i = 0; i < *count; i++) {
+            struct ptx* ptx = &list[i];
+
+            if ((events & ptx->wait_events) || now >= ptx->wake_time) {
+#if PT_STATS
+                pt_stats_woken(ptx, events, core);
+#endif
+                // poll the thread unless its wait names events
+                ptx->wait_events = PT_EVENT_ALL;
+                ptx->wake_time   = now + PT_POLL_US;
+
+                pt_run(ptx, core);
+
+                ran = true;
+            }
+
+            if (ptx->wake_time < wake) {
+                wake = ptx->wake_time;
+            }
+        }
+
+        // an event posted since pt_take_events() leaves the event register
+        // set, so __wfe() returns straight away
+        if (!ran) {
+            best_effort_wfe_or_timeout(from_us_since_boot(wake));
+        }
+    }
+}
+
+// run the most urgent woken thread in [list], forever: the lowest priority
+// first, then the earliest due time. A thread is due its deadline after it's
+// woken, counted from its wake time when a timer woke it, so timers run in
+// wake time order and a late thread overtakes the ones woken after it. The
+// events are checked again after every run, so a woken thread only waits for
+// the run in progress and the more urgent threads, not for its place in the
+// list. A thread that never waits starves the less urgent ones, so high
+// priorities are for threads that wait on events.
+static void pt_run_priority(struct ptx* list, int* count)
+{
+    uint core = get_core_num();
+
+    while (1) {
+        uint32_t events  = pt_take_events(core);
+        uint64_t now     = time_us_64();
+        uint64_t wake    = now + PT_MAX_SLEEP_US;
+        struct ptx* next = NULL;
+
+        for (int i = 0; i < *count; i++) {
+            struct ptx* ptx = &list[i];
+
+            // the events are consumed, so a woken thread stays ready until
+            // it runs
+            if (!ptx->ready) {
+                if (events & ptx->wait_events) {
+#if PT_STATS
+                    pt_stats_woken(ptx, events, core);
+#endif
+                    ptx->ready = true;
+                    ptx->due   = now + ptx->deadline_us;
+                } else if (now >= ptx->wake_time) {
+                    ptx->ready = true;
+                    ptx->due   = ptx->wake_time + ptx->deadline_us;
+                } else {
+                    if (ptx->wake_time < wake) {
+                        wake = ptx->wake_time;
+                    }
+                    continue;
+                }
+            }
+
+            // ties go to the thread added first
+            if (next == NULL || ptx->priority < next->priority
+                || (ptx->priority == next->priority && ptx->due < next->due)) {
+                next = ptx;
+            }
+        }
+
+        if (next == NULL) {
+            best_effort_wfe_or_timeout(from_us_since_boot(wake));
+            continue;
+        }
+
+        // poll the thread unless its wait names events
+        next->ready       = false;
+        next->wait_events = PT_EVENT_ALL;
+        next->wake_time   = now + PT_POLL_US;
+
+        pt_run(next, core);
+    }
+}
+
 static PT_THREAD(protothread_sched(struct pt* pt))
 {
     PT_BEGIN(pt);
     static int i, rate;
 
     if (pt_sched_method == SCHED_ROUND_ROBIN) {
-        while (1) {
-            // test stupid round-robin
-            // on all defined threads
-            struct ptx* ptx = &pt_thread_list[0];
-            // step thru all defined threads
-            // -- loop can have more than one initialization or
-            // increment/decrement,
-            // -- separated using comma operator. But it can have only one
-            // condition.
-            for (i = 0; i < pt_task_count; i++, ptx++) {
-                // call thread function
-                (pt_thread_list[i].pf)(&ptx->pt);
-            }
-            // Never yields!
-            // NEVER exit while!
-        } // END WHILE(1)
+        // round-robin on all woken threads
+        // Never yields!
+        // NEVER returns!
+        pt_run_threads(pt_thread_list, &pt_task_count);
     }     // end if (pt_sched_method==RR)
+    else if (pt_sched_method == SCHED_PRIORITY) {
+        // most urgent woken thread first, NEVER returns!
+        pt_run_priority(pt_thread_list, &pt_task_count);
+    }
 
     PT_END(pt);
 } // scheduler thread
@@ -807,23 +1197,15 @@ static PT_THREAD(protothread_sched1(struct pt* pt))
     static int i, rate;
 
     if (pt_sched_method == SCHED_ROUND_ROBIN) {
-        while (1) {
-            // test stupid round-robin
-            // on all defined threads
-            struct ptx* ptx = &pt_thread_list1[0];
-            // step thru all defined threads
-            // -- loop can have more than one initialization or
-            // increment/decrement,
-            // -- separated using comma operator. But it can have only one
-            // condition.
-            for (i = 0; i < pt_task_count1; i++, ptx++) {
-                // call thread function
-                (pt_thread_list1[i].pf)(&ptx->pt);
-            }
-            // Never yields!
-            // NEVER exit while!
-        } // END WHILE(1)
+        // round-robin on all woken threads
+        // Never yields!
+        // NEVER returns!
+        pt_run_threads(pt_thread_list1, &pt_task_count1);
     }     // end if(pt_sched_method==SCHED_ROUND_ROBIN)
+    else if (pt_sched_method == SCHED_PRIORITY) {
+        // most urgent woken thread first, NEVER returns!
+        pt_run_priority(pt_thread_list1, &pt_task_count1);
+    }
 
     PT_END(pt);
 } // scheduler1 thread
@@ -851,6 +1233,17 @@ static PT_THREAD(protothread_sched1(struct pt* pt))
         }                                                                      \
     } while (0)
 
+// add a thread with a priority (PT_PRIO_*) and a deadline (us) for
+// SCHED_PRIORITY, round robin ignores both
+#define pt_add_thread_prio(thread_name, priority, deadline_us)                 \
+    do {                                                                       \
+        if (get_core_num() == 1) {                                             \
+            pt_add_prio1(thread_name, priority, deadline_us);                  \
+        } else {                                                               \
+            pt_add_prio(thread_name, priority, deadline_us);                   \
+        }                                                                      \
+    } while (0)
+
 // === serial input thread ================================
 // serial buffers
 #define pt_buffer_size 100
@@ -862,6 +1255,8 @@ static struct pt pt_serialin, pt_serialout;
 #define UART_ID uart0
 //
 #define pt_backspace 0x7f // make sure your backspace matches this!
+// how often to look for typed characters (us)
+#define PT_SERIAL_POLL_US 10000
 //
 static PT_THREAD(pt_serialin_polled(struct pt* pt))
 {
@@ -877,7 +1272,9 @@ static PT_THREAD(pt_serialin_polled(struct pt* pt))
     }
     // build the output string
     while (pt_current_char_count < pt_buffer_size) {
-        PT_YIELD_UNTIL(pt, (int) uart_is_readable(UART_ID));
+        // a human is typing, no need to poll the uart often
+        PT_WAIT_EVENT_UNTIL(pt, 0, time_us_64() + PT_SERIAL_POLL_US,
+                            (int) uart_is_readable(UART_ID));
         // get the character and echo it back to terminal
         //  NOTE this assumes a human is typing!!
         ch = uart_getc(UART_ID);
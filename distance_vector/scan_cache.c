@@ -0,0 +1,190 @@
+// C libraries
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Pico
+#include "hardware/sync.h"
+#include "pico/cyw43_arch.h"
+
+// Local
+#include "scan_cache.h"
+#include "utils.h"
+
+static scan_entry_t scan_cache[SCAN_CACHE_SIZE];
+
+// Time of the last full scan (ms), only meaningful if scan_cache_valid
+static uint32_t last_scan_time = 0;
+static bool scan_cache_valid   = false;
+
+// Held for every access, the scan callbacks take it from an interrupt
+static spin_lock_t* scan_cache_lock;
+
+void scan_cache_init()
+{
+    scan_cache_lock = spin_lock_init(spin_lock_claim_unused(true));
+}
+
+// Find the entry for [bssid], or the slot to replace if there is none. Called
+// with the lock held.
+static scan_entry_t* scan_cache_slot(const uint8_t* bssid, bool* found)
+{
+    scan_entry_t* oldest = NULL;
+
+    for (int i = 0; i < SCAN_CACHE_SIZE; i++) {
+        scan_entry_t* e = &scan_cache[i];
+
+        if (!e->valid) {
+            if (oldest == NULL || oldest->valid) {
+                oldest = e;
+            }
+            continue;
+        }
+
+        if (memcmp(e->bssid, bssid, sizeof(e->bssid)) == 0) {
+            *found = true;
+            return e;
+        }
+
+        // Prefer empty slots, then the least recently seen entry
+        if (oldest == NULL
+            || (oldest->valid
+                && (int32_t) (e->last_seen - oldest->last_seen) < 0)) {
+            oldest = e;
+        }
+    }
+
+    *found = false;
+    return oldest;
+}
+
+// Round a fixed-point RSSI to the nearest dB
+static int16_t rssi_round(int32_t rssi_fp)
+{
+    int32_t half = 1 << (SCAN_RSSI_FRAC_BITS - 1);
+
+    if (rssi_fp < 0) {
+        return -((-rssi_fp + half) >> SCAN_RSSI_FRAC_BITS);
+    }
+    return (rssi_fp + half) >> SCAN_RSSI_FRAC_BITS;
+}
+
+void scan_cache_update(const cyw43_ev_scan_result_t* result, ssid_kind_t kind,
+                       int ID, int phys_ID, int rssi)
+{
+    uint32_t now = time_ms_32();
+    bool found;
+
+    uint32_t save   = spin_lock_blocking(scan_cache_lock);
+    scan_entry_t* e = scan_cache_slot(result->bssid, &found);
+
+    // A new network, or an AP that has been renamed (a pidog becomes a picow
+    // once it has an ID) starts over
+    if (!found || strncmp(e->ssid, (const char*) result->ssid, SSID_LEN) != 0) {
+        memset(e, 0, sizeof(*e));
+        e->valid = true;
+        memcpy(e->bssid, result->bssid, sizeof(e->bssid));
+        snprintf(e->ssid, SSID_LEN, "%s", result->ssid);
+        e->first_seen = now;
+        e->rssi_fp    = rssi * (1 << SCAN_RSSI_FRAC_BITS);
+    }
+
+    e->kind      = kind;
+    e->ID        = ID;
+    e->phys_ID   = phys_ID;
+    e->rssi_fp  += (rssi * (1 << SCAN_RSSI_FRAC_BITS) - e->rssi_fp)
+                / (1 << SCAN_RSSI_EWMA_SHIFT);
+    e->rssi      = rssi_round(e->rssi_fp);
+    e->channel   = result->channel;
+    e->auth_mode = result->auth_mode;
+    e->last_seen = now;
+
+    spin_unlock(scan_cache_lock, save);
+}
+
+bool scan_cache_find(const char* ssid, scan_entry_t* out)
+{
+    bool found    = false;
+    uint32_t save = spin_lock_blocking(scan_cache_lock);
+
+    for (int i = 0; i < SCAN_CACHE_SIZE && !found; i++) {
+        if (scan_cache[i].valid
+            && strncmp(scan_cache[i].ssid, ssid, SSID_LEN) == 0) {
+            *out  = scan_cache[i];
+            found = true;
+        }
+    }
+
+    spin_unlock(scan_cache_lock, save);
+
+    return found;
+}
+
+void scan_cache_copy(scan_entry_t* out)
+{
+    uint32_t save = spin_lock_blocking(scan_cache_lock);
+    memcpy(out, scan_cache, sizeof(scan_cache));
+    spin_unlock(scan_cache_lock, save);
+}
+
+bool scan_cache_entry_fresh(scan_entry_t* e, uint32_t now)
+{
+    return e->valid && now - e->last_seen <= SCAN_CACHE_TTL_MS;
+}
+
+bool scan_cache_stale(uint32_t now)
+{
+    uint32_t save = spin_lock_blocking(scan_cache_lock);
+    bool stale = !scan_cache_valid || now - last_scan_time > SCAN_CACHE_TTL_MS;
+    spin_unlock(scan_cache_lock, save);
+
+    return stale;
+}
+
+void scan_cache_scanned(uint32_t now)
+{
+    uint32_t save    = spin_lock_blocking(scan_cache_lock);
+    last_scan_time   = now;
+    scan_cache_valid = true;
+    spin_unlock(scan_cache_lock, save);
+}
+
+void scan_cache_forget(const char* ssid)
+{
+    uint32_t save = spin_lock_blocking(scan_cache_lock);
+
+    for (int i = 0; i < SCAN_CACHE_SIZE; i++) {
+        if (scan_cache[i].valid
+            && strncmp(scan_cache[i].ssid, ssid, SSID_LEN) == 0) {
+            scan_cache[i].valid = false;
+        }
+    }
+
+    scan_cache_valid = false;
+
+    spin_unlock(scan_cache_lock, save);
+}
+
+void print_scan_cache()
+{
+    // Printed from a copy, the lock is only held for short stretches
+    static scan_entry_t entries[SCAN_CACHE_SIZE];
+    scan_cache_copy(entries);
+
+    uint32_t now = time_ms_32();
+
+    printf("SCAN CACHE (%s)\n", scan_cache_stale(now) ? "stale" : "fresh");
+
+    for (int i = 0; i < SCAN_CACHE_SIZE; i++) {
+        scan_entry_t* e = &entries[i];
+
+        if (e->valid) {
+            printf("\t%-*s %02x:%02x:%02x:%02x:%02x:%02x ch %2d rssi %4d dB  "
+                   "seen %5.1fs ago (first %5.1fs ago)\n",
+                   SSID_LEN, e->ssid, e->bssid[0], e->bssid[1], e->bssid[2],
+                   e->bssid[3], e->bssid[4], e->bssid[5], e->channel, e->rssi,
+                   (now - e->last_seen) / 1e3, (now - e->first_seen) / 1e3);
+        }
+    }
+}
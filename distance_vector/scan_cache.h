@@ -0,0 +1,76 @@
+#ifndef SCAN_CACHE_H
+#define SCAN_CACHE_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pico
+#include "pico/cyw43_arch.h"
+
+// Local
+#include "network_opts.h"
+#include "ssid.h"
+
+// Number of networks remembered, the least recently seen entry is replaced
+// when the cache is full
+#define SCAN_CACHE_SIZE 16
+
+// RSSI smoothing, each new sample moves the average 1/2^SHIFT of the way. The
+// average is kept with SCAN_RSSI_FRAC_BITS fractional bits so that steps
+// smaller than 1 dB aren't truncated away.
+#define SCAN_RSSI_EWMA_SHIFT 2
+#define SCAN_RSSI_FRAC_BITS  4
+
+// What the scans have taught us about one network
+typedef struct scan_entry {
+    bool valid;          // Is this entry in use?
+    uint8_t bssid[6];    // MAC address of the AP
+    char ssid[SSID_LEN]; // SSID of the AP
+    ssid_kind_t kind;    // picow or pidog
+    int ID;              // Node ID (picow) or -1 (pidog)
+    int phys_ID;         // Physical ID (USE_LAYOUT only) or -1
+    int16_t rssi;        // Smoothed RSSI (dB), rssi_fp rounded
+    int32_t rssi_fp;     // Smoothed RSSI (dB << SCAN_RSSI_FRAC_BITS)
+    uint16_t channel;    // Wi-Fi channel
+    uint8_t auth_mode;   // CYW43 auth mode reported by the scan
+    uint32_t first_seen; // Time of the first sighting (ms)
+    uint32_t last_seen;  // Time of the latest sighting (ms)
+} scan_entry_t;
+
+// The scan callbacks fill the cache on the core that runs the cyw43 (core 1
+// with NETWORK_ON_CORE1) while core 0 reads it, so every function takes the
+// cache's spin lock and entries are handed out as copies.
+
+// Claim the cache's spin lock, call before the cache is used
+void scan_cache_init();
+
+// Record a sighting of [result]. [rssi] replaces the RSSI reported by the scan
+// so emulated links can override it.
+void scan_cache_update(const cyw43_ev_scan_result_t* result, ssid_kind_t kind,
+                       int ID, int phys_ID, int rssi);
+
+// Copy the entry for [ssid] into [out], returns false if it isn't cached
+bool scan_cache_find(const char* ssid, scan_entry_t* out);
+
+// Copy every entry (valid or not) into [out], SCAN_CACHE_SIZE of them
+void scan_cache_copy(scan_entry_t* out);
+
+// Returns true if [e] was seen within the last SCAN_CACHE_TTL_MS
+bool scan_cache_entry_fresh(scan_entry_t* e, uint32_t now);
+
+// Returns true if the cache can't answer a scan, either because the last scan
+// is older than SCAN_CACHE_TTL_MS or because the cache was invalidated
+bool scan_cache_stale(uint32_t now);
+
+// Mark that a full scan completed at [now]
+void scan_cache_scanned(uint32_t now);
+
+// Forget the network [ssid] (it was renamed, or refused a connection) and
+// force the next scan to use the radio
+void scan_cache_forget(const char* ssid);
+
+// Print every entry
+void print_scan_cache();
+
+#endif
@@ -0,0 +1,54 @@
+// C libraries
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Local
+#include "seen_set.h"
+
+_Static_assert((SEEN_SET_SIZE & (SEEN_SET_SIZE - 1)) == 0,
+               "SEEN_SET_SIZE must be a power of two");
+
+// Mix the key so that consecutive IDs spread out (splitmix64 finalizer)
+static uint32_t seen_hash(uint8_t kind, uint64_t ID)
+{
+    uint64_t x = ID ^ ((uint64_t) kind << 56);
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x = x ^ (x >> 31);
+
+    return (uint32_t) x;
+}
+
+void seen_set_clear(seen_set_t* set)
+{
+    memset(set->kinds, 0, sizeof(set->kinds));
+    set->count     = 0;
+    set->overflows = 0;
+}
+
+seen_result_t seen_set_insert(seen_set_t* set, uint8_t kind, uint64_t ID)
+{
+    uint32_t slot = seen_hash(kind, ID) & (SEEN_SET_SIZE - 1);
+
+    // Linear probing, there is always an empty slot to stop at since the set
+    // is never filled past SEEN_SET_MAX
+    while (set->kinds[slot] != 0) {
+        if (set->kinds[slot] == kind + 1 && set->IDs[slot] == ID) {
+            return SEEN_REPEAT;
+        }
+        slot = (slot + 1) & (SEEN_SET_SIZE - 1);
+    }
+
+    if (set->count >= SEEN_SET_MAX) {
+        set->overflows++;
+        return SEEN_FULL;
+    }
+
+    set->kinds[slot] = kind + 1;
+    set->IDs[slot]   = ID;
+    set->count++;
+
+    return SEEN_NEW;
+}
@@ -0,0 +1,311 @@
+// C libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Local
+#include "ssid.h"
+
+// Longest field decoded, 16 hex digits fill a uint64_t
+#define MAX_HEX_DIGITS 16
+
+// Longest decimal field, always fits in an int
+#define MAX_DEC_DIGITS 9
+
+// Value of a hex digit, -1 if [c] isn't one
+static int hex_value(uint8_t c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+// One '_' separated number, decoded as decimal and hex at the same time since
+// which one it is depends on what follows it
+typedef struct ssid_field {
+    int digits;   // Number of digits
+    bool decimal; // Only decimal digits?
+    int dec;      // Value as decimal (if [decimal])
+    uint64_t hex; // Value as hex
+} ssid_field_t;
+
+bool parse_ssid(const uint8_t* ssid, size_t len, ssid_info_t* info)
+{
+    // "picow_" or "pidog_" and at least one digit
+    if (len < 7 || ssid[0] != 'p' || ssid[1] != 'i' || ssid[5] != '_') {
+        return false;
+    }
+
+    if (ssid[2] == 'c' && ssid[3] == 'o' && ssid[4] == 'w') {
+        info->kind = SSID_PICOW;
+    } else if (ssid[2] == 'd' && ssid[3] == 'o' && ssid[4] == 'g') {
+        info->kind = SSID_PIDOG;
+    } else {
+        return false;
+    }
+
+    ssid_field_t fields[2] = {{0, true, 0, 0}, {0, true, 0, 0}};
+    int f = 0;
+
+    for (size_t i = 6; i < len && ssid[i] != '\0'; i++) {
+        uint8_t c = ssid[i];
+
+        if (c == '_') {
+            // At most two fields, neither of them empty
+            if (f == 1 || fields[0].digits == 0) {
+                return false;
+            }
+            f = 1;
+            continue;
+        }
+
+        int v = hex_value(c);
+        if (v < 0 || fields[f].digits == MAX_HEX_DIGITS) {
+            return false;
+        }
+
+        ssid_field_t* fd = &fields[f];
+        fd->digits++;
+        fd->hex = (fd->hex << 4) | (uint64_t) v;
+
+        if (v > 9 || fd->digits > MAX_DEC_DIGITS) {
+            fd->decimal = false;
+        } else {
+            fd->dec = 10 * fd->dec + v;
+        }
+    }
+
+    if (fields[f].digits == 0) {
+        return false;
+    }
+
+    // With two fields, the first one is the physical ID
+    ssid_field_t* id = &fields[f];
+    info->phys_ID    = -1;
+
+    if (f == 1) {
+        if (!fields[0].decimal) {
+            return false;
+        }
+        info->phys_ID = fields[0].dec;
+    }
+
+    if (info->kind == SSID_PICOW) {
+        if (!id->decimal) {
+            return false;
+        }
+        info->ID     = id->dec;
+        info->hex_ID = 0;
+    } else {
+        info->ID     = -1;
+        info->hex_ID = id->hex;
+    }
+
+    return true;
+}
+
+/************************************************
+ *  HOST BENCHMARK
+ ************************************************/
+
+// Build with `make ssid_bench` to compare this parser with the snprintf() +
+// strtok() parsing the scan callbacks used before, on a scan list that is
+// mostly foreign networks.
+#ifdef SSID_BENCH_MAIN
+
+#    include <stdio.h>
+#    include <stdlib.h>
+#    include <string.h>
+#    include <time.h>
+
+#    define SSID_LEN 30
+
+// Networks in the generated scan list, the most read from a file, and the
+// number of passes over the list
+#    define NUM_FOREIGN   500
+#    define NUM_OURS      8
+#    define SCAN_LIST_MAX (NUM_FOREIGN + NUM_OURS)
+#    define NUM_PASSES    20000
+
+// The old callback parsing, returns true for one of our SSIDs
+static bool legacy_parse(const char* ssid, ssid_info_t* info)
+{
+    char header[10] = "";
+    snprintf(header, 6, "%s", ssid);
+
+    bool is_pidog = (strcmp(header, "pidog") == 0);
+    bool is_picow = (strcmp(header, "picow") == 0);
+
+    if (!is_pidog && !is_picow) {
+        return false;
+    }
+
+    char tbuf[SSID_LEN];
+    snprintf(tbuf, SSID_LEN, "%s", ssid);
+
+    char* token = strtok(tbuf, "_");
+    token       = strtok(NULL, "_");
+    char* next  = strtok(NULL, "_");
+
+    info->phys_ID = -1;
+    if (next != NULL) {
+        info->phys_ID = atoi(token);
+        token         = next;
+    }
+
+    if (is_pidog) {
+        info->kind   = SSID_PIDOG;
+        info->hex_ID = strtoull(token, NULL, 16);
+    } else {
+        info->kind = SSID_PICOW;
+        info->ID   = atoi(token);
+    }
+
+    return true;
+}
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read a captured scan list, one SSID per line (e.g. the output of
+// "nmcli -t -f SSID dev wifi list"). Returns the number of SSIDs read, or -1
+// if [path] can't be opened.
+static int load_scan_list(const char* path, char list[][SSID_LEN])
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    char line[256];
+    int n = 0;
+    while (n < SCAN_LIST_MAX && fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        // Hidden networks show up as empty names
+        if (line[0] != '\0') {
+            snprintf(list[n++], SSID_LEN, "%.*s", SSID_LEN - 1, line);
+        }
+    }
+
+    fclose(f);
+    return n;
+}
+
+// Fill [list] with names seen in a crowded building, with numbered variants,
+// followed by NUM_OURS of our own SSIDs. Returns the number of SSIDs.
+static int generate_scan_list(char list[][SSID_LEN])
+{
+    const char* foreign[] = {
+        "eduroam",     "RedRover",    "xfinitywifi", "NETGEAR",
+        "DIRECT-HP",   "linksys",     "ATT-WIFI",    "Verizon_",
+        "TP-Link_",    "pico_sensor", "picnic_wifi", "pi_hole",
+        "Guest",       "MyCharter",   "Spectrum",    "DESKTOP-",
+        "iPhone",      "Galaxy_A52"};
+    const int num_names = sizeof(foreign) / sizeof(foreign[0]);
+    int n               = 0;
+
+    srand(1);
+    for (int i = 0; i < NUM_FOREIGN; i++, n++) {
+        snprintf(list[n], SSID_LEN, "%s%04X", foreign[i % num_names],
+                 rand() & 0xFFFF);
+    }
+    for (int i = 0; i < NUM_OURS; i++, n++) {
+        if (i % 4 == 0) {
+            snprintf(list[n], SSID_LEN, "picow_%d", i);
+        } else if (i % 4 == 1) {
+            snprintf(list[n], SSID_LEN, "picow_%d_%d", i + 10, i);
+        } else if (i % 4 == 2) {
+            snprintf(list[n], SSID_LEN, "pidog_E6614C311B%06X", i);
+        } else {
+            snprintf(list[n], SSID_LEN, "pidog_%d_E6614C311B%06X", i + 10, i);
+        }
+    }
+
+    return n;
+}
+
+// Usage: ssid_bench [scan list file]. Without a file the scan list is
+// generated.
+int main(int argc, char** argv)
+{
+    static char list[SCAN_LIST_MAX][SSID_LEN];
+    static size_t lens[SCAN_LIST_MAX];
+    int n;
+
+    if (argc > 1) {
+        n = load_scan_list(argv[1], list);
+        if (n < 0) {
+            printf("Couldn't open %s\n", argv[1]);
+            return 1;
+        }
+        if (n == 0) {
+            printf("No SSIDs in %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        n = generate_scan_list(list);
+    }
+    for (int i = 0; i < n; i++) {
+        lens[i] = strlen(list[i]);
+    }
+
+    // Both parsers must agree
+    int ours = 0;
+    for (int i = 0; i < n; i++) {
+        ssid_info_t a = {0}, b = {0};
+        bool ra = parse_ssid((const uint8_t*) list[i], lens[i], &a);
+        bool rb = legacy_parse(list[i], &b);
+
+        if (ra != rb
+            || (ra
+                && (a.kind != b.kind || a.phys_ID != b.phys_ID
+                    || (a.kind == SSID_PICOW ? a.ID != b.ID
+                                             : a.hex_ID != b.hex_ID)))) {
+            printf("MISMATCH: %s\n", list[i]);
+            return 1;
+        }
+        ours += ra;
+    }
+
+    ssid_info_t info;
+    volatile int matches = 0;
+
+    double t0 = now_sec();
+    for (int p = 0; p < NUM_PASSES; p++) {
+        for (int i = 0; i < n; i++) {
+            matches += legacy_parse(list[i], &info);
+        }
+    }
+    double t1 = now_sec();
+    for (int p = 0; p < NUM_PASSES; p++) {
+        for (int i = 0; i < n; i++) {
+            matches += parse_ssid((const uint8_t*) list[i], lens[i], &info);
+        }
+    }
+    double t2 = now_sec();
+
+    double per_legacy = (t1 - t0) / ((double) NUM_PASSES * n) * 1e9;
+    double per_new    = (t2 - t1) / ((double) NUM_PASSES * n) * 1e9;
+
+    printf("%d SSIDs (%d ours), %d passes\n", n, ours, NUM_PASSES);
+    printf("\tsnprintf + strtok: %7.1f ns / SSID\n", per_legacy);
+    printf("\tparse_ssid():      %7.1f ns / SSID (%.1fx)\n", per_new,
+           per_legacy / per_new);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef SSID_H
+#define SSID_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Kinds of networks hosted by our nodes
+typedef enum ssid_kind {
+    SSID_PICOW, // picow_<ID>, an initialized node
+    SSID_PIDOG  // pidog_<hex ID>, an uninitialized node
+} ssid_kind_t;
+
+// Fields decoded from one of our SSIDs. With a layout the SSIDs carry a
+// physical ID as well: picow_<phys>_<ID> and pidog_<phys>_<hex ID>.
+typedef struct ssid_info {
+    ssid_kind_t kind; // picow or pidog
+    int ID;           // Node ID (picow only, -1 for a pidog)
+    int phys_ID;      // Physical ID, -1 if the SSID doesn't have one
+    uint64_t hex_ID;  // Unique board ID (pidog only)
+} ssid_info_t;
+
+// Decode [ssid] ([len] bytes, need not be NULL terminated) in a single pass
+// without copying it. Returns false as soon as it's clear that the SSID isn't
+// one of ours, which for foreign networks is almost always the first byte.
+bool parse_ssid(const uint8_t* ssid, size_t len, ssid_info_t* info);
+
+#endif
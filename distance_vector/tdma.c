@@ -0,0 +1,219 @@
+// C libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local
+#include "tdma.h"
+
+void tdma_init(tdma_t* tdma, bool reference)
+{
+    tdma->reference = reference;
+    tdma->synced    = reference;
+    tdma->offset    = 0;
+}
+
+uint64_t tdma_net_time(const tdma_t* tdma, uint64_t local)
+{
+    return local + tdma->offset;
+}
+
+void tdma_sync(tdma_t* tdma, uint64_t local, uint64_t net)
+{
+    // The master keeps its own time
+    if (tdma->reference) {
+        return;
+    }
+
+    tdma->offset = (int64_t) (net - local);
+    tdma->synced = true;
+}
+
+int tdma_slot_owner(uint64_t net)
+{
+    return (int) ((net % TDMA_FRAME_US) / TDMA_SLOT_US);
+}
+
+bool tdma_in_window(int ID, uint64_t net)
+{
+    uint64_t into_slot = net % TDMA_SLOT_US;
+
+    return tdma_slot_owner(net) == ID && into_slot >= TDMA_GUARD_US
+           && into_slot < TDMA_GUARD_US + TDMA_WINDOW_US;
+}
+
+uint64_t tdma_next_window(int ID, uint64_t net)
+{
+    if (tdma_in_window(ID, net)) {
+        return net;
+    }
+
+    uint64_t frame_start = net - net % TDMA_FRAME_US;
+    uint64_t window      = frame_start + ID * TDMA_SLOT_US + TDMA_GUARD_US;
+
+    return window > net ? window : window + TDMA_FRAME_US;
+}
+
+bool tdma_hosting(int ID, uint64_t net)
+{
+    return tdma_slot_owner(net) == ID;
+}
+
+/************************************************
+ *  HOST SIMULATION
+ ************************************************/
+
+// Build with `make tdma_sim` to compare the rendezvous latency of the slot
+// schedule with that of nodes that host for a random 15-30 sec and then scan.
+// Usage: tdma_sim [sync error (ms)]
+#ifdef TDMA_SIM_MAIN
+
+#    include <stdio.h>
+#    include <stdlib.h>
+
+// Random hosting period, and time spent scanning and joining after it (us)
+#    define COOLDOWN_MIN 15000000ULL
+#    define COOLDOWN_MAX 30000000ULL
+#    define SCAN_US      2500000ULL
+
+// Time to join an AP and deliver a packet (us)
+#    define JOIN_US 1500000ULL
+
+#    define NUM_TRIALS 100000
+
+static uint64_t rand_range(uint64_t min, uint64_t max)
+{
+    return min + (uint64_t) ((double) rand() / RAND_MAX * (max - min));
+}
+
+// Length of [node]'s [k]th hosting period under the random scheme, the same
+// every time it's asked for (splitmix64 of the pair)
+static uint64_t random_host_us(uint64_t node, uint64_t k)
+{
+    uint64_t z = node * 0x9E3779B97F4A7C15ULL + k + 1;
+    z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z          = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z          = z ^ (z >> 31);
+
+    return COOLDOWN_MIN + z % (COOLDOWN_MAX - COOLDOWN_MIN);
+}
+
+// Under the random scheme a node alternates between hosting and scanning.
+// Returns the end of the hosting period [node] is in at [t], or the next one
+// if it's scanning, and whether it is hosting in [hosting].
+static uint64_t random_host_end(uint64_t node, uint64_t t, bool* hosting)
+{
+    uint64_t start = 0;
+
+    for (uint64_t k = 0;; k++) {
+        uint64_t host = random_host_us(node, k);
+
+        if (t < start + host) {
+            *hosting = true;
+            return start + host;
+        }
+        if (t < start + host + SCAN_US) {
+            *hosting = false;
+            return start + host + SCAN_US + random_host_us(node, k + 1);
+        }
+        start += host + SCAN_US;
+    }
+}
+
+// Latency of a rendezvous between [a] and [b], from a random time [t0]. Node
+// a scans at the end of each of its hosting periods, and reaches b if b is
+// hosting from the start of the scan until the packet is delivered.
+static uint64_t random_latency(uint64_t a, uint64_t b, uint64_t t0)
+{
+    bool hosting;
+    uint64_t t = t0;
+
+    while (true) {
+        uint64_t scan = random_host_end(a, t, &hosting);
+        uint64_t done = scan + SCAN_US + JOIN_US;
+
+        if (random_host_end(b, scan, &hosting) >= done && hosting) {
+            return done - t0;
+        }
+        t = scan + SCAN_US;
+    }
+}
+
+// Slot schedule: a node whose clock is off by [err_a] reaches node [b] at b's
+// next window by its own clock. The join succeeds if b's clock (off by
+// [err_b]) still puts it inside b's slot. Returns 0 if the clocks are too far
+// apart for the rendezvous to ever succeed.
+static uint64_t tdma_latency(int b, uint64_t t0, int64_t err_a, int64_t err_b)
+{
+    uint64_t start = tdma_next_window(b, t0 + err_a) - err_a;
+    uint64_t end   = start + JOIN_US;
+
+    if (!tdma_hosting(b, start + err_b) || !tdma_hosting(b, end + err_b)) {
+        return 0;
+    }
+
+    return end - t0;
+}
+
+static int cmp_u64(const void* x, const void* y)
+{
+    uint64_t a = *(const uint64_t*) x, b = *(const uint64_t*) y;
+    return (a > b) - (a < b);
+}
+
+// Print the mean, median, 95th percentile and maximum of [n] latencies
+static void print_stats(const char* name, uint64_t* lat, int n, int failed)
+{
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += lat[i];
+    }
+
+    qsort(lat, n, sizeof(lat[0]), cmp_u64);
+
+    printf("%-22s mean %6.2f s  p50 %6.2f s  p95 %6.2f s  max %6.2f s  "
+           "failed %d / %d\n",
+           name, n ? sum / n / 1e6 : 0, n ? lat[n / 2] / 1e6 : 0,
+           n ? lat[n * 95 / 100] / 1e6 : 0, n ? lat[n - 1] / 1e6 : 0,
+           failed, n + failed);
+}
+
+int main(int argc, char** argv)
+{
+    // Largest clock error of a node against the network time
+    int64_t max_err = 1000LL * (argc > 1 ? atoi(argv[1]) : 50);
+
+    static uint64_t lat_random[NUM_TRIALS];
+    static uint64_t lat_tdma[NUM_TRIALS];
+    int n_tdma = 0, failed_tdma = 0;
+
+    printf("%d nodes, %llu ms slots (%llu ms guard, %llu ms window), clock "
+           "error up to %lld ms\n",
+           MAX_NODES, TDMA_SLOT_US / 1000, TDMA_GUARD_US / 1000,
+           TDMA_WINDOW_US / 1000, (long long) (max_err / 1000));
+
+    for (int i = 0; i < NUM_TRIALS; i++) {
+        // Pick two distinct nodes and a time well into the run
+        srand(7919 * i + 1);
+        int a      = rand() % MAX_NODES;
+        int b      = (a + 1 + rand() % (MAX_NODES - 1)) % MAX_NODES;
+        uint64_t t = rand_range(60000000ULL, 600000000ULL);
+        int64_t ea = (int64_t) rand_range(0, 2 * max_err) - max_err;
+        int64_t eb = (int64_t) rand_range(0, 2 * max_err) - max_err;
+
+        lat_random[i] = random_latency(2 * i, 2 * i + 1, t);
+
+        uint64_t l = tdma_latency(b, t, ea, eb);
+        if (l == 0) {
+            failed_tdma++;
+        } else {
+            lat_tdma[n_tdma++] = l;
+        }
+    }
+
+    print_stats("random 15-30 s dwell:", lat_random, NUM_TRIALS, 0);
+    print_stats("slot schedule:", lat_tdma, n_tdma, failed_tdma);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef TDMA_H
+#define TDMA_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local
+#include "network_opts.h"
+
+// Rendezvous schedule. Time is cut into frames of MAX_NODES slots, and node
+// <ID> hosts its AP for the whole of slot <ID>. A node that wants to reach a
+// neighbor joins it at the start of the neighbor's slot instead of scanning
+// for it, and never leaves its own AP during its own slot.
+//
+// Slots are laid out on the network time, the master's clock. Every other
+// node follows its parent's clock, which it learns from the timestamps of the
+// packets its parent sends it (first of all the token).
+
+// Slot, frame, guard and window lengths (us)
+#define TDMA_SLOT_US   (1000ULL * TDMA_SLOT_MS)
+#define TDMA_FRAME_US  (MAX_NODES * TDMA_SLOT_US)
+#define TDMA_GUARD_US  (1000ULL * TDMA_GUARD_MS)
+#define TDMA_WINDOW_US (1000ULL * TDMA_WINDOW_MS)
+
+// Clock of one node
+typedef struct tdma {
+    bool reference; // Is my clock the network time (master)?
+    bool synced;    // Do I know the network time?
+    int64_t offset; // Network time - my time (us)
+} tdma_t;
+
+// Initialize the clock, [reference] for the master
+void tdma_init(tdma_t* tdma, bool reference);
+
+// Network time at my time [local]
+uint64_t tdma_net_time(const tdma_t* tdma, uint64_t local);
+
+// Follow a clock that reads [net] at my time [local]
+void tdma_sync(tdma_t* tdma, uint64_t local, uint64_t net);
+
+// ID of the node whose slot contains [net]
+int tdma_slot_owner(uint64_t net);
+
+// Returns true if [net] is in [ID]'s connect window, the part of its slot
+// during which its neighbors may start joining it
+bool tdma_in_window(int ID, uint64_t net);
+
+// Start of [ID]'s next connect window, [net] itself if it's in one
+uint64_t tdma_next_window(int ID, uint64_t net);
+
+// Returns true if [ID] is guaranteed to be hosting at [net]
+bool tdma_hosting(int ID, uint64_t net);
+
+#endif
@@ -0,0 +1,347 @@
+// C libraries
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Local
+#include "trace.h"
+
+const char* trace_names[NUM_TRACE_IDS] = {
+    "thread_run",     "thread_yield", "pkt_rx",     "pkt_drop",
+    "pkt_tx",         "enqueue",      "dequeue",    "scan_start",
+    "scan_end",       "conn_begin",   "conn_end",   "conn_phase",
+    "net_call_begin", "net_call_end"};
+
+const char* trace_queue_names[NUM_TRACE_QUEUES] = {"net_call", "rx", "send",
+                                                   "ack"};
+
+#ifndef TRACE_CONVERT_MAIN
+
+// Pico
+#    include "hardware/sync.h"
+#    include "pico/stdlib.h"
+
+// Local
+#    include "conn_timing.h"
+#    include "net_core.h"
+
+// Threads that can be named, the scheduler's MAX_THREADS
+#    define TRACE_MAX_THREADS 10
+
+// One ring per core, so the cores never contend. [head] counts every event
+// ever recorded, the ring holds the last TRACE_RING_SIZE of them.
+static struct {
+    uint32_t head;
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_rings[2];
+
+// Thread being run on each core
+static uint8_t trace_thread[2] = {TRACE_NO_THREAD, TRACE_NO_THREAD};
+
+static char thread_names[TRACE_MAX_THREADS][TRACE_NAME_LEN];
+
+// Set during a dump
+static volatile bool trace_paused = false;
+
+void trace_event(trace_id_t id, uint32_t a0, uint32_t a1)
+{
+    if (trace_paused) {
+        return;
+    }
+
+    uint core = get_core_num();
+
+    // Keep interrupts on this core from recording into the same slot
+    uint32_t save = save_and_disable_interrupts();
+
+    uint8_t thread = __get_current_exception() ? TRACE_IRQ : trace_thread[core];
+    uint32_t slot  = trace_rings[core].head % TRACE_RING_SIZE;
+
+    trace_event_t* e = &trace_rings[core].events[slot];
+    e->time_us       = time_us_32();
+    e->core          = core;
+    e->thread        = thread;
+    e->id            = id;
+    e->arg0          = a0;
+    e->arg1          = a1;
+
+    trace_rings[core].head++;
+
+    restore_interrupts(save);
+}
+
+void trace_thread_run(int num)
+{
+    trace_thread[get_core_num()] = num;
+    trace_event(TR_THREAD_RUN, num, 0);
+}
+
+void trace_thread_yield(int num)
+{
+    trace_event(TR_THREAD_YIELD, num, 0);
+    trace_thread[get_core_num()] = TRACE_NO_THREAD;
+}
+
+void trace_name_thread(int num, const char* name)
+{
+    if (num >= 0 && num < TRACE_MAX_THREADS) {
+        snprintf(thread_names[num], TRACE_NAME_LEN, "%s", name);
+    }
+}
+
+// Dump format, one record per line:
+//      TRACE BEGIN
+//      N <thread> <name>                           Thread names
+//      P <phase> <name>                            conn_phase_t names
+//      O <op> <name>                               net_op_t names
+//      T <core> <time> <thread> <id> <a0> <a1>     Events, oldest first
+//      TRACE END <events> <overwritten>
+void trace_dump()
+{
+    trace_paused = true;
+
+    printf("TRACE BEGIN\n");
+
+    for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+        if (thread_names[i][0] != '\0') {
+            printf("N %d %s\n", i, thread_names[i]);
+        }
+    }
+    for (int i = 0; i < NUM_CONN_PHASES; i++) {
+        printf("P %d %s\n", i, conn_phase_name(i));
+    }
+    for (int i = 0; i < NUM_NET_OPS; i++) {
+        printf("O %d %s\n", i, net_op_name(i));
+    }
+
+    uint32_t total = 0, lost = 0;
+
+    for (int core = 0; core < 2; core++) {
+        uint32_t head  = trace_rings[core].head;
+        uint32_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+        for (uint32_t i = first; i < head; i++) {
+            trace_event_t* e = &trace_rings[core].events[i % TRACE_RING_SIZE];
+            printf("T %u %u %u %u %u %u\n", e->core, (unsigned int) e->time_us,
+                   e->thread, e->id, (unsigned int) e->arg0,
+                   (unsigned int) e->arg1);
+        }
+
+        total += head - first;
+        lost  += first;
+    }
+
+    printf("TRACE END %u %u\n", (unsigned int) total, (unsigned int) lost);
+
+    trace_paused = false;
+}
+
+void trace_clear()
+{
+    trace_paused = true;
+
+    trace_rings[0].head = 0;
+    trace_rings[1].head = 0;
+
+    trace_paused = false;
+}
+
+#else
+
+/************************************************
+ *  HOST CONVERTER
+ ************************************************/
+
+// Build with `make trace_convert`. Reads a serial capture holding a "trace"
+// dump on stdin and writes a Chrome trace (JSON) to stdout. Lines outside of
+// the dump are skipped.
+//
+// Each core is a process and each protothread a thread of it. The connect
+// thread's passes, their phases and the scans get a process of their own,
+// since they span several threads (and both cores with NETWORK_ON_CORE1).
+
+#    include <stdlib.h>
+
+#    define MAX_NAMES  32
+#    define LINE_LEN   256
+#    define PID_CONN   2
+#    define TID_PASSES 0
+#    define TID_PHASES 1
+#    define TID_SCANS  2
+
+static char thread_names[MAX_NAMES][LINE_LEN];
+static char phase_names[MAX_NAMES][LINE_LEN];
+static char op_names[MAX_NAMES][LINE_LEN];
+
+static bool first_event = true;
+
+static const char* name_of(char names[][LINE_LEN], uint32_t i,
+                           const char* fallback)
+{
+    static char buf[LINE_LEN];
+
+    if (i < MAX_NAMES && names[i][0] != '\0') {
+        return names[i];
+    }
+    snprintf(buf, sizeof(buf), "%s %u", fallback, (unsigned int) i);
+    return buf;
+}
+
+// Start a JSON event, the caller adds the remaining fields and the "}"
+static void event_head(const char* name, const char* ph, int pid, int tid,
+                       uint64_t ts)
+{
+    printf("%s\n  {\"name\": \"%s\", \"ph\": \"%s\", \"pid\": %d, "
+           "\"tid\": %d, \"ts\": %llu",
+           first_event ? "" : ",", name, ph, pid, tid,
+           (unsigned long long) ts);
+    first_event = false;
+}
+
+static void metadata(const char* kind, int pid, int tid, const char* name)
+{
+    event_head(kind, "M", pid, tid, 0);
+    printf(", \"args\": {\"name\": \"%s\"}}", name);
+}
+
+static void convert(const trace_event_t* e, uint64_t ts)
+{
+    const char* thread = name_of(thread_names, e->thread, "thread");
+    int pid            = e->core;
+    int tid            = e->thread;
+
+    switch (e->id) {
+    case TR_THREAD_RUN:
+        event_head(thread, "B", pid, tid, ts);
+        printf("}");
+        break;
+    case TR_THREAD_YIELD:
+        event_head(thread, "E", pid, tid, ts);
+        printf("}");
+        break;
+    case TR_PKT_RX:
+    case TR_PKT_DROP:
+    case TR_PKT_TX:
+        event_head(trace_names[e->id], "i", pid, tid, ts);
+        printf(", \"s\": \"t\", \"args\": {\"bytes\": %u, \"%s\": %d}}",
+               (unsigned int) e->arg0, e->id == TR_PKT_TX ? "err" : "depth",
+               (int) e->arg1);
+        break;
+    case TR_ENQUEUE:
+    case TR_DEQUEUE: {
+        const char* queue = e->arg0 < NUM_TRACE_QUEUES
+                              ? trace_queue_names[e->arg0]
+                              : "unknown";
+        event_head(trace_names[e->id], "i", pid, tid, ts);
+        printf(", \"s\": \"t\", \"args\": {\"queue\": \"%s\"}}", queue);
+        event_head(queue, "C", pid, tid, ts);
+        printf(", \"args\": {\"depth\": %u}}", (unsigned int) e->arg1);
+        break;
+    }
+    case TR_SCAN_START:
+        event_head(e->arg0 == 0 ? "nbr_find_scan" : "dv_route_scan", "B",
+                   PID_CONN, TID_SCANS, ts);
+        printf(", \"args\": {\"filtered\": %u}}", (unsigned int) e->arg1);
+        break;
+    case TR_SCAN_END:
+        event_head("scan", "E", PID_CONN, TID_SCANS, ts);
+        printf(", \"args\": {\"cached\": %u}}", (unsigned int) e->arg1);
+        break;
+    case TR_CONN_BEGIN:
+        event_head("connect", "B", PID_CONN, TID_PASSES, ts);
+        printf(", \"args\": {\"target\": %d}}", (int) e->arg0);
+        break;
+    case TR_CONN_END:
+        event_head("connect", "E", PID_CONN, TID_PASSES, ts);
+        printf(", \"args\": {\"err\": %d}}", (int) e->arg0);
+        break;
+    case TR_CONN_PHASE:
+        // Recorded at the end of the phase
+        event_head(name_of(phase_names, e->arg0, "phase"), "X", PID_CONN,
+                   TID_PHASES, ts - e->arg1);
+        printf(", \"dur\": %u}", (unsigned int) e->arg1);
+        break;
+    case TR_NET_CALL_BEGIN:
+        event_head(name_of(op_names, e->arg0, "op"), "B", pid, tid, ts);
+        printf("}");
+        break;
+    case TR_NET_CALL_END:
+        event_head(name_of(op_names, e->arg0, "op"), "E", pid, tid, ts);
+        printf(", \"args\": {\"result\": %d}}", (int) e->arg1);
+        break;
+    }
+}
+
+int main()
+{
+    char line[LINE_LEN];
+    char name[LINE_LEN];
+    bool in_dump = false;
+
+    // Timestamps are 32-bit, unwrapped per core (each ring is in order)
+    uint32_t last[2] = {0, 0};
+    uint64_t high[2] = {0, 0};
+
+    printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+    metadata("process_name", 0, 0, "core 0");
+    metadata("process_name", 1, 0, "core 1");
+    metadata("process_name", PID_CONN, 0, "connections");
+    metadata("thread_name", PID_CONN, TID_PASSES, "connect passes");
+    metadata("thread_name", PID_CONN, TID_PHASES, "phases");
+    metadata("thread_name", PID_CONN, TID_SCANS, "scans");
+    for (int core = 0; core < 2; core++) {
+        metadata("thread_name", core, TRACE_NO_THREAD,
+                 core == 0 ? "main" : "network loop");
+        metadata("thread_name", core, TRACE_IRQ, "irq");
+    }
+
+    int events = 0;
+
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        unsigned int v[6];
+
+        if (strncmp(line, "TRACE BEGIN", 11) == 0) {
+            in_dump = true;
+        } else if (strncmp(line, "TRACE END", 9) == 0) {
+            in_dump = false;
+        } else if (!in_dump) {
+            continue;
+        } else if (sscanf(line, "N %u %255s", &v[0], name) == 2
+                   && v[0] < MAX_NAMES) {
+            snprintf(thread_names[v[0]], LINE_LEN, "%s", name);
+            for (int core = 0; core < 2; core++) {
+                metadata("thread_name", core, v[0], name);
+            }
+        } else if (sscanf(line, "P %u %255s", &v[0], name) == 2
+                   && v[0] < MAX_NAMES) {
+            snprintf(phase_names[v[0]], LINE_LEN, "%s", name);
+        } else if (sscanf(line, "O %u %255s", &v[0], name) == 2
+                   && v[0] < MAX_NAMES) {
+            snprintf(op_names[v[0]], LINE_LEN, "%s", name);
+        } else if (sscanf(line, "T %u %u %u %u %u %u", &v[0], &v[1], &v[2],
+                          &v[3], &v[4], &v[5])
+                       == 6
+                   && v[0] < 2 && v[3] < NUM_TRACE_IDS) {
+            trace_event_t e = {v[1],          (uint8_t) v[0], (uint8_t) v[2],
+                               (uint16_t) v[3], v[4],           v[5]};
+
+            if (e.time_us < last[e.core]) {
+                high[e.core] += 1ULL << 32;
+            }
+            last[e.core] = e.time_us;
+
+            convert(&e, high[e.core] + e.time_us);
+            events++;
+        }
+    }
+
+    printf("\n]}\n");
+
+    fprintf(stderr, "%d events converted\n", events);
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local
+#include "network_opts.h"
+
+// Event trace (with TRACE_EVENTS). TRACE() records a fixed-size event into a
+// RAM ring, one ring per core, overwriting the oldest events once it's full.
+// Recording only disables interrupts on its own core for the copy, so it's
+// cheap enough for the packet path, the scheduler and the lwIP callbacks.
+//
+// The "trace" console command dumps the rings as text. Build the converter
+// with `make trace_convert` and run `./trace_convert < capture.txt >
+// trace.json` on a serial capture to get a Chrome trace, which opens in
+// chrome://tracing or ui.perfetto.dev.
+
+// Events per core
+#define TRACE_RING_SIZE 256
+
+// Longest thread name
+#define TRACE_NAME_LEN 16
+
+// Thread field of events recorded outside of a protothread
+#define TRACE_NO_THREAD 0xFF // main(), or the network core's loop
+#define TRACE_IRQ       0xFE // An interrupt handler
+
+// Events, and what their arguments hold
+typedef enum trace_id {
+    TR_THREAD_RUN,     // Scheduler runs a thread   -
+    TR_THREAD_YIELD,   // The thread returned       -
+    TR_PKT_RX,         // Packet received           bytes, rx queue depth
+    TR_PKT_DROP,       // Packet dropped            bytes, rx queue depth
+    TR_PKT_TX,         // Packet sent               bytes, lwIP error
+    TR_ENQUEUE,        // Item queued               trace_queue_t, depth
+    TR_DEQUEUE,        // Item taken                trace_queue_t, depth
+    TR_SCAN_START,     // Scan started              scan_type_t, filtered
+    TR_SCAN_END,       // Scan results published    scan_type_t, cached
+    TR_CONN_BEGIN,     // Connect thread pass       target ID
+    TR_CONN_END,       // End of the pass           error code
+    TR_CONN_PHASE,     // End of a phase            conn_phase_t, duration (us)
+    TR_NET_CALL_BEGIN, // Network core call         net_op_t
+    TR_NET_CALL_END,   // End of the call           net_op_t, result
+    NUM_TRACE_IDS
+} trace_id_t;
+
+// Queues named by TR_ENQUEUE and TR_DEQUEUE
+typedef enum trace_queue {
+    TRQ_NET_CALL, // Calls to the network core
+    TRQ_RX,       // Received packets
+    TRQ_SEND,     // send_queue
+    TRQ_ACK,      // ack_queue
+    NUM_TRACE_QUEUES
+} trace_queue_t;
+
+// One event, 16 bytes
+typedef struct trace_event {
+    uint32_t time_us; // time_us_32()
+    uint8_t core;     // Core it was recorded on
+    uint8_t thread;   // Protothread number, or TRACE_NO_THREAD / TRACE_IRQ
+    uint16_t id;      // trace_id_t
+    uint32_t arg0;
+    uint32_t arg1;
+} trace_event_t;
+
+extern const char* trace_names[NUM_TRACE_IDS];
+extern const char* trace_queue_names[NUM_TRACE_QUEUES];
+
+#if TRACE_EVENTS
+#    define TRACE(id, a0, a1)                                                  \
+        trace_event(id, (uint32_t) (a0), (uint32_t) (a1))
+#    define TRACE_NAME_THREAD(num, name) trace_name_thread(num, name)
+#else
+#    define TRACE(id, a0, a1)            ((void) 0)
+#    define TRACE_NAME_THREAD(num, name) ((void) 0)
+#endif
+
+// Record an event, use TRACE()
+void trace_event(trace_id_t id, uint32_t a0, uint32_t a1);
+
+// Scheduler hooks, called around every run of thread [num]
+void trace_thread_run(int num);
+void trace_thread_yield(int num);
+
+// Label thread [num] of core 0 in dumps, use TRACE_NAME_THREAD()
+void trace_name_thread(int num, const char* name);
+
+// Print the rings, oldest events first. Recording pauses during the dump.
+void trace_dump();
+
+// Forget every event
+void trace_clear();
+
+#endif
@@ -0,0 +1,83 @@
+// C libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local
+#include "trickle.h"
+#include "utils.h"
+
+// Start a new interval of length [tr->i] at time [now]
+static void trickle_new_interval(trickle_t* tr, uint64_t now)
+{
+    tr->i_start = now;
+    tr->t       = now + rand_uint64(tr->i / 2, tr->i);
+    tr->c       = 0;
+    tr->fired   = false;
+}
+
+void trickle_init(trickle_t* tr, uint64_t i_min, unsigned int doublings,
+                  unsigned int k)
+{
+    tr->i_min = i_min;
+    tr->i_max = i_min << doublings;
+    tr->k     = k;
+
+    tr->i       = i_min;
+    tr->i_start = 0;
+    tr->t       = UINT64_MAX;
+    tr->c       = 0;
+
+    tr->running = false;
+    tr->fired   = false;
+}
+
+void trickle_reset(trickle_t* tr, uint64_t now)
+{
+    // Per RFC 6206, an inconsistency heard while already at the minimum
+    // interval does not restart the interval. This stops a burst of updates
+    // from pushing the transmission back indefinitely.
+    if (tr->running && tr->i == tr->i_min) {
+        return;
+    }
+
+    tr->i       = tr->i_min;
+    tr->running = true;
+    trickle_new_interval(tr, now);
+}
+
+void trickle_consistent(trickle_t* tr)
+{
+    tr->c++;
+}
+
+trickle_event_t trickle_poll(trickle_t* tr, uint64_t now)
+{
+    if (!tr->running) {
+        return TRICKLE_IDLE;
+    }
+
+    // Reached [t], decide whether to transmit. This is checked before the end
+    // of the interval so that a late poll never skips a transmission.
+    if (!tr->fired && now >= tr->t) {
+        tr->fired = true;
+
+        return (tr->c < tr->k) ? TRICKLE_TRANSMIT : TRICKLE_SUPPRESS;
+    }
+
+    // Interval expired, double it (up to the max) and start a new one
+    if (now >= tr->i_start + tr->i) {
+        tr->i = (2 * tr->i > tr->i_max) ? tr->i_max : 2 * tr->i;
+        trickle_new_interval(tr, now);
+    }
+
+    return TRICKLE_IDLE;
+}
+
+uint64_t trickle_next_event(trickle_t* tr)
+{
+    if (!tr->running) {
+        return UINT64_MAX;
+    }
+
+    return tr->fired ? tr->i_start + tr->i : tr->t;
+}
@@ -0,0 +1,51 @@
+#ifndef TRICKLE_H
+#define TRICKLE_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Trickle timer (RFC 6206). The interval doubles every time it expires while
+// the network is consistent, and shrinks back to the minimum as soon as an
+// inconsistency is detected. A node only transmits at time [t] if it has heard
+// fewer than [k] consistent transmissions during the current interval.
+typedef struct trickle {
+    uint64_t i_min; // Minimum interval length (us)
+    uint64_t i_max; // Maximum interval length (us)
+    unsigned int k; // Redundancy constant
+
+    uint64_t i;       // Current interval length (us)
+    uint64_t i_start; // Time the current interval started
+    uint64_t t;       // Time to transmit during the current interval
+    unsigned int c;   // Consistent transmissions heard this interval
+
+    bool running; // Has the timer been started?
+    bool fired;   // Has [t] already passed during this interval?
+} trickle_t;
+
+// Result of polling a trickle timer
+typedef enum trickle_event {
+    TRICKLE_IDLE,     // Nothing to do yet
+    TRICKLE_TRANSMIT, // Reached [t] and should transmit
+    TRICKLE_SUPPRESS  // Reached [t] but enough consistent messages were heard
+} trickle_event_t;
+
+// Initialize a stopped trickle timer. The maximum interval is [i_min] doubled
+// [doublings] times.
+void trickle_init(trickle_t* tr, uint64_t i_min, unsigned int doublings,
+                  unsigned int k);
+
+// Report an inconsistency, restarts the timer at the minimum interval
+void trickle_reset(trickle_t* tr, uint64_t now);
+
+// Report that a consistent transmission was heard
+void trickle_consistent(trickle_t* tr);
+
+// Advance the timer to [now], returns what the caller should do
+trickle_event_t trickle_poll(trickle_t* tr, uint64_t now);
+
+// Time of the next event (transmission or end of interval), UINT64_MAX if the
+// timer is stopped
+uint64_t trickle_next_event(trickle_t* tr);
+
+#endif
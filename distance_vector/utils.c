@@ -1,6 +1,7 @@
 
 // C libraries
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,6 +9,7 @@
 // Pico
 #include "boards/pico_w.h"
 #include "pico/cyw43_arch.h"
+#include "pico/rand.h"
 #include "pico/stdlib.h"
 
 // Local
@@ -23,6 +25,17 @@ void led_off()
     cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, LOW);
 }
 
+uint32_t time_ms_32()
+{
+    return (uint32_t) (time_us_64() / 1000);
+}
+
+uint64_t rand_uint64(uint64_t min, uint64_t max)
+{
+    float rand = (float) (get_rand_32()) / UINT32_MAX;
+    return (uint64_t) (min + (max - min) * rand);
+}
+
 void sleep_ms_progress_bar(unsigned int bar_ms, unsigned int bar_len)
 {
     // Bar length and dot interval
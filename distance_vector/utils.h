@@ -1,6 +1,9 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+// C Libraries
+#include <stdint.h>
+
 // LED on/off
 #define HIGH 1
 #define LOW  0
@@ -34,6 +37,13 @@
 void led_on();
 void led_off();
 
+// Milliseconds since boot as a 32-bit relative timestamp (wraps after 49 days,
+// compare timestamps by subtracting them)
+uint32_t time_ms_32();
+
+// Generate a random uint64_t in the range [min, max]
+uint64_t rand_uint64(uint64_t min, uint64_t max);
+
 // Sleep and animate a progress bar
 void sleep_ms_progress_bar(unsigned int bar_ms, unsigned int bar_len);
 
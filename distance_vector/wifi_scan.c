@@ -1,16 +1,26 @@
 
 // C libraries
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 // Pico
+#include "hardware/sync.h"
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
 
 // Local
+#include "distance_vector.h"
+#include "emulate.h"
 #include "layout.h"
+#include "scan_cache.h"
+#include "seen_set.h"
+#include "ssid.h"
+#include "trace.h"
+#include "utils.h"
 #include "wifi_scan.h"
 
 bool pidogs_found;
@@ -19,101 +29,62 @@ char nbr_find_scan_result[SSID_LEN];
 
 nbr_t* routing_scan_result;
 
-// Track unique SSIDs during a scan
-int num_unique_results = 0;
-uint64_t unique_results[MAX_NODES];
+int routing_scan_score;
 
-// Returns true if the specified ID has not been encountered during this scan
-bool id_is_not_a_repeat(uint64_t id)
-{
-    for (int i = 0; i < num_unique_results; i++) {
-        if (unique_results[i] == id) {
-            // Match found
-            return false;
-        }
-    }
+scan_status_t scan_status = {.done = true};
 
-    return true;
-}
+// Set by the network core once the radio has finished (or the scan was
+// answered from the cache, or failed to start). Core 0 publishes the results
+// when it sees it.
+static volatile bool scan_radio_done = false;
+
+// Nodes seen during the current scan, so each one is only printed once
+static seen_set_t seen_nodes;
+
+// The results are decided on core 0 from a copy of the cache, the scan
+// callbacks may be filling it on the network core meanwhile
+static scan_entry_t cache_copy[SCAN_CACHE_SIZE];
 
 // Scan callback function for neighbor finding
 static int nbr_finding_scan_callback(void* env,
                                      const cyw43_ev_scan_result_t* result)
 {
-    if (result) {
-        // Get first 5 characters of the SSID
-        char header[10] = "";
-        snprintf(header, 6, "%s", result->ssid);
+    ssid_info_t info;
 
-        // Set flags
-        bool result_is_pidog = (strcmp(header, "pidog") == 0);
-        bool result_is_picow = (strcmp(header, "picow") == 0);
-        bool is_visible      = true;
-
-        if (result_is_pidog || result_is_picow) {
-            // Create a token buffer (strtok is destructive)
-            char tbuf[SSID_LEN];
-            snprintf(tbuf, SSID_LEN, "%s", result->ssid);
+    // Break out of the function if the result is null or not one of ours
+    if (result == NULL
+        || !parse_ssid(result->ssid, result->ssid_len, &info)) {
+        return 0;
+    }
 
-            // Separate the header
-            char* token;
-            token = strtok(tbuf, "_");
+    int rssi = result->rssi;
 
 #ifdef USE_LAYOUT
-            // Parse the extra physical ID out of the middle
-            token              = strtok(NULL, "_");
-            int result_phys_ID = atoi(token);
+    // Use the emulated topology to determine if this node is actually visible
+    if (!emu_scan_visible(self.physical_ID, info.phys_ID)) {
+        return 0;
+    }
 
-            // Use the network connections list to determine if this node is
-            // actually visible
-            is_visible = conn_array[self.physical_ID][result_phys_ID];
+    // Emulated link quality
+    rssi = emu_rssi(self.physical_ID, info.phys_ID, rssi);
 #endif
 
-            // Get the ID - <ID> if picow_<ID> / <hex ID> if pidog_<hex ID>
-            token = strtok(NULL, "_");
-
-            if (result_is_pidog && is_visible) {
-                // Convert the hexadecimal ID to a uint64_t
-                uint64_t id = strtoull(token, NULL, 16);
-
-                if (id_is_not_a_repeat(id)) {
-                    // Log unique result
-                    unique_results[num_unique_results] = id;
-                    num_unique_results++;
-
-                    // Write SSID to scan_result
-                    snprintf(nbr_find_scan_result, SSID_LEN, "%s",
-                             result->ssid);
-
-                    printf("\tssid: %-*s rssi: %4d dB  <-- New node\n",
-                           SSID_LEN, result->ssid, result->rssi);
-                }
-
-            } else if (result_is_picow && is_visible) {
-                // Convert the decimal ID to an integer
-                int id = atoi(token);
-
-                if (id_is_not_a_repeat(id)) {
-                    // Log unique result
-                    unique_results[num_unique_results] = id;
-                    num_unique_results++;
-
-                    printf("\tssid: %-*s rssi: %4d dB  <-- ID = %d\n", SSID_LEN,
-                           result->ssid, result->rssi, id);
-                }
-
-                // Mark as neighbor
-                self.ID_is_nbr[id] = true;
+    if (info.kind == SSID_PIDOG) {
+        if (seen_set_insert(&seen_nodes, info.kind, info.hex_ID)
+            != SEEN_REPEAT) {
+            printf("\tssid: %-*s rssi: %4d dB  <-- New node\n", SSID_LEN,
+                   result->ssid, rssi);
+        }
 
-#ifdef USE_LAYOUT
-                // Store the physical ID corresponding to the ID assigned by the
-                // neighbor finding process
-                ID_to_phys_ID[id] = result_phys_ID;
-#endif
-            }
+    } else {
+        if (seen_set_insert(&seen_nodes, info.kind, info.ID) != SEEN_REPEAT) {
+            printf("\tssid: %-*s rssi: %4d dB  <-- ID = %d\n", SSID_LEN,
+                   result->ssid, rssi, info.ID);
         }
     }
 
+    scan_cache_update(result, info.kind, info.ID, info.phys_ID, rssi);
+
     return 0;
 }
 
@@ -121,93 +92,230 @@ static int nbr_finding_scan_callback(void* env,
 static int vector_routing_scan_callback(void* env,
                                         const cyw43_ev_scan_result_t* result)
 {
-    // Break out of the function if the result is null
-    if (result == NULL) {
+    ssid_info_t info;
+
+    // Break out of the function if the result is null or not a picow network
+    if (result == NULL || !parse_ssid(result->ssid, result->ssid_len, &info)
+        || info.kind != SSID_PICOW) {
         return 0;
     }
 
-    // Get first 5 characters of the SSID
-    char header[10] = "";
-    snprintf(header, 6, "%s", result->ssid);
+    int rssi = result->rssi;
 
-    // Set flags
-    bool result_is_picow = (strcmp(header, "picow") == 0);
-    bool is_visible      = true;
+#ifdef USE_LAYOUT
+    // Use the emulated topology to determine if this node is actually visible
+    if (!emu_scan_visible(self.physical_ID, info.phys_ID)) {
+        return 0;
+    }
+
+    // Emulated link quality
+    rssi = emu_rssi(self.physical_ID, info.phys_ID, rssi);
+#endif
 
-    // Break out of the function if the result is not a picow network
-    if (!result_is_picow) {
+    // Break out of the function if the ID is out of range
+    if (info.ID < 0 || info.ID >= MAX_NODES) {
         return 0;
     }
 
-    // Create a token buffer (strtok is destructive)
-    char tbuf[SSID_LEN];
-    snprintf(tbuf, SSID_LEN, "%s", result->ssid);
+    scan_cache_update(result, SSID_PICOW, info.ID, info.phys_ID, rssi);
 
-    // Separate the header
-    char* token;
-    token = strtok(tbuf, "_");
+    return 0;
+}
 
-#ifdef USE_LAYOUT
-    // Parse the extra physical ID out of the middle
-    token              = strtok(NULL, "_");
-    int result_phys_ID = atoi(token);
+// Pick the neighbor finding result from the cached networks
+static void nbr_find_decide(uint32_t now)
+{
+    int best_rssi = INT32_MIN;
 
-    // Use the network connections list to determine if this node is
-    // actually visible
-    is_visible = conn_array[self.physical_ID][result_phys_ID];
+    for (int i = 0; i < SCAN_CACHE_SIZE; i++) {
+        scan_entry_t* e = &cache_copy[i];
 
-    // Break out of the function if the result is not visible
-    if (is_visible == false) {
-        return 0;
-    }
-#endif
+        if (!scan_cache_entry_fresh(e, now)) {
+            continue;
+        }
 
-    // Get the ID - <ID> if picow_<ID> / <hex ID> if pidog_<hex ID>
-    token = strtok(NULL, "_");
+        if (e->kind == SSID_PIDOG) {
+            // Hand the token to the strongest pidog
+            if (e->rssi > best_rssi) {
+                snprintf(nbr_find_scan_result, SSID_LEN, "%s", e->ssid);
+                best_rssi = e->rssi;
+            }
+
+        } else if (e->kind == SSID_PICOW && e->ID >= 0 && e->ID < MAX_NODES) {
+            // Mark as neighbor
+            set_nbr(&self, e->ID);
+
+#ifdef USE_LAYOUT
+            // Store the physical ID corresponding to the ID assigned by the
+            // neighbor finding process
+            ID_to_phys_ID[e->ID] = e->phys_ID;
+#endif
+        }
+    }
+}
 
-    // Convert the decimal ID to an integer
-    int id = atoi(token);
+// Pick the neighbor which most needs my distance vector from the cached
+// networks
+static void dv_route_decide(uint32_t now)
+{
+    for (int i = 0; i < SCAN_CACHE_SIZE; i++) {
+        scan_entry_t* e = &cache_copy[i];
 
-    if (id_is_not_a_repeat(id)) {
-        // Log unique result
-        unique_results[num_unique_results] = id;
-        num_unique_results++;
+        // Skip anything that isn't one of my neighbors
+        if (!scan_cache_entry_fresh(e, now) || e->kind != SSID_PICOW
+            || e->ID < 0 || e->ID >= MAX_NODES || self.nbrs[e->ID] == NULL) {
+            continue;
+        }
 
-        nbr_t* nb = self.nbrs[id];
+        nbr_t* nb = self.nbrs[e->ID];
+        nb->rssi  = e->rssi;
 
         if (nb->up_to_date == true) {
-            printf("\tssid: %-*s Last contact: %4.1fs\n", SSID_LEN,
-                   result->ssid, (nb->last_contact) / 1e6);
+            printf("\tssid: %-*s Last contact: %4.1fs\n", SSID_LEN, e->ssid,
+                   (nb->last_contact) / 1e3);
         } else {
-            printf("\tssid: %-*s Last contact: %4.1fs  <-- Needs my DV\n",
-                   SSID_LEN, result->ssid, (nb->last_contact) / 1e6);
+            int score = nbr_score_fn(&self, nb, now);
+
+            printf("\tssid: %-*s Last contact: %4.1fs  <-- Needs my DV "
+                   "(score %d)\n",
+                   SSID_LEN, e->ssid, (nb->last_contact) / 1e3, score);
 
             // Update "neediest" neighbor
-            if (nb->last_contact < routing_scan_result->last_contact) {
+            if (routing_scan_result == NULL || score > routing_scan_score) {
                 routing_scan_result = nb;
+                routing_scan_score  = score;
             }
         }
     }
-
-    return 0;
 }
 
-int scan_wifi(scan_type_t t)
+// Publish the results of a finished scan
+static void scan_wifi_finish()
 {
-    // Scan options don't matter
-    cyw43_wifi_scan_options_t scan_options = {0};
-
     // Clear last scan result
     snprintf(nbr_find_scan_result, SSID_LEN, "%s", NO_UNINITIALIZED_NBRS);
     routing_scan_result = NULL;
+    routing_scan_score  = 0;
+
+    scan_status.done     = true;
+    scan_status.end_time = time_us_64();
+
+    // Complete with no results
+    if (scan_status.err != 0) {
+        TRACE(TR_SCAN_END, scan_status.type, false);
+        return;
+    }
 
-    // Reset list of seen IDs
-    num_unique_results = 0;
-    for (int i = 0; i < MAX_NODES; i++) {
-        unique_results[i] = 0;
+    TRACE(TR_SCAN_END, scan_status.type, scan_status.cached);
+
+    uint32_t now = time_ms_32();
+    if (!scan_status.cached && !scan_status.filtered) {
+        scan_cache_scanned(now);
+    }
+    scan_cache_copy(cache_copy);
+
+    printf("\t%*c...\n", 4, ' ');
+    if (seen_nodes.overflows > 0) {
+        printf("\t(%d more nodes than the scan can track, some may be "
+               "printed twice)\n",
+               seen_nodes.overflows);
+    }
+    if (scan_status.type == NBR_FIND_SCAN) {
+        nbr_find_decide(now);
+
+        // Mark whether any pidogs (uninitialized nodes) were found
+        if (strcmp(nbr_find_scan_result, NO_UNINITIALIZED_NBRS) == 0) {
+            pidogs_found = false;
+        } else {
+            pidogs_found = true;
+        };
+
+        // Print the strongest pidog found
+        printf("\tscan result: %-30s\n", nbr_find_scan_result);
+    } else if (scan_status.type == DV_ROUTE_SCAN) {
+        dv_route_decide(now);
+
+        if (routing_scan_result != NULL) {
+            printf("\tscan result: Node #%d\n", routing_scan_result->ID);
+        } else {
+            printf("\tscan result: No un-updated nbrs are hosting APs\n");
+        }
+    }
+    printf("\tscan time:   %.2f sec\n",
+           (float) (scan_status.end_time - scan_status.start_time) / 1e6);
+}
+
+void scan_options_init(cyw43_wifi_scan_options_t* opts,
+                       const scan_filter_t* filter)
+{
+    memset(opts, 0, sizeof(*opts));
+
+    if (filter == NULL) {
+        return;
+    }
+
+    if (filter->ssid != NULL) {
+        size_t len = strlen(filter->ssid);
+        if (len > sizeof(opts->ssid)) {
+            len = sizeof(opts->ssid);
+        }
+
+        opts->ssid_len = len;
+        memcpy(opts->ssid, filter->ssid, len);
+    }
+
+    // 0 = active, 1 = passive
+    opts->scan_type = filter->passive ? 1 : 0;
+}
+
+int scan_wifi_start(scan_type_t t)
+{
+    return scan_wifi_start_filtered(t, NULL);
+}
+
+int scan_wifi_start_filtered(scan_type_t t, const scan_filter_t* filter)
+{
+    cyw43_wifi_scan_options_t scan_options;
+    scan_options_init(&scan_options, filter);
+
+    bool filtered = (filter != NULL && filter->ssid != NULL);
+
+    // Reset the set of seen nodes
+    seen_set_clear(&seen_nodes);
+
+    // Reset the completion record
+    scan_radio_done        = false;
+    scan_status.type       = t;
+    scan_status.active     = false;
+    scan_status.done       = false;
+    scan_status.cached     = false;
+    scan_status.filtered   = filtered;
+    scan_status.err        = 0;
+    scan_status.start_time = time_us_64();
+    scan_status.end_time   = 0;
+
+    TRACE(TR_SCAN_START, t, filtered);
+
+    // Answer from the cache if the last scan (or the last sighting of the
+    // filtered SSID) is recent enough
+    uint32_t now = time_ms_32();
+    scan_entry_t e;
+
+    if (filtered ? (scan_cache_find(filter->ssid, &e)
+                    && scan_cache_entry_fresh(&e, now))
+                 : !scan_cache_stale(now)) {
+        printf("Using cached scan results\n");
+        scan_status.cached = true;
+        __dmb();
+        scan_radio_done = true;
+        return 0;
+    }
+
+    int err = 0;
+    if (filtered) {
+        printf("Looking for %s. ", filter->ssid);
     }
 
-    int err;
     if (t == NBR_FIND_SCAN) {
         printf("Starting neighbor finding scan...");
         err = cyw43_wifi_scan(&cyw43_state, &scan_options, NULL,
@@ -220,36 +328,72 @@ int scan_wifi(scan_type_t t)
 
     if (err == 0) {
         printf("success!\n");
+        scan_status.active = true;
     } else {
         printf("failed to start scan. err = %d\n", err);
+
+        // Complete immediately with no results
+        scan_status.err = err;
+        __dmb();
+        scan_radio_done = true;
         return 1;
     }
 
-    // Give time for the scan to start
-    sleep_ms(500);
+    return 0;
+}
 
-    while (cyw43_wifi_scan_active(&cyw43_state)) {
-        // Block until scan is complete
+bool scan_wifi_radio_poll()
+{
+    if (!scan_status.active) {
+        return false;
     }
 
-    printf("\t%*c...\n", 4, ' ');
-    if (t == NBR_FIND_SCAN) {
-        // Mark whether any pidogs (uninitialized nodes) were found
-        if (strcmp(nbr_find_scan_result, NO_UNINITIALIZED_NBRS) == 0) {
-            pidogs_found = false;
-        } else {
-            pidogs_found = true;
-        };
+    // The driver may report the scan as inactive before it has really started,
+    // so don't trust it for the first SCAN_MIN_TIME microseconds.
+    if (time_us_64() - scan_status.start_time < SCAN_MIN_TIME
+        || cyw43_wifi_scan_active(&cyw43_state)) {
+        return false;
+    }
 
-        // Print the last pidog found
-        printf("\tscan result: %-30s\n", nbr_find_scan_result);
-    } else if (t == DV_ROUTE_SCAN) {
-        if (routing_scan_result != NULL) {
-            printf("\tscan result: Node #%d\n", routing_scan_result->ID);
-        } else {
-            printf("\tscan result: No un-updated nbrs are hosting APs\n");
-        }
+    scan_status.active = false;
+    __dmb();
+    scan_radio_done = true;
+
+    return true;
+}
+
+bool scan_wifi_poll()
+{
+    if (scan_status.done) {
+        return true;
     }
 
-    return 0;
+#if !NETWORK_ON_CORE1
+    // No network core to do it
+    scan_wifi_radio_poll();
+#endif
+
+    if (!scan_radio_done) {
+        return false;
+    }
+
+    // Don't read what the network core left before the flag
+    __dmb();
+    scan_wifi_finish();
+
+    return true;
+}
+
+int scan_wifi(scan_type_t t)
+{
+    net_call_t call;
+    net_call_init(&call, NET_SCAN_START, t, NULL);
+    net_call_blocking(&call);
+
+    while (!scan_wifi_poll()) {
+        // Block until scan is complete
+        sleep_ms(10);
+    }
+
+    return scan_status.err != 0;
 }
@@ -1,7 +1,15 @@
 #ifndef WIFI_SCAN_H
 #define WIFI_SCAN_H
 
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Pico
+#include "pico/cyw43_arch.h"
+
 // Local
+#include "net_core.h"
 #include "network_opts.h"
 #include "node.h"
 
@@ -11,12 +19,15 @@
 // Whether pidogs were found during a scan
 extern bool pidogs_found;
 
-// The SSID of the most recent pidog_<hex ID> wifi network
+// The SSID of the strongest pidog_<hex ID> wifi network
 extern char nbr_find_scan_result[SSID_LEN];
 
 // The neighbor which most needs my distance vector
 extern nbr_t* routing_scan_result;
 
+// Priority score of [routing_scan_result]
+extern int routing_scan_score;
+
 // Scan types
 typedef enum scan_type {
     NBR_FIND_SCAN,
@@ -31,8 +42,92 @@ enum {
     CONNECT_TO_AP = 0
 };
 
-// Scan for picow_<ID> and pidog_<hex ID> networks, returns 0 on success. Places
-// the result of the scan in the [scan_result] variable.
+// Minimum time (us) before the driver's "scan active" flag is trusted
+#define SCAN_MIN_TIME 500000
+
+// How often (us) the network core asks the driver whether a scan is done, it
+// doesn't signal the end of one
+#define SCAN_POLL_US 10000
+
+// When a thread waiting on a scan should look again (for PT_WAIT_EVENT_UNTIL).
+// Without the network core nobody posts EV_NET_SCAN, the thread polls.
+#if NETWORK_ON_CORE1
+#    define SCAN_WAKE_TIME() PT_NO_WAKE_TIME
+#else
+#    define SCAN_WAKE_TIME() (time_us_64() + SCAN_POLL_US)
+#endif
+
+// Completion record of the most recent scan
+typedef struct scan_status {
+    scan_type_t type;    // Type of the scan
+    bool active;         // Is the scan still running?
+    bool done;           // Are the results in place?
+    bool cached;         // Were the results taken from the scan cache?
+    bool filtered;       // Was the scan restricted to one SSID?
+    int err;             // Error code from starting the scan, 0 on success
+    uint64_t start_time; // Time the scan was started
+    uint64_t end_time;   // Time the results were published
+} scan_status_t;
+
+extern scan_status_t scan_status;
+
+// Narrows down a scan. The driver always sweeps every channel (it overwrites
+// the channel list in cyw43_wifi_scan_options_t), but naming the SSID makes
+// the chip send directed probes and only report that network. A passive scan
+// sends no probes at all, which only finds networks that beacon, such as a
+// picow whose AP the scan cache has already seen.
+typedef struct scan_filter {
+    const char* ssid; // Only look for this SSID, NULL for every SSID
+    bool passive;     // Listen for beacons instead of sending probes
+} scan_filter_t;
+
+// Fill [opts] from [filter] (NULL for a full active scan)
+void scan_options_init(cyw43_wifi_scan_options_t* opts,
+                       const scan_filter_t* filter);
+
+// Start a scan for picow_<ID> and pidog_<hex ID> networks without blocking,
+// returns 0 on success. The results are in place once scan_wifi_poll() returns
+// true. If the scan cache is fresh the radio is not used and the results are
+// in place at the first poll. Network core only (NET_SCAN_START).
+int scan_wifi_start(scan_type_t t);
+
+// Same as scan_wifi_start(), restricted by [filter]. A filtered scan is
+// answered from the cache if its SSID was seen recently, and does not refresh
+// the cache as a whole.
+int scan_wifi_start_filtered(scan_type_t t, const scan_filter_t* filter);
+
+// Network core: ask the driver whether the running scan has finished. Returns
+// true the first time it has, which hands the scan to scan_wifi_poll().
+bool scan_wifi_radio_poll();
+
+// Returns true once the scan started by scan_wifi_start() has finished. The
+// first call that sees the scan finish publishes the results. Core 0 only, it
+// never touches the driver.
+bool scan_wifi_poll();
+
+// Blocking scan through the network core for use outside of protothreads,
+// returns 0 on success.
 int scan_wifi(scan_type_t t);
 
+// Scan from inside a protothread, yielding to the other threads until the scan
+// is complete
+#define PT_SCAN_WIFI(pt, t) PT_SCAN_WIFI_FILTERED(pt, t, NULL)
+
+// Filtered version of the above. The scan is started and watched by the
+// network core (see net_core.h), the results are published by the calling
+// thread. It sleeps until the network core posts the end of the call or of
+// the scan, without the network core it looks every SCAN_POLL_US.
+#define PT_SCAN_WIFI_FILTERED(pt, t, f)                                        \
+    do {                                                                       \
+        static net_call_t scan_call;                                           \
+        net_call_init(&scan_call, NET_SCAN_START, t, NULL);                    \
+        scan_call.filter = f;                                                  \
+        if (!(net_call_poll(&scan_call) && scan_wifi_poll())) {                \
+            PT_WAIT_EVENT_UNTIL(pt, EV_NET_DONE | EV_NET_SCAN,                 \
+                                SCAN_WAKE_TIME(),                              \
+                                net_call_poll(&scan_call)                      \
+                                    && scan_wifi_poll());                      \
+        }                                                                      \
+    } while (0)
+
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 
 // C libraries
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +8,7 @@
 // Pico
 #include "boards/pico_w.h"
 #include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
 
 // Lightweight IP
 #include "lwip/ip_addr.h"
@@ -19,9 +21,15 @@
 #include "connect.h"
 #include "layout.h"
 #include "node.h"
+#include "wifi_scan.h"
 
 int access_point = true;
 
+bool station_active = false;
+
+// SSID of the running access point
+static char hosted_ssid[SSID_LEN];
+
 char dest_addr_str[IP_ADDR_LEN] = "255.255.255.255";
 
 int connected_ID = 0;
@@ -64,6 +72,21 @@ void generate_picow_ssid(char* buf, int picow_ID)
 
 #endif
 
+void generate_ap_addr(char* buf, int ID)
+{
+#if CONCURRENT_AP_STA
+    // My station joins other nodes' subnets while my AP is up, so every AP
+    // needs its own. Uninitialized nodes never host and join at the same time
+    // and keep the default subnet.
+    if (ID >= 0) {
+        snprintf(buf, IP_ADDR_LEN, "192.168.%d.1", AP_SUBNET_BASE + ID);
+        return;
+    }
+#endif
+
+    snprintf(buf, IP_ADDR_LEN, "%s", AP_ADDR);
+}
+
 int boot_ap()
 {
     // Allocate TCP server state
@@ -82,13 +105,23 @@ int boot_ap()
     printf("Access point mode enabled!\n");
     printf("\tssid         = %s\n", self.wifi_ssid);
 
+    snprintf(hosted_ssid, SSID_LEN, "%s", self.wifi_ssid);
+
+    char ap_addr[IP_ADDR_LEN];
+    generate_ap_addr(ap_addr, self.ID);
+
     // The variable 'state' is a pointer to a TCP_SERVER_T struct
     // Set up the access point IP address and mask
-    ipaddr_aton(AP_ADDR, ip_2_ip4(&state->gw));
+    ipaddr_aton(ap_addr, ip_2_ip4(&state->gw));
     ipaddr_aton(MASK_ADDR, ip_2_ip4(&mask));
 
+    // The driver always brings the AP interface up as AP_ADDR
+    struct netif* ap_netif = &cyw43_state.netif[CYW43_ITF_AP];
+    netif_set_addr(ap_netif, ip_2_ip4(&state->gw), ip_2_ip4(&mask),
+                   ip_2_ip4(&state->gw));
+
     // Configure target IP address
-    snprintf(self.ip_addr, IP_ADDR_LEN, "%s", AP_ADDR);
+    snprintf(self.ip_addr, IP_ADDR_LEN, "%s", ap_addr);
     snprintf(dest_addr_str, IP_ADDR_LEN, "%s", STATION_ADDR);
 
     // Start the Dynamic Host Configuration Protocol (DHCP) server. Even though
@@ -107,20 +140,34 @@ int boot_ap()
     // printf("My IPv4 addr = %s\n", ip4addr_ntoa(&state->gw));
 
     // Print IP address (potentially better method)
-    printf("\tMy IPv4 addr = %s\n", ip4addr_ntoa(netif_ip4_addr(netif_list)));
+    printf("\tMy IPv4 addr = %s\n", ip4addr_ntoa(netif_ip4_addr(ap_netif)));
 
     access_point = true;
 
     return 0;
 }
 
+int ensure_ap()
+{
+    if (access_point && strcmp(hosted_ssid, self.wifi_ssid) == 0) {
+        return 0;
+    }
+
+    if (access_point) {
+        shutdown_ap();
+    }
+
+    return boot_ap();
+}
+
 void shutdown_ap()
 {
     printf("Shutting down access point...");
 
     // Disable access point
     cyw43_arch_disable_ap_mode();
-    access_point = false;
+    access_point   = false;
+    hosted_ssid[0] = '\0';
 
     // Disable the DHCP server
     dhcp_server_deinit(&dhcp_server);
@@ -138,7 +185,10 @@ void boot_station()
 
     // Enable station
     cyw43_arch_enable_sta_mode();
+    station_active = true;
+#if !CONCURRENT_AP_STA
     access_point = false;
+#endif
 
     printf("success!\n");
 }
@@ -150,43 +200,102 @@ void shutdown_station()
 
     // Disable station
     cyw43_arch_disable_sta_mode();
+    station_active = false;
 
     printf("success!\n");
 }
 
+// Join [ssid] at [bssid] on [channel]. Naming the channel lets the chip skip
+// its own scan for the AP. Returns 0 once the link is up.
+static int fast_connect(char* ssid, const uint8_t* bssid, uint32_t channel)
+{
+    int err = cyw43_wifi_join(&cyw43_state, strlen(ssid), (const uint8_t*) ssid,
+                              strlen(WIFI_PASSWORD),
+                              (const uint8_t*) WIFI_PASSWORD,
+                              CYW43_AUTH_WPA2_AES_PSK, bssid, channel);
+    if (err) {
+        return err;
+    }
+
+    absolute_time_t until = make_timeout_time_ms(FAST_CONNECT_TIMEOUT_MS);
+
+    int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+    while (status != CYW43_LINK_UP) {
+        // Failed, or the AP moved. Abandon the join before falling back.
+        if (status < 0 || time_reached(until)) {
+            cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+            return 1;
+        }
+
+        sleep_ms(10);
+        status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+    }
+
+    return 0;
+}
+
 int connect_to_network(char* ssid)
 {
-    if (access_point) {
-        printf("ERROR: Can't connect to a network while in AP mode.\n");
+    if (!station_active) {
+        printf("ERROR: Can't connect to a network without the station.\n");
         return 1;
     }
 
     // Connect to the access point
     printf("Connecting to %s...", ssid);
-    if (cyw43_arch_wifi_connect_timeout_ms(ssid, WIFI_PASSWORD,
-                                           CYW43_AUTH_WPA2_AES_PSK, 30000)) {
+
+    uint64_t start = time_us_64();
+    bool fast      = false;
+
+    // Try the BSSID and channel from the last scan that saw the network
+    const ap_hint_t* hint = find_ap_hint(ssid);
+    if (hint != NULL) {
+        fast = (fast_connect(ssid, hint->bssid, hint->channel) == 0);
+        if (!fast) {
+            printf("fast connect failed...");
+        }
+    }
+    if (!fast
+        && cyw43_arch_wifi_connect_timeout_ms(ssid, WIFI_PASSWORD,
+                                              CYW43_AUTH_WPA2_AES_PSK,
+                                              CONNECT_TIMEOUT_MS)) {
         printf("failed to connect.\n");
         return 1;
     } else {
-        printf("connected!\n");
+        printf("connected in %.2f sec%s\n",
+               (float) (time_us_64() - start) / 1e6,
+               fast ? " (fast)" : "");
         printf("\tssid         = %s\n", ssid);
         printf("\tpassword     = %s\n", WIFI_PASSWORD);
 
-        // Configure target IP address
+        struct netif* sta_netif = &cyw43_state.netif[CYW43_ITF_STA];
+
+        // Configure target IP address, the access point is the gateway
+        // handed out by its DHCP server
+        snprintf(dest_addr_str, IP_ADDR_LEN, "%s",
+                 ip4addr_ntoa(netif_ip4_gw(sta_netif)));
+
+#if CONCURRENT_AP_STA
+        // Every AP has its own subnet, keep the address assigned by DHCP
+        snprintf(self.ip_addr, IP_ADDR_LEN, "%s",
+                 ip4addr_ntoa(netif_ip4_addr(sta_netif)));
+
+        printf("\tMy IPv4 addr = %s (DHCP)\n", self.ip_addr);
+#else
         snprintf(self.ip_addr, IP_ADDR_LEN, "%s", STATION_ADDR);
-        snprintf(dest_addr_str, IP_ADDR_LEN, "%s", AP_ADDR);
 
         // Print address assigned by DHCP
         printf("\tMy IPv4 addr = %s (DHCP) --> ",
-               ip4addr_ntoa(netif_ip4_addr(netif_list)));
+               ip4addr_ntoa(netif_ip4_addr(sta_netif)));
 
         // Set local address, override the address assigned by DHCP
         ip_addr_t ip;
         ipaddr_aton(STATION_ADDR, &ip);
-        netif_set_ipaddr(netif_default, &ip);
+        netif_set_ipaddr(sta_netif, &ip);
 
         // Print new local address
-        printf("%s (new)\n", ip4addr_ntoa(netif_ip4_addr(netif_list)));
+        printf("%s (new)\n", ip4addr_ntoa(netif_ip4_addr(sta_netif)));
+#endif
 
         return 0;
     }
@@ -46,15 +46,17 @@
 // UDP constants
 #define UDP_PORT 4444 // Same port number on both devices
 
+// The one UDP PCB, shared by the send, ack and recv paths. It's bound to every
+// interface, so it outlives the AP/station switches.
+static struct udp_pcb* udp_pcb = NULL;
+
 // UDP recv
 char recv_data[UDP_MSG_LEN_MAX];
-static struct udp_pcb* udp_recv_pcb;
 struct pt_sem new_udp_recv_s;
 
 // UDP send
 packet_t send_queue;
 static ip_addr_t dest_addr;
-static struct udp_pcb* udp_send_pcb;
 struct pt_sem new_udp_send_s;
 
 // UDP ack
@@ -62,7 +64,6 @@ packet_t ack_queue;
 bool ack_queue_empty              = true;
 char return_addr_str[IP_ADDR_LEN] = "255.255.255.255";
 static ip_addr_t return_addr;
-static struct udp_pcb* udp_ack_pcb;
 struct pt_sem new_udp_ack_s;
 
 /*
@@ -112,26 +113,31 @@ void udp_recv_callback(void* arg, struct udp_pcb* upcb, struct pbuf* p,
     }
 }
 
-// Define the recv callback function
+// Create the UDP PCB and define the recv callback function, once. The PCB is
+// bound to IP_ANY_TYPE rather than to an address, so it receives on whichever
+// interface is up and survives re_init_cyw43() (lwIP is only initialized
+// once).
 int udp_recv_callback_init(void)
 {
-    // Create a new UDP PCB
-    udp_recv_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (udp_pcb != NULL) {
+        return 0;
+    }
 
-    if (udp_recv_pcb != NULL) {
-        err_t err;
+    // Create a new UDP PCB
+    udp_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
 
-        // Bind the UDP PCB to the socket
-        // - netif_ip4_addr returns the pico-w ip address
-        err = udp_bind(udp_recv_pcb, netif_ip4_addr(netif_list),
-                       UDP_PORT); // DHCP addr
+    if (udp_pcb != NULL) {
+        // Receive on every interface, whatever its address
+        err_t err = udp_bind(udp_pcb, IP_ANY_TYPE, UDP_PORT);
 
         if (err == ERR_OK) {
             // This function assigns the callback function for when a UDP
             // packet is received
-            udp_recv(udp_recv_pcb, udp_recv_callback, NULL);
+            udp_recv(udp_pcb, udp_recv_callback, NULL);
         } else {
             printf("UDP bind error\n");
+            udp_remove(udp_pcb);
+            udp_pcb = NULL;
             return 1;
         }
     } else {
@@ -176,11 +182,20 @@ static PT_THREAD(protothread_connect(struct pt* pt))
         // Reset error code
         connect_err = 0;
 
-        if (access_point) {
+        if (!station_active) {
+#if CONCURRENT_AP_STA
+            // My AP stays up, only restarted if I've been given an ID since
+            // it was booted
+            if (self.ID != DEFAULT_ID) {
+                generate_picow_ssid(self.wifi_ssid, self.ID);
+            }
+            ensure_ap();
+#else
             // Disable access point
             shutdown_ap();
+#endif
 
-#if RE_INIT_CYW43_BETWEEN_MODES
+#if RE_INIT_CYW43_BETWEEN_MODES && !CONCURRENT_AP_STA
             // Re-initialize Wifi chip
             cyw43_arch_deinit();
             printf("Initializing cyw43...");
@@ -195,9 +210,6 @@ static PT_THREAD(protothread_connect(struct pt* pt))
             // Enable station
             boot_station();
 
-            // Set dest addr to the access point
-            snprintf(dest_addr_str, IP_ADDR_LEN, "%s", AP_ADDR);
-
             if (target_ID == RUN_SCAN) {
                 printf("Waiting for nearby APs to boot:\n\t");
                 sleep_ms_progress_bar(2000, 30);
@@ -281,7 +293,7 @@ static PT_THREAD(protothread_connect(struct pt* pt))
                 // Disable station
                 shutdown_station();
 
-#if RE_INIT_CYW43_BETWEEN_MODES
+#if RE_INIT_CYW43_BETWEEN_MODES && !CONCURRENT_AP_STA
                 // Re-initialize Wifi chip
                 cyw43_arch_deinit();
                 printf("Initializing cyw43...");
@@ -292,26 +304,18 @@ static PT_THREAD(protothread_connect(struct pt* pt))
                     printf("initialized!\n");
                 }
 #endif
-                // Turn on the access point
+                // Turn on the access point (it's already up, under my old
+                // SSID, with CONCURRENT_AP_STA)
                 generate_picow_ssid(self.wifi_ssid, self.ID);
 
-                boot_ap();
+                ensure_ap();
 
                 connected_ID = ENABLE_AP;
             }
         }
 
-        // Re-initialize UDP recv callback function
-        udp_remove(udp_recv_pcb);
-        printf("Initializing recv callback...");
-        if (udp_recv_callback_init()) {
-            printf("receive callback failed to initialize.");
-        } else {
-            printf("success!\n");
-        }
-
         // Print list of neighbors
-        if (self.knows_nbrs && access_point) {
+        if (self.knows_nbrs && !station_active) {
             // Print list of neighbors
             print_neighbors();
         }
@@ -329,13 +333,6 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
 {
     PT_BEGIN(pt);
 
-    // Create a new UDP PCB
-    udp_send_pcb = udp_new();
-
-    // Assign port numbers
-    udp_send_pcb->remote_port = UDP_PORT;
-    udp_send_pcb->local_port  = UDP_PORT;
-
     // Outgoing packet
     static packet_t send_buf;
 
@@ -385,7 +382,7 @@ static PT_THREAD(protothread_udp_send(struct pt* pt))
 
         // Send packet
         // cyw43_arch_lwip_begin();
-        er = udp_sendto(udp_send_pcb, p, &dest_addr, UDP_PORT);
+        er = udp_sendto(udp_pcb, p, &dest_addr, UDP_PORT);
         // cyw43_arch_lwip_end();
 
         if (er == ERR_OK) {
@@ -527,13 +524,6 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
 {
     PT_BEGIN(pt);
 
-    // Create a new UDP PCB
-    udp_ack_pcb = udp_new();
-
-    // Assign port numbers
-    udp_ack_pcb->remote_port = UDP_PORT;
-    udp_ack_pcb->local_port  = UDP_PORT;
-
     // Outgoing packet
     static packet_t ack_buf;
 
@@ -580,7 +570,7 @@ static PT_THREAD(protothread_udp_ack(struct pt* pt))
 
         // Send packet
         // cyw43_arch_lwip_begin();
-        er = udp_sendto(udp_ack_pcb, p, &return_addr, UDP_PORT);
+        er = udp_sendto(udp_pcb, p, &return_addr, UDP_PORT);
         // cyw43_arch_lwip_end();
 
         // The thread protothread_connect waits on this flag
@@ -732,7 +722,8 @@ int main()
         boot_ap();
     }
 
-    // Initialize UDP recv callback function
+    // Create the UDP PCB, it stays valid through the connect thread's
+    // AP/station switches
     printf("Initializing recv callback...");
     if (udp_recv_callback_init()) {
         printf("receive callback failed to initialize.");
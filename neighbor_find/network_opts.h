@@ -10,4 +10,10 @@
 // Max IP address length (slightly bigger than an IPv4 address)
 #define IP_ADDR_LEN 20
 
+// Keep my access point up while joining neighbors as a station, instead of
+// switching between the two for every hop. Each AP then needs a subnet of its
+// own, node <ID> hosts 192.168.<AP_SUBNET_BASE + ID>.1.
+#define CONCURRENT_AP_STA false
+#define AP_SUBNET_BASE    10
+
 #endif
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef SEEN_SET_H
+#define SEEN_SET_H
+
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+// Number of slots, a power of two. Only SEEN_SET_MAX of them are filled so
+// that probe sequences stay short.
+#define SEEN_SET_SIZE 64
+#define SEEN_SET_MAX  (SEEN_SET_SIZE * 3 / 4)
+
+// Open-addressing hash set of the nodes seen during a scan. A node is
+// identified by the kind of its SSID and the ID in it, so a picow's decimal ID
+// and a pidog's hex ID never collide.
+typedef struct seen_set {
+    uint64_t IDs[SEEN_SET_SIZE];  // ID of each slot
+    uint8_t kinds[SEEN_SET_SIZE]; // Kind of each slot + 1, 0 if empty
+    int count;                    // Number of filled slots
+    int overflows;                // Inserts turned away because it was full
+} seen_set_t;
+
+// Results of seen_set_insert()
+typedef enum seen_result {
+    SEEN_NEW,    // First time this node was seen
+    SEEN_REPEAT, // Already in the set
+    SEEN_FULL    // Not in the set, and there is no room to add it
+} seen_result_t;
+
+// Empty the set
+void seen_set_clear(seen_set_t* set);
+
+// Add the node ([kind], [ID]) to the set
+seen_result_t seen_set_insert(seen_set_t* set, uint8_t kind, uint64_t ID);
+
+#endif
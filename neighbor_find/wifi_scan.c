@@ -12,27 +12,50 @@
 // Local
 #include "layout.h"
 #include "node.h"
+#include "seen_set.h"
 #include "wifi_scan.h"
 
 bool pidogs_found;
 
 char scan_result[SSID_LEN];
 
-// Track unique SSIDs during a scan
-int num_unique_results = 0;
-uint64_t unique_results[MAX_NODES];
+// Kinds of node identity in the seen set
+enum {
+    SEEN_PICOW,
+    SEEN_PIDOG
+};
 
-// Returns true if the specified ID has not been encountered during this scan
-bool id_is_not_a_repeat(uint64_t id)
+// Nodes seen during the current scan, so each one is only reported once
+static seen_set_t seen_nodes;
+
+// BSSID and channel of the networks seen by scans, oldest replaced first
+static ap_hint_t ap_hints[NUM_AP_HINTS];
+static int next_ap_hint = 0;
+
+const ap_hint_t* find_ap_hint(const char* ssid)
 {
-    for (int i = 0; i < num_unique_results; i++) {
-        if (unique_results[i] == id) {
-            // Match found
-            return false;
+    for (int i = 0; i < NUM_AP_HINTS; i++) {
+        if (strncmp(ap_hints[i].ssid, ssid, SSID_LEN) == 0) {
+            return &ap_hints[i];
         }
     }
 
-    return true;
+    return NULL;
+}
+
+// Remember where [result] was seen
+static void remember_ap(const cyw43_ev_scan_result_t* result)
+{
+    ap_hint_t* hint = (ap_hint_t*) find_ap_hint((const char*) result->ssid);
+
+    if (hint == NULL) {
+        hint         = &ap_hints[next_ap_hint];
+        next_ap_hint = (next_ap_hint + 1) % NUM_AP_HINTS;
+        snprintf(hint->ssid, SSID_LEN, "%s", result->ssid);
+    }
+
+    memcpy(hint->bssid, result->bssid, sizeof(hint->bssid));
+    hint->channel = result->channel;
 }
 
 // Scan callback function
@@ -70,15 +93,16 @@ static int scan_callback(void* env, const cyw43_ev_scan_result_t* result)
             // Get the ID - <ID> if picow_<ID> / <hex ID> if pidog_<hex ID>
             token = strtok(NULL, "_");
 
+            if (is_visible) {
+                remember_ap(result);
+            }
+
             if (result_is_pidog && is_visible) {
                 // Convert the hexadecimal ID to a uint64_t
                 uint64_t id = strtoull(token, NULL, 16);
 
-                if (id_is_not_a_repeat(id)) {
-                    // Log unique result
-                    unique_results[num_unique_results] = id;
-                    num_unique_results++;
-
+                if (seen_set_insert(&seen_nodes, SEEN_PIDOG, id)
+                    != SEEN_REPEAT) {
                     // Write SSID to scan_result
                     snprintf(scan_result, SSID_LEN, "%s", result->ssid);
 
@@ -90,11 +114,13 @@ static int scan_callback(void* env, const cyw43_ev_scan_result_t* result)
                 // Convert the decimal ID to an integer
                 int id = atoi(token);
 
-                if (id_is_not_a_repeat(id)) {
-                    // Log unique result
-                    unique_results[num_unique_results] = id;
-                    num_unique_results++;
+                // Ignore IDs that can't be in the network
+                if (id < 0 || id >= MAX_NODES) {
+                    return 0;
+                }
 
+                if (seen_set_insert(&seen_nodes, SEEN_PICOW, id)
+                    != SEEN_REPEAT) {
                     printf("\tssid: %-*s rssi: %4d  <-- ID = %d\n", SSID_LEN,
                            result->ssid, result->rssi, id);
                 }
@@ -122,11 +148,8 @@ int scan_wifi()
     // Clear last scan result
     snprintf(scan_result, SSID_LEN, "%s", NO_UNINITIALIZED_NBRS);
 
-    // Reset list of seen IDs
-    num_unique_results = 0;
-    for (int i = 0; i < MAX_NODES; i++) {
-        unique_results[i] = 0;
-    }
+    // Reset the set of seen nodes
+    seen_set_clear(&seen_nodes);
 
     printf("Starting scan...");
 
@@ -157,6 +180,10 @@ int scan_wifi()
 
     // Print the last pidog found
     printf("\t%*c...\n", 4, ' ');
+    if (seen_nodes.overflows > 0) {
+        printf("\t(%d more nodes than the scan can track)\n",
+               seen_nodes.overflows);
+    }
     printf("\tscan result: %-30s\n", scan_result);
 
     return 0;
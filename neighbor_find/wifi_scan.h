@@ -1,6 +1,10 @@
 #ifndef WIFI_SCAN_H
 #define WIFI_SCAN_H
 
+// C Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
 // Local
 #include "network_opts.h"
 
@@ -13,6 +17,19 @@ extern bool pidogs_found;
 // The SSID of the most recent pidog_<hex ID> wifi network
 extern char scan_result[SSID_LEN];
 
+// Number of networks remembered for fast reconnects
+#define NUM_AP_HINTS 8
+
+// Where a picow/pidog network was last seen
+typedef struct ap_hint {
+    char ssid[SSID_LEN];
+    uint8_t bssid[6];
+    uint16_t channel;
+} ap_hint_t;
+
+// Returns where [ssid] was last seen, NULL if no scan has seen it
+const ap_hint_t* find_ap_hint(const char* ssid);
+
 // Non-ID scan targets
 enum {
     RUN_SCAN  = -2,